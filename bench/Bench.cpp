@@ -0,0 +1,482 @@
+/**
+ *@file Bench.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ERROR_WRITE(...) fprintf(stderr, __VA_ARGS__)
+
+#define BENCH_VERSION       (1)     // Bumped when the JSON changes shape
+#define BENCH_COUNT         (2000)  // Exchanges in each run unless told otherwise
+#define BENCH_WARMUP        (16)    // Exchanges before each run, ARP and first allocations out of the way
+#define BENCH_TIMEOUT_NS    (1000000000ULL)
+#define BENCH_PATH          "/NekoNet"
+#define BENCH_DNS_CLIENT    PEER_ADDRESS(200)   // Outside the DHCP pool
+#define BENCH_HTTP_CLIENT   PEER_ADDRESS(201)
+#define BENCH_MAC_OUI       (0x02424E)          // Locally administered, the rest counts up per client
+#define BENCH_BOOTP_MIN     (300)               // Clients pad their messages to the BOOTP size
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <NekoNet.h>
+#include <DHCP.hpp>
+#include <DNS.hpp>
+#include <TCP.hpp>
+
+#include <Connection.hpp>
+#include <Measure.hpp>
+#include <Peer.hpp>
+
+typedef struct BENCH_OPTIONS_T_ {
+    size_t count;
+    bool instructions;
+    const char* path;
+    const char* output;
+    const char* only;
+} BENCH_OPTIONS_T;
+
+typedef struct BENCH_QUERY_T_ {
+    const char* name;
+    uint16_t type;
+    const char* label;
+} BENCH_QUERY_T;
+
+// What a phone joining the portal asks, in about the proportions it asks it
+static const BENCH_QUERY_T QUERIES[] = {
+    { "connectivitycheck.gstatic.com",  DNS_TYPE_A,     "A" },
+    { "connectivitycheck.gstatic.com",  DNS_TYPE_AAAA,  "AAAA" },
+    { "captive.apple.com",              DNS_TYPE_HTTPS, "HTTPS" },
+    { "neko.local",                     DNS_TYPE_A,     "A local" },
+    { "use-application-dns.net",        DNS_TYPE_A,     "A NXDOMAIN" },
+    { "1.4.168.192.in-addr.arpa",       DNS_TYPE_PTR,   "PTR" },
+    { "neko.local",                     DNS_TYPE_ANY,   "ANY" },
+};
+#define BENCH_QUERIES (sizeof(QUERIES) / sizeof(QUERIES[0]))
+
+static BENCH_OPTIONS_T options = { BENCH_COUNT, false, BENCH_PATH, NULL, NULL };
+static int failures;
+
+static bool Wanted(const char* run) {
+    return options.only == NULL || strcmp(options.only, run) == 0;
+}
+
+/**
+ * @brief Instructions per frame given to the board, or null when not counting.
+ *
+ * @param out
+ * @param peer
+ * @param sent Frames on the wire when the run started
+ */
+static void WriteInstructions(FILE* out, const BENCH_PEER& peer, uint32_t sent) {
+    uint32_t frames = peer.sent - sent;
+    if (!INSTRUCTION_COUNTER::Enabled() || frames == 0) {
+        fprintf(out, "\"instructions_per_packet\": null");
+        return;
+    }
+    fprintf(out, "\"instructions_per_packet\": %.1f", (double)INSTRUCTION_COUNTER::Read() / frames);
+}
+
+static void BeginRun(BENCH_PEER* peer, uint32_t* sent, uint64_t* start) {
+    INSTRUCTION_COUNTER::Reset();
+    *sent = peer->sent;
+    *start = MeasureNanos();
+}
+
+static double PerSecond(size_t count, uint64_t start) {
+    uint64_t elapsed = MeasureNanos() - start;
+    return elapsed == 0 ? 0 : count * 1e9 / elapsed;
+}
+
+static size_t DhcpMessage(uint8_t* buffer, uint8_t type, uint32_t xid, uint32_t client, uint32_t requested,
+    uint32_t ciaddr) {
+    Message* msg = (Message*)buffer;
+    memset(msg, 0, sizeof(Message));
+    msg->op = BOOTREQUEST;
+    msg->htype = 1;
+    msg->hlen = 6;
+    msg->xid = lwip_htonl(xid);
+
+    uint8_t* o = msg->chaddr;
+    *o++ = BENCH_MAC_OUI >> 16;
+    *o++ = BENCH_MAC_OUI >> 8 & 0xFF;
+    *o++ = BENCH_MAC_OUI & 0xFF;
+    *o++ = client >> 16 & 0xFF;
+    *o++ = client >> 8 & 0xFF;
+    *o++ = client & 0xFF;
+    DnsPut32(msg->ciaddr, ciaddr);
+
+    uint8_t* opt = msg->options;
+    opt = DnsPut32(opt, DHCP_MAGIC_COOKIE);
+    DHCP_SERVER::Write(&opt, DHCP_OPT_MSG_TYPE, type);
+    if (requested != 0) DHCP_SERVER::Write(&opt, DHCP_OPT_REQUESTED_IP, requested);
+    if (type != DHCPDISCOVER) DHCP_SERVER::Write(&opt, DHCP_OPT_SERVER_ID, (uint32_t)PEER_SERVER);
+    *opt++ = DHCP_OPT_END;
+
+    // Padded to the BOOTP minimum like real clients
+    size_t len = opt - buffer;
+    return len < BENCH_BOOTP_MIN ? BENCH_BOOTP_MIN : len;
+}
+
+/**
+ * @brief Waits for the reply to xid and returns its message type.
+ *
+ * @param peer
+ * @param xid
+ * @param yiaddr
+ * @return uint8_t 0 on timeout
+ */
+static uint8_t DhcpReply(BENCH_PEER* peer, uint32_t xid, uint32_t* yiaddr) {
+    uint64_t deadline = MeasureNanos() + BENCH_TIMEOUT_NS;
+
+    while (MeasureNanos() < deadline) {
+        size_t len;
+        const uint8_t* reply = peer->AwaitUdp(PORT_DHCP_CLIENT, &len, BENCH_TIMEOUT_NS);
+        if (reply == NULL) return 0;
+
+        DHCP_OPTION_INDEX_T index;
+        if (len < DHCP_OPTIONS_OFFSET || DnsGet32(reply + offsetof(Message, xid)) != xid) continue;
+        if (!DHCP_SERVER::Index(reply, len, &index)) continue;
+
+        const uint8_t* type = DHCP_SERVER::Option(reply, &index, DHCP_SLOT_MSG_TYPE, 1);
+        if (type == NULL) continue;
+        *yiaddr = DnsGet32(reply + offsetof(Message, yiaddr));
+        return type[0];
+    }
+    return 0;
+}
+
+/**
+ * @brief One DORA from a new client, then a RELEASE so the pool never runs dry.
+ *
+ * @return bool false if the board did not offer or acknowledge
+ */
+static bool Dora(BENCH_PEER* peer, uint32_t client, LATENCY_SAMPLES* offer, LATENCY_SAMPLES* ack) {
+    static Message message;
+    uint8_t* buffer = (uint8_t*)&message;
+    uint32_t xid = 0x4E000000 | client;
+    uint32_t yiaddr = 0;
+
+    uint64_t start = MeasureNanos();
+    size_t len = DhcpMessage(buffer, DHCPDISCOVER, xid, client, 0, 0);
+    peer->SendUdp(0, PORT_DHCP_CLIENT, PEER_BROADCAST, PORT_DHCP_SERVER, buffer, len);
+    if (DhcpReply(peer, xid, &yiaddr) != DHCPOFFER) return false;
+    uint64_t offered = MeasureNanos();
+
+    len = DhcpMessage(buffer, DHCPREQUEST, xid, client, yiaddr, 0);
+    peer->SendUdp(0, PORT_DHCP_CLIENT, PEER_BROADCAST, PORT_DHCP_SERVER, buffer, len);
+    if (DhcpReply(peer, xid, &yiaddr) != DHCPACK) return false;
+    uint64_t acked = MeasureNanos();
+
+    // Nothing comes back, the board takes it on the next turn
+    len = DhcpMessage(buffer, DHCPRELEASE, xid, client, 0, yiaddr);
+    peer->SendUdp(yiaddr, PORT_DHCP_CLIENT, PEER_SERVER, PORT_DHCP_SERVER, buffer, len);
+
+    if (offer != NULL) offer->Add(offered - start);
+    if (ack != NULL) ack->Add(acked - offered);
+    return true;
+}
+
+static void RunDhcp(FILE* out, BENCH_PEER* peer, DHCP_SERVER* dhcp_server) {
+    LATENCY_SAMPLES offer, ack;
+    uint32_t client = 0;
+    size_t failed = 0;
+
+    for (int i = 0; i < BENCH_WARMUP; ++i) Dora(peer, ++client, NULL, NULL);
+
+    uint32_t sent;
+    uint64_t start;
+    BeginRun(peer, &sent, &start);
+    for (size_t i = 0; i < options.count; ++i) {
+        if (!Dora(peer, ++client, &offer, &ack)) failed++;
+
+        // The main loop's share of the work, outside the board's turns so not counted against the packets
+        dhcp_server->Flush();
+    }
+    double rate = PerSecond(options.count, start);
+
+    // The last RELEASE
+    peer->Pump();
+
+    fprintf(out, "  \"dhcp\": {\"exchanges\": %zu, \"failed\": %zu, \"dora_per_s\": %.1f,\n", options.count, failed, rate);
+    fprintf(out, "    \"offer_us\": ");
+    offer.Write(out);
+    fprintf(out, ",\n    \"ack_us\": ");
+    ack.Write(out);
+    fprintf(out, ",\n    ");
+    WriteInstructions(out, *peer, sent);
+    fprintf(out, "},\n");
+
+    if (failed > 0) failures++;
+}
+
+static size_t DnsQuery(uint8_t* buffer, uint16_t id, const BENCH_QUERY_T* query) {
+    uint8_t* o = buffer;
+    o = DnsPut16(o, id);
+    o = DnsPut16(o, DNS_FLAG_RD);
+    o = DnsPut16(o, 1);
+    o = DnsPut16(o, 0);
+    o = DnsPut16(o, 0);
+    o = DnsPut16(o, 0);
+
+    // Labels from the dotted name
+    for (const char* label = query->name; *label != '\0';) {
+        const char* dot = strchr(label, '.');
+        size_t n = dot != NULL ? dot - label : strlen(label);
+        *o++ = n;
+        memcpy(o, label, n);
+        o += n;
+        label += n + (dot != NULL);
+    }
+    *o++ = 0;
+
+    o = DnsPut16(o, query->type);
+    o = DnsPut16(o, DNS_CLASS_IN);
+    return o - buffer;
+}
+
+/**
+ * @brief One query and its answer.
+ *
+ * @return int Response code, -1 on timeout
+ */
+static int Resolve(BENCH_PEER* peer, uint16_t id, const BENCH_QUERY_T* query) {
+    static uint8_t buffer[DNS_MAX_REPLY];
+    size_t len = DnsQuery(buffer, id, query);
+    peer->SendUdp(BENCH_DNS_CLIENT, id | 0x8000, PEER_SERVER, PORT_DNS_SERVER, buffer, len);
+
+    uint64_t deadline = MeasureNanos() + BENCH_TIMEOUT_NS;
+    while (MeasureNanos() < deadline) {
+        const uint8_t* reply = peer->AwaitUdp(id | 0x8000, &len, BENCH_TIMEOUT_NS);
+        if (reply == NULL) break;
+        if (len < sizeof(DNS_HEADER_T) || DnsGet16(reply) != id || (DnsGet16(reply + 2) & DNS_FLAG_QR) == 0) continue;
+        return DnsGet16(reply + 2) & 0x0F;
+    }
+    return -1;
+}
+
+static void RunDns(FILE* out, BENCH_PEER* peer) {
+    LATENCY_SAMPLES all, by_query[BENCH_QUERIES];
+    int rcode[BENCH_QUERIES];
+    size_t lost = 0;
+    uint16_t id = 0;
+
+    for (int i = 0; i < BENCH_WARMUP; ++i) Resolve(peer, ++id, &QUERIES[i % BENCH_QUERIES]);
+    RATE_LIMIT_STATS_T limited = DNS_SERVER::limiter.stats;
+
+    uint32_t sent;
+    uint64_t start;
+    BeginRun(peer, &sent, &start);
+    for (size_t i = 0; i < options.count; ++i) {
+        size_t q = i % BENCH_QUERIES;
+        uint64_t asked = MeasureNanos();
+
+        int code = Resolve(peer, ++id, &QUERIES[q]);
+        if (code < 0) {
+            lost++;
+            continue;
+        }
+
+        uint64_t ns = MeasureNanos() - asked;
+        all.Add(ns);
+        by_query[q].Add(ns);
+        rcode[q] = code;
+    }
+    double rate = PerSecond(options.count, start);
+    uint32_t refused = DNS_SERVER::limiter.stats.refused - limited.refused;
+    uint32_t dropped = DNS_SERVER::limiter.stats.dropped - limited.dropped;
+
+    fprintf(out, "  \"dns\": {\"queries\": %zu, \"lost\": %zu, \"rate_limit_per_s\": %u, \"refused\": %u, \"dropped\": %u,"
+        " \"qps\": %.1f,\n", options.count, lost, (unsigned)DNS_RATE_PER_S, refused, dropped, rate);
+    fprintf(out, "    \"latency_us\": ");
+    all.Write(out);
+    fprintf(out, ",\n    \"mix\": [\n");
+    for (size_t q = 0; q < BENCH_QUERIES; ++q) {
+        fprintf(out, "      {\"query\": \"%s\", \"name\": \"%s\", \"rcode\": %d, \"latency_us\": ",
+            QUERIES[q].label, QUERIES[q].name, by_query[q].Count() > 0 ? rcode[q] : -1);
+        by_query[q].Write(out);
+        fprintf(out, "}%s\n", q + 1 < BENCH_QUERIES ? "," : "");
+    }
+    fprintf(out, "    ],\n    ");
+    WriteInstructions(out, *peer, sent);
+    fprintf(out, "},\n");
+
+    // Answers held back by the limiter measure the limit, not the server
+    if (lost > 0) failures++;
+    if (refused > 0 || dropped > 0) {
+        ERROR_WRITE("BENCH: %u DNS queries rate limited, configure with -DNEKONET_DNS_RATE=1000000\n",
+            refused + dropped);
+    }
+}
+
+typedef struct BENCH_HTTP_RUN_T_ {
+    LATENCY_SAMPLES connect;
+    LATENCY_SAMPLES ttfb;
+    LATENCY_SAMPLES latency;
+    size_t failed;          // No complete response
+    size_t errors;          // A response other than 200
+    size_t connections;
+} BENCH_HTTP_RUN_T;
+
+/**
+ * @brief One request, connecting first if the last response closed the connection.
+ */
+static void Fetch(BENCH_CONNECTION* connection, const char* request, size_t len, bool keep_alive,
+    BENCH_HTTP_RUN_T* run) {
+    uint64_t began = MeasureNanos();
+    if (!connection->IsOpen()) {
+        if (!connection->Open()) {
+            run->failed++;
+            return;
+        }
+        run->connections++;
+        run->connect.Add(MeasureNanos() - began);
+    }
+
+    uint64_t asked = MeasureNanos();
+    uint64_t first;
+    int status = connection->Request(request, len, &first);
+    if (status == 0) {
+        run->failed++;
+        connection->Close();
+        return;
+    }
+    if (status != 200) run->errors++;
+    run->ttfb.Add(first);
+    run->latency.Add(MeasureNanos() - asked);
+
+    if (!keep_alive || connection->Closing()) connection->Close();
+}
+
+static void RunHttp(FILE* out, BENCH_PEER* peer, bool keep_alive, bool last) {
+    static char request[256];
+    size_t len = snprintf(request, sizeof(request),
+        "GET %s HTTP/1.1\r\nHost: 192.168.4.1\r\nUser-Agent: NekoNetBench\r\nAccept: */*\r\n%s\r\n",
+        options.path, keep_alive ? "" : "Connection: close\r\n");
+
+    BENCH_CONNECTION connection(peer, BENCH_HTTP_CLIENT);
+    BENCH_HTTP_RUN_T warmup = {}, run = {};
+
+    for (int i = 0; i < BENCH_WARMUP; ++i) Fetch(&connection, request, len, keep_alive, &warmup);
+    connection.Close();
+
+    uint32_t sent;
+    uint64_t start;
+    BeginRun(peer, &sent, &start);
+    for (size_t i = 0; i < options.count; ++i) Fetch(&connection, request, len, keep_alive, &run);
+    connection.Close();
+    double rate = PerSecond(options.count, start);
+    double churn = PerSecond(run.connections, start);
+
+    fprintf(out, "    \"%s\": {\"requests\": %zu, \"failed\": %zu, \"errors\": %zu, \"connections\": %zu,"
+        " \"rps\": %.1f, \"connections_per_s\": %.1f,\n", keep_alive ? "keep_alive" : "close",
+        options.count, run.failed, run.errors, run.connections, rate, churn);
+    fprintf(out, "      \"connect_us\": ");
+    run.connect.Write(out);
+    fprintf(out, ",\n      \"ttfb_us\": ");
+    run.ttfb.Write(out);
+    fprintf(out, ",\n      \"latency_us\": ");
+    run.latency.Write(out);
+    fprintf(out, ",\n      ");
+    WriteInstructions(out, *peer, sent);
+    fprintf(out, "}%s\n", last ? "" : ",");
+
+    if (run.failed > 0 || run.errors > 0) failures++;
+}
+
+static bool Parse(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--instructions") == 0) {
+            options.instructions = true;
+            continue;
+        }
+        if (value == NULL) return false;
+        i++;
+
+        if (strcmp(arg, "--count") == 0) options.count = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "--path") == 0) options.path = value;
+        else if (strcmp(arg, "--output") == 0) options.output = value;
+        else if (strcmp(arg, "--only") == 0) options.only = value;
+        else return false;
+    }
+    return options.count > 0;
+}
+
+int main(int argc, char** argv) {
+    if (!Parse(argc, argv)) {
+        ERROR_WRITE("usage: %s [--count N] [--instructions] [--path /route] [--only dhcp|dns|http] [--output file]\n",
+            argv[0]);
+        return 2;
+    }
+
+    // JSON keeps stdout to itself, anything the servers print goes to stderr
+    FILE* out;
+    if (options.output != NULL) {
+        out = fopen(options.output, "w");
+    } else {
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    if (out == NULL) {
+        ERROR_WRITE("BENCH: Cannot write results\n");
+        return 2;
+    }
+
+    if (options.instructions && !INSTRUCTION_COUNTER::Open()) {
+        ERROR_WRITE("BENCH: No instruction counts, %s\n", INSTRUCTION_COUNTER::Error());
+    }
+
+    // The board as main brings it up, on a wire to the peer instead of WiFi
+    cyw43_arch_init();
+    int wire = HOST_BOARD::Wire();
+    ip4_addr_t address, netmask;
+    IP4_ADDR(&address, 192, 168, 4, 1);
+    IP4_ADDR(&netmask, 255, 255, 255, 0);
+    if (wire < 0 || !HOST_BOARD::Up(&address, &netmask)) {
+        ERROR_WRITE("BENCH: No wire to the board\n");
+        return 2;
+    }
+
+    TCP_SERVER tcp_server("NekoNetBench");
+    ip_addr_t gw;
+    IP4_ADDR(ip_2_ip4(&gw), 192, 168, 4, 1);
+    tcp_server.SetGateway(&gw);
+    DHCP_SERVER dhcp_server(&tcp_server.gw, &netmask);
+    DNS_SERVER dns_server(&tcp_server.gw);
+
+    BENCH_PEER peer(wire);
+
+    fprintf(out, "{\n  \"version\": %d,\n  \"count\": %zu,\n", BENCH_VERSION, options.count);
+    fprintf(out, "  \"mode\": \"%s\",\n", INSTRUCTION_COUNTER::Enabled() ? "instructions" : "time");
+    if (options.instructions && !INSTRUCTION_COUNTER::Enabled()) {
+        fprintf(out, "  \"instructions_error\": \"%s\",\n", INSTRUCTION_COUNTER::Error());
+    }
+    fprintf(out, "  \"build\": {\"dhcp_leases\": %d, \"tcp_mss\": %d, \"tcp_pcbs\": %d, \"pbuf_pool\": %d},\n",
+        DHCPS_MAX_IP, TCP_MSS, MEMP_NUM_TCP_PCB, PBUF_POOL_SIZE);
+
+    if (Wanted("dhcp")) RunDhcp(out, &peer, &dhcp_server);
+    if (Wanted("dns")) RunDns(out, &peer);
+    fprintf(out, "  \"http\": {\n");
+    if (Wanted("http")) {
+        fprintf(out, "    \"path\": \"%s\",\n", options.path);
+        RunHttp(out, &peer, true, false);
+        RunHttp(out, &peer, false, true);
+    }
+    fprintf(out, "  }\n}\n");
+    fclose(out);
+
+    INSTRUCTION_COUNTER::Close();
+    close(wire);
+    return failures > 0 ? 1 : 0;
+}
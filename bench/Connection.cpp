@@ -0,0 +1,158 @@
+/**
+ *@file Connection.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include <lwip/prot/tcp.h>
+
+#include <Connection.hpp>
+#include <Measure.hpp>
+#include <TCP.hpp>
+
+uint16_t BENCH_CONNECTION::next_port = CONNECTION_PORT_FIRST;
+
+BENCH_CONNECTION::BENCH_CONNECTION(BENCH_PEER* peer, uint32_t address)
+    : peer(peer), address(address), port(0), open(false), fin(false), closing(false) {}
+
+bool BENCH_CONNECTION::Open() {
+    // A port the board still holds in TIME_WAIT comes round again long after it is reused
+    port = next_port;
+    next_port = next_port == 0xFFFF ? CONNECTION_PORT_FIRST : next_port + 1;
+    open = false;
+    fin = false;
+    closing = false;
+
+    snd_nxt = (uint32_t)MeasureNanos() * 2654435761U;
+    if (!peer->SendTcp(address, port, TCP_PORT, snd_nxt, 0, TCP_SYN, NULL, 0)) return false;
+    snd_nxt++;
+
+    PEER_SEGMENT_T segment;
+    if (!peer->AwaitTcp(port, &segment, CONNECTION_TIMEOUT_NS)) return false;
+    if ((segment.flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK) || segment.ack != snd_nxt) {
+        if ((segment.flags & TCP_RST) == 0) peer->SendTcp(address, port, TCP_PORT, segment.ack, 0, TCP_RST, NULL, 0);
+        return false;
+    }
+
+    snd_una = segment.ack;
+    rcv_nxt = segment.seq + 1;
+    Acknowledge();
+    open = true;
+    return true;
+}
+
+void BENCH_CONNECTION::Acknowledge() {
+    peer->SendTcp(address, port, TCP_PORT, snd_nxt, rcv_nxt, TCP_ACK, NULL, 0);
+}
+
+void BENCH_CONNECTION::Parse() {
+    if (strncmp(header, "HTTP/1.", 7) == 0) status = atoi(header + 9);
+
+    for (const char* line = strstr(header, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+        const char* field = line + 2;
+        if (strncasecmp(field, "Content-Length:", 15) == 0) length = atoi(field + 15);
+        if (strncasecmp(field, "Connection:", 11) == 0) closing = strncasecmp(field + 11, " close", 6) == 0;
+    }
+}
+
+bool BENCH_CONNECTION::Receive() {
+    PEER_SEGMENT_T segment;
+    if (!peer->AwaitTcp(port, &segment, CONNECTION_TIMEOUT_NS)) return false;
+
+    if (segment.flags & TCP_RST) {
+        open = false;
+        return false;
+    }
+    if ((segment.flags & TCP_ACK) && (int32_t)(segment.ack - snd_una) > 0) snd_una = segment.ack;
+
+    bool took = segment.length > 0 || (segment.flags & TCP_FIN);
+    if (segment.seq != rcv_nxt) {
+        // Nothing is lost on the wire, a repeat is answered with where we are
+        if (took) Acknowledge();
+        return true;
+    }
+
+    if (segment.length > 0) {
+        if (first_byte == 0) first_byte = MeasureNanos();
+
+        size_t take = 0;
+        if (!headed) {
+            take = CONNECTION_HEADER_MAX - 1 - header_len;
+            if (take > segment.length) take = segment.length;
+            memcpy(header + header_len, segment.payload, take);
+            header_len += take;
+            header[header_len] = '\0';
+
+            const char* end = strstr(header, "\r\n\r\n");
+            if (end != NULL) {
+                size_t head = end + 4 - header;
+                headed = true;
+                received = header_len - head;
+                header[head] = '\0';
+                Parse();
+            }
+        }
+        if (headed) received += segment.length - take;
+        rcv_nxt += segment.length;
+    }
+
+    if (segment.flags & TCP_FIN) {
+        rcv_nxt++;
+        fin = true;
+    }
+    if (took) Acknowledge();
+    return true;
+}
+
+int BENCH_CONNECTION::Request(const char* request, size_t len, uint64_t* ttfb_ns) {
+    if (!open) return 0;
+
+    header_len = 0;
+    headed = false;
+    status = 0;
+    length = -1;
+    received = 0;
+    first_byte = 0;
+
+    uint64_t sent = MeasureNanos();
+    if (!peer->SendTcp(address, port, TCP_PORT, snd_nxt, rcv_nxt, TCP_PSH | TCP_ACK, request, len)) return 0;
+    snd_nxt += len;
+
+    // Without a length the body ends when the board closes
+    while (!(headed && length >= 0 && received >= (size_t)length) && !fin) {
+        if (!Receive()) return 0;
+    }
+
+    if (!headed || (length >= 0 && received < (size_t)length)) return 0;
+    *ttfb_ns = first_byte - sent;
+    return status;
+}
+
+void BENCH_CONNECTION::Close() {
+    if (!open) return;
+
+    // The board said it would close, let it go first like a browser does
+    if (closing) {
+        while (!fin) {
+            if (!Receive()) break;
+        }
+    }
+
+    peer->SendTcp(address, port, TCP_PORT, snd_nxt, rcv_nxt, TCP_FIN | TCP_ACK, NULL, 0);
+    snd_nxt++;
+
+    // Done once our FIN is acknowledged and the board has closed its side
+    while (snd_una != snd_nxt || !fin) {
+        if (!Receive()) break;
+    }
+    open = false;
+}
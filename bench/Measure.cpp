@@ -0,0 +1,112 @@
+/**
+ *@file Measure.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define COUNTER_CALIBRATION (1000)  // Empty Start and Stop pairs averaged for the overhead
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <Measure.hpp>
+
+int INSTRUCTION_COUNTER::fd = -1;
+const char* INSTRUCTION_COUNTER::error = "not requested";
+uint64_t INSTRUCTION_COUNTER::windows;
+uint64_t INSTRUCTION_COUNTER::overhead;
+
+double LATENCY_SAMPLES::Percentile(double percent) const {
+    if (samples.empty()) return 0;
+
+    if (sorted.size() != samples.size()) {
+        sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+    }
+
+    size_t rank = (size_t)std::ceil(percent / 100 * sorted.size());
+    if (rank == 0) rank = 1;
+    if (rank > sorted.size()) rank = sorted.size();
+    return sorted[rank - 1] / 1000.0;
+}
+
+void LATENCY_SAMPLES::Write(FILE* out) const {
+    fprintf(out, "{\"count\": %zu, \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}",
+        samples.size(), Percentile(50), Percentile(99), Percentile(100));
+}
+
+bool INSTRUCTION_COUNTER::Open() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // This thread on any CPU, the board and the peer share it so only the board's turns are counted
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        error = errno == EACCES || errno == EPERM ? "perf events not permitted, see perf_event_paranoid"
+            : errno == ENOENT || errno == EOPNOTSUPP ? "no instruction counter on this CPU"
+            : "perf_event_open failed";
+        return false;
+    }
+    error = NULL;
+
+    // Enabling and disabling retire a few user instructions of their own
+    Reset();
+    for (int i = 0; i < COUNTER_CALIBRATION; ++i) {
+        Start();
+        Stop();
+    }
+    overhead = 0;
+    overhead = Read() / COUNTER_CALIBRATION;
+    Reset();
+    return true;
+}
+
+void INSTRUCTION_COUNTER::Close() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+void INSTRUCTION_COUNTER::Start() {
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void INSTRUCTION_COUNTER::Stop() {
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    windows++;
+}
+
+void INSTRUCTION_COUNTER::Reset() {
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    windows = 0;
+}
+
+uint64_t INSTRUCTION_COUNTER::Read() {
+    if (fd < 0) return 0;
+
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+
+    uint64_t own = windows * overhead;
+    return count > own ? count - own : 0;
+}
@@ -0,0 +1,228 @@
+/**
+ *@file Peer.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ARP_HLEN    (28)    // Ethernet and IPv4 addresses only
+#define TCP_MSS_OPT (4)     // Kind, length and the MSS itself, only on SYN
+
+#include <cstring>
+
+#include <unistd.h>
+
+#include <lwip/prot/ethernet.h>
+#include <lwip/prot/ip.h>
+#include <lwip/prot/ip4.h>
+#include <lwip/prot/tcp.h>
+#include <lwip/prot/udp.h>
+
+#include <Measure.hpp>
+#include <Peer.hpp>
+
+// Locally administered, one MAC for every client the peer plays
+static const uint8_t PEER_MAC[ETH_HWADDR_LEN] = { 0x02, 0x42, 0x4E, 0x4B, 0x00, 0x02 };
+static const uint8_t BROADCAST_MAC[ETH_HWADDR_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static uint8_t* Put16(uint8_t* out, uint16_t value) {
+    *out++ = value >> 8;
+    *out++ = value & 0xFF;
+    return out;
+}
+
+static uint8_t* Put32(uint8_t* out, uint32_t value) {
+    out = Put16(out, value >> 16);
+    return Put16(out, value & 0xFFFF);
+}
+
+static uint16_t Get16(const uint8_t* in) {
+    return in[0] << 8 | in[1];
+}
+
+static uint32_t Get32(const uint8_t* in) {
+    return (uint32_t)Get16(in) << 16 | Get16(in + 2);
+}
+
+BENCH_PEER::BENCH_PEER(int fd) : sent(0), pumps(0), fd(fd), id(0), in_len(0) {}
+
+uint32_t BENCH_PEER::Sum(const uint8_t* data, size_t len, uint32_t sum) {
+    for (size_t i = 0; i + 1 < len; i += 2) sum += Get16(data + i);
+    if (len & 1) sum += data[len - 1] << 8;
+    return sum;
+}
+
+uint16_t BENCH_PEER::Fold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum & 0xFFFF;
+}
+
+size_t BENCH_PEER::Ip(uint32_t source, uint32_t dest, uint8_t protocol, size_t payload_len) {
+    uint8_t* eth = out;
+    memcpy(eth, dest == PEER_BROADCAST ? BROADCAST_MAC : HOST_BOARD::Interface()->hwaddr, ETH_HWADDR_LEN);
+    memcpy(eth + ETH_HWADDR_LEN, PEER_MAC, ETH_HWADDR_LEN);
+    Put16(eth + 2 * ETH_HWADDR_LEN, ETHTYPE_IP);
+
+    uint8_t* ip = out + SIZEOF_ETH_HDR;
+    uint8_t* o = ip;
+    *o++ = 0x45;
+    *o++ = 0;
+    o = Put16(o, IP_HLEN + payload_len);
+    o = Put16(o, id++);
+    o = Put16(o, IP_DF);
+    *o++ = 64;
+    *o++ = protocol;
+    o = Put16(o, 0);
+    o = Put32(o, source);
+    Put32(o, dest);
+    Put16(ip + 10, Fold(Sum(ip, IP_HLEN, 0)));
+
+    return SIZEOF_ETH_HDR + IP_HLEN;
+}
+
+bool BENCH_PEER::Send(size_t len) {
+    sent++;
+    return write(fd, out, len) == (ssize_t)len;
+}
+
+bool BENCH_PEER::SendUdp(uint32_t source, uint16_t sport, uint32_t dest, uint16_t dport, const void* data,
+    size_t len) {
+    if (SIZEOF_ETH_HDR + IP_HLEN + UDP_HLEN + len > sizeof(out)) return false;
+
+    size_t at = Ip(source, dest, IP_PROTO_UDP, UDP_HLEN + len);
+    uint8_t* udp = out + at;
+    uint8_t* o = Put16(udp, sport);
+    o = Put16(o, dport);
+    o = Put16(o, UDP_HLEN + len);
+    o = Put16(o, 0);
+    memcpy(o, data, len);
+
+    // Pseudo header, then the datagram, 0 would mean no checksum at all
+    uint32_t sum = Sum(out + SIZEOF_ETH_HDR + 12, 8, IP_PROTO_UDP + UDP_HLEN + len);
+    uint16_t check = Fold(Sum(udp, UDP_HLEN + len, sum));
+    Put16(udp + 6, check == 0 ? 0xFFFF : check);
+
+    return Send(at + UDP_HLEN + len);
+}
+
+bool BENCH_PEER::SendTcp(uint32_t source, uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack, uint8_t flags,
+    const void* data, size_t len) {
+    size_t header = TCP_HLEN + (flags & TCP_SYN ? TCP_MSS_OPT : 0);
+    if (SIZEOF_ETH_HDR + IP_HLEN + header + len > sizeof(out)) return false;
+
+    size_t at = Ip(source, PEER_SERVER, IP_PROTO_TCP, header + len);
+    uint8_t* tcp = out + at;
+    uint8_t* o = Put16(tcp, sport);
+    o = Put16(o, dport);
+    o = Put32(o, seq);
+    o = Put32(o, flags & TCP_ACK ? ack : 0);
+    *o++ = header / 4 << 4;
+    *o++ = flags;
+    o = Put16(o, PEER_WINDOW);
+    o = Put16(o, 0);
+    o = Put16(o, 0);
+    if (flags & TCP_SYN) {
+        *o++ = 2;
+        *o++ = TCP_MSS_OPT;
+        o = Put16(o, TCP_MSS);
+    }
+    memcpy(o, data, len);
+
+    uint32_t sum = Sum(out + SIZEOF_ETH_HDR + 12, 8, IP_PROTO_TCP + header + len);
+    Put16(tcp + 16, Fold(Sum(tcp, header + len, sum)));
+
+    return Send(at + header + len);
+}
+
+void BENCH_PEER::Pump() {
+    pumps++;
+    INSTRUCTION_COUNTER::Start();
+    HOST_BOARD::Poll(0);
+    INSTRUCTION_COUNTER::Stop();
+}
+
+bool BENCH_PEER::Next() {
+    while (true) {
+        ssize_t len = read(fd, in, sizeof(in));
+        if (len <= 0) return false;
+        if (len < SIZEOF_ETH_HDR) continue;
+
+        uint16_t type = Get16(in + 2 * ETH_HWADDR_LEN);
+        if (type == ETHTYPE_IP && len >= SIZEOF_ETH_HDR + IP_HLEN) {
+            in_len = len;
+            return true;
+        }
+        if (type != ETHTYPE_ARP || len < SIZEOF_ETH_HDR + ARP_HLEN) continue;
+
+        // Every client the peer plays is behind the one MAC
+        const uint8_t* arp = in + SIZEOF_ETH_HDR;
+        if (Get16(arp + 6) != 1 || Get32(arp + 24) == PEER_SERVER) continue;
+
+        memcpy(out, arp + 8, ETH_HWADDR_LEN);
+        memcpy(out + ETH_HWADDR_LEN, PEER_MAC, ETH_HWADDR_LEN);
+        Put16(out + 2 * ETH_HWADDR_LEN, ETHTYPE_ARP);
+
+        uint8_t* reply = out + SIZEOF_ETH_HDR;
+        memcpy(reply, arp, 6);
+        Put16(reply + 6, 2);
+        memcpy(reply + 8, PEER_MAC, ETH_HWADDR_LEN);
+        memcpy(reply + 14, arp + 24, 4);
+        memcpy(reply + 18, arp + 8, ETH_HWADDR_LEN + 4);
+        Send(SIZEOF_ETH_HDR + ARP_HLEN);
+    }
+}
+
+const uint8_t* BENCH_PEER::AwaitUdp(uint16_t port, size_t* len, uint64_t timeout_ns) {
+    uint64_t deadline = MeasureNanos() + timeout_ns;
+
+    while (true) {
+        while (Next()) {
+            const uint8_t* ip = in + SIZEOF_ETH_HDR;
+            size_t ihl = (ip[0] & 0x0F) * 4;
+            if (ip[9] != IP_PROTO_UDP || SIZEOF_ETH_HDR + ihl + UDP_HLEN > in_len) continue;
+
+            const uint8_t* udp = ip + ihl;
+            size_t ulen = Get16(udp + 4);
+            if (Get16(udp + 2) != port || ulen < UDP_HLEN || SIZEOF_ETH_HDR + ihl + ulen > in_len) continue;
+
+            *len = ulen - UDP_HLEN;
+            return udp + UDP_HLEN;
+        }
+
+        if (MeasureNanos() > deadline) return NULL;
+        Pump();
+    }
+}
+
+bool BENCH_PEER::AwaitTcp(uint16_t port, PEER_SEGMENT_T* segment, uint64_t timeout_ns) {
+    uint64_t deadline = MeasureNanos() + timeout_ns;
+
+    while (true) {
+        while (Next()) {
+            const uint8_t* ip = in + SIZEOF_ETH_HDR;
+            size_t ihl = (ip[0] & 0x0F) * 4;
+            size_t total = Get16(ip + 2);
+            if (ip[9] != IP_PROTO_TCP || SIZEOF_ETH_HDR + total > in_len || ihl + TCP_HLEN > total) continue;
+
+            const uint8_t* tcp = ip + ihl;
+            size_t header = (tcp[12] >> 4) * 4;
+            if (Get16(tcp + 2) != port || header < TCP_HLEN || ihl + header > total) continue;
+
+            segment->source = Get16(tcp);
+            segment->dest = port;
+            segment->seq = Get32(tcp + 4);
+            segment->ack = Get32(tcp + 8);
+            segment->flags = tcp[13];
+            segment->payload = tcp + header;
+            segment->length = total - ihl - header;
+            return true;
+        }
+
+        if (MeasureNanos() > deadline) return false;
+        Pump();
+    }
+}
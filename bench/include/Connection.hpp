@@ -0,0 +1,85 @@
+/**
+ *@file Connection.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CONNECTION
+#define CONNECTION
+
+#include <Peer.hpp>
+
+#define CONNECTION_HEADER_MAX   (1024)      // Response header kept for parsing, the body is only counted
+#define CONNECTION_PORT_FIRST   (49152)     // Ephemeral ports, taken in turn
+#define CONNECTION_TIMEOUT_NS   (1000000000ULL)
+
+/**
+ * @brief HTTP client on one TCP connection, just enough TCP for a lossless wire.
+ * Every segment is acknowledged as it arrives and nothing is ever retransmitted.
+ */
+class BENCH_CONNECTION {
+public:
+    BENCH_CONNECTION(BENCH_PEER* peer, uint32_t address);
+
+    /**
+     * @brief Handshake from the next ephemeral port.
+     *
+     * @return bool false if the board refused or did not answer
+     */
+    bool Open();
+    /**
+     * @brief Sends a request and takes the whole response.
+     *
+     * @param request
+     * @param len
+     * @param ttfb_ns Request sent until the first byte of the response
+     * @return int Status code, 0 if no complete response came back
+     */
+    int Request(const char* request, size_t len, uint64_t* ttfb_ns);
+    /**
+     * @brief Waits for the board to close first when it said it would, then closes.
+     */
+    void Close();
+
+    bool IsOpen() const { return open; }
+    bool Closing() const { return closing || fin; }
+
+private:
+    /**
+     * @brief Handles the next segment, acknowledging anything that took sequence space.
+     *
+     * @return bool false on timeout or reset
+     */
+    bool Receive();
+    void Acknowledge();
+    /**
+     * @brief Status, Content-Length and Connection from the response header.
+     */
+    void Parse();
+
+    BENCH_PEER* peer;
+    uint32_t address;
+    uint16_t port;
+    bool open;
+    bool fin;               // The board has closed its side
+    bool closing;           // The response said Connection: close
+    uint32_t snd_nxt;
+    uint32_t snd_una;
+    uint32_t rcv_nxt;
+    char header[CONNECTION_HEADER_MAX];
+    size_t header_len;
+    bool headed;            // The whole header is in
+    int status;
+    int32_t length;         // Content-Length, -1 when the body ends with the connection
+    size_t received;        // Body bytes of the current response
+    uint64_t first_byte;    // When the current response started arriving, 0 until it does
+
+    static uint16_t next_port;
+};
+
+#endif /* CONNECTION */
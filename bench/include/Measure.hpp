@@ -0,0 +1,96 @@
+/**
+ *@file Measure.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef MEASURE
+#define MEASURE
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#include <time.h>
+
+/**
+ * @brief Monotonic nanoseconds, microseconds from the board clock are too coarse for one packet.
+ *
+ * @return uint64_t
+ */
+inline uint64_t MeasureNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Latencies of one kind of exchange, summarised as percentiles.
+ */
+class LATENCY_SAMPLES {
+public:
+    void Add(uint64_t ns) { samples.push_back(ns); }
+    size_t Count() const { return samples.size(); }
+    /**
+     * @brief Nearest rank percentile.
+     *
+     * @param percent
+     * @return double Microseconds, 0 without samples
+     */
+    double Percentile(double percent) const;
+    /**
+     * @brief Writes {"count", "p50", "p99", "max"} in microseconds.
+     *
+     * @param out
+     */
+    void Write(FILE* out) const;
+
+private:
+    std::vector<uint64_t> samples;
+    mutable std::vector<uint64_t> sorted;
+};
+
+/**
+ * @brief User space instructions retired by the board, counted only while it runs.
+ * On Linux through perf_event_open, a stand-in for Cortex-M0+ cost that timing on a
+ * fast out-of-order core is not.
+ */
+class INSTRUCTION_COUNTER {
+public:
+    /**
+     * @brief Opens the counter and measures what Start and Stop cost on their own.
+     *
+     * @return bool false if perf events are not available, Error says why
+     */
+    static bool Open();
+    static void Close();
+    static bool Enabled() { return fd >= 0; }
+    static const char* Error() { return error; }
+
+    static void Start();
+    static void Stop();
+    /**
+     * @brief Zeroes the count, at the start of each run.
+     */
+    static void Reset();
+    /**
+     * @brief Instructions since Reset, less the counter's own overhead.
+     *
+     * @return uint64_t
+     */
+    static uint64_t Read();
+
+private:
+    static int fd;
+    static const char* error;
+    static uint64_t windows;    // Start and Stop pairs since Reset
+    static uint64_t overhead;   // Counted by one empty pair
+};
+
+#endif /* MEASURE */
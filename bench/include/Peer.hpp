@@ -0,0 +1,120 @@
+/**
+ *@file Peer.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef PEER
+#define PEER
+
+#include <cstdint>
+#include <cstddef>
+
+#include <Host.hpp>
+
+#define PEER_ADDRESS(last)  (0xC0A80400 | (last))   // 192.168.4.x, host order
+#define PEER_SERVER         PEER_ADDRESS(1)
+#define PEER_BROADCAST      (0xFFFFFFFF)
+#define PEER_WINDOW         (0xFFFF)                // Advertised by every TCP segment, never scaled
+
+/**
+ * @brief TCP segment addressed to the peer, pointing into its receive frame.
+ */
+typedef struct PEER_SEGMENT_T_ {
+    uint16_t source;
+    uint16_t dest;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t flags;
+    const uint8_t* payload;
+    size_t length;
+} PEER_SEGMENT_T;
+
+/**
+ * @brief The other end of the board's wire, putting raw frames on it and taking its replies off.
+ * The board only runs when the peer pumps it, so both live on one thread and every exchange is
+ * timed without a scheduler in between. ARP for any address but the board's is answered here.
+ */
+class BENCH_PEER {
+public:
+    BENCH_PEER(int fd);
+
+    /**
+     * @brief Sends a datagram to the board, broadcast when dest is PEER_BROADCAST.
+     *
+     * @param source Host order
+     * @param sport
+     * @param dest Host order
+     * @param dport
+     * @param data
+     * @param len
+     * @return bool
+     */
+    bool SendUdp(uint32_t source, uint16_t sport, uint32_t dest, uint16_t dport, const void* data, size_t len);
+    /**
+     * @brief Sends a segment to the board's address, SYN carries an MSS option.
+     *
+     * @param source Host order
+     * @param sport
+     * @param dport
+     * @param seq
+     * @param ack
+     * @param flags TCP_SYN, TCP_ACK and the rest from lwIP
+     * @param data
+     * @param len
+     * @return bool
+     */
+    bool SendTcp(uint32_t source, uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack, uint8_t flags,
+        const void* data, size_t len);
+    /**
+     * @brief Runs the board until a datagram to port comes back.
+     *
+     * @param port
+     * @param len
+     * @param timeout_ns
+     * @return const uint8_t* Payload, valid until the next call, NULL on timeout
+     */
+    const uint8_t* AwaitUdp(uint16_t port, size_t* len, uint64_t timeout_ns);
+    /**
+     * @brief Runs the board until a segment to port comes back.
+     *
+     * @param port
+     * @param segment
+     * @param timeout_ns
+     * @return bool false on timeout
+     */
+    bool AwaitTcp(uint16_t port, PEER_SEGMENT_T* segment, uint64_t timeout_ns);
+    /**
+     * @brief One turn of the board's loop, the only time its instructions are counted.
+     */
+    void Pump();
+
+    uint32_t sent;      // Frames put on the wire
+    uint32_t pumps;
+
+private:
+    /**
+     * @brief Takes the next IPv4 frame off the wire, answering ARP on the way.
+     *
+     * @return bool false once the wire is empty
+     */
+    bool Next();
+    size_t Ip(uint32_t source, uint32_t dest, uint8_t protocol, size_t payload_len);
+    bool Send(size_t len);
+
+    static uint32_t Sum(const uint8_t* data, size_t len, uint32_t sum);
+    static uint16_t Fold(uint32_t sum);
+
+    int fd;
+    uint16_t id;        // IPv4 identification
+    uint8_t in[HOST_FRAME_MAX];
+    size_t in_len;
+    uint8_t out[HOST_FRAME_MAX];
+};
+
+#endif /* PEER */
@@ -0,0 +1,215 @@
+/**
+ *@file Host.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ERROR_WRITE printf
+
+#define HOST_AP_ADDRESS     "192.168.4.1"   // What the cyw43 driver gives the access point
+#define HOST_AP_NETMASK     "255.255.255.0"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <lwip/init.h>
+#include <lwip/sys.h>
+#include <lwip/timeouts.h>
+
+#include <pico/cyw43_arch.h>
+
+#include <Host.hpp>
+
+async_context_t HOST_BOARD::context;
+
+static uint64_t Now() {
+    static uint64_t start = 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start == 0) start = us - 1;
+    return us - start;
+}
+
+uint64_t time_us_64(void) {
+    return Now();
+}
+
+absolute_time_t get_absolute_time(void) {
+    return Now();
+}
+
+uint32_t cyw43_hal_ticks_ms(void) {
+    return (uint32_t)(Now() / 1000);
+}
+
+u32_t sys_now(void) {
+    return (u32_t)(Now() / 1000);
+}
+
+bool stdio_init_all(void) {
+    // Lines come out as they are printed, as they do over USB
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    return true;
+}
+
+void sleep_ms(uint32_t ms) {
+    uint64_t until = Now() + (uint64_t)ms * 1000;
+    for (uint64_t now = Now(); now < until; now = Now()) {
+        HOST_BOARD::Poll((until - now + 999) / 1000);
+    }
+}
+
+int cyw43_arch_init(void) {
+    lwip_init();
+    return 0;
+}
+
+int cyw43_arch_init_with_country(uint32_t country) {
+    (void)country;
+    return cyw43_arch_init();
+}
+
+void cyw43_arch_deinit(void) {
+    HOST_BOARD::Down();
+}
+
+void cyw43_arch_enable_ap_mode(const char* ssid, const char* password, uint32_t auth) {
+    (void)password;
+    (void)auth;
+
+    // Link picked by whoever runs the host build, a TAP device unless told otherwise
+    const char* wire = getenv("NEKONET_WIRE_FD");
+    const char* tap = getenv("NEKONET_TAP");
+    if (wire != NULL) {
+        HOST_BOARD::Attach(atoi(wire));
+    } else {
+        HOST_BOARD::Open(tap != NULL ? tap : HOST_TAP_DEFAULT);
+    }
+
+    ip4_addr_t address, netmask;
+    ip4addr_aton(HOST_AP_ADDRESS, &address);
+    ip4addr_aton(HOST_AP_NETMASK, &netmask);
+    if (!HOST_BOARD::Up(&address, &netmask)) {
+        ERROR_WRITE("HOST: No link for access point '%s'\n", ssid);
+        exit(1);
+    }
+}
+
+void cyw43_arch_gpio_put(unsigned int pin, bool value) {
+    (void)pin;
+    (void)value;
+}
+
+async_context_t* cyw43_arch_async_context(void) {
+    return HOST_BOARD::Context();
+}
+
+bool async_context_add_at_time_worker(async_context_t* context, async_at_time_worker_t* worker) {
+    async_context_remove_at_time_worker(context, worker);
+
+    // Kept soonest first, workers due at the same time run in the order they were added
+    async_at_time_worker_t** link = &context->at_time_list;
+    while (*link != NULL && (*link)->next_time <= worker->next_time) link = &(*link)->next;
+    worker->next = *link;
+    *link = worker;
+    return true;
+}
+
+bool async_context_add_at_time_worker_in_ms(async_context_t* context, async_at_time_worker_t* worker, uint32_t ms) {
+    worker->next_time = Now() + (uint64_t)ms * 1000;
+    return async_context_add_at_time_worker(context, worker);
+}
+
+bool async_context_remove_at_time_worker(async_context_t* context, async_at_time_worker_t* worker) {
+    for (async_at_time_worker_t** link = &context->at_time_list; *link != NULL; link = &(*link)->next) {
+        if (*link == worker) {
+            *link = worker->next;
+            worker->next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool async_context_add_when_pending_worker(async_context_t* context, async_when_pending_worker_t* worker) {
+    for (async_when_pending_worker_t* w = context->when_pending_list; w != NULL; w = w->next) {
+        if (w == worker) return false;
+    }
+
+    worker->next = context->when_pending_list;
+    context->when_pending_list = worker;
+    return true;
+}
+
+bool async_context_remove_when_pending_worker(async_context_t* context, async_when_pending_worker_t* worker) {
+    for (async_when_pending_worker_t** link = &context->when_pending_list; *link != NULL; link = &(*link)->next) {
+        if (*link == worker) {
+            *link = worker->next;
+            worker->next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+void async_context_set_work_pending(async_context_t* context, async_when_pending_worker_t* worker) {
+    (void)context;
+    worker->work_pending = true;
+}
+
+void HOST_BOARD::RunTimers() {
+    uint64_t now = Now();
+
+    // Taken off the list before it runs, so it can add itself again
+    while (context.at_time_list != NULL && context.at_time_list->next_time <= now) {
+        async_at_time_worker_t* worker = context.at_time_list;
+        context.at_time_list = worker->next;
+        worker->next = NULL;
+        worker->do_work(&context, worker);
+    }
+}
+
+void HOST_BOARD::RunPending() {
+    bool ran = true;
+
+    // Work may set more work pending, run until it settles
+    while (ran) {
+        ran = false;
+        for (async_when_pending_worker_t* worker = context.when_pending_list; worker != NULL; worker = worker->next) {
+            if (!worker->work_pending) continue;
+
+            worker->work_pending = false;
+            worker->do_work(&context, worker);
+            ran = true;
+            break;
+        }
+    }
+}
+
+void HOST_BOARD::Poll(uint32_t timeout_ms) {
+    RunPending();
+
+    // Wait no longer than the next worker or lwIP timer
+    uint32_t wait = timeout_ms;
+    if (context.at_time_list != NULL) {
+        uint64_t now = Now();
+        uint64_t due = context.at_time_list->next_time;
+        uint64_t until = due > now ? (due - now + 999) / 1000 : 0;
+        if (until < wait) wait = until;
+    }
+    u32_t timers = sys_timeouts_sleeptime();
+    if (timers < wait) wait = timers;
+
+    Receive(wait);
+    sys_check_timeouts();
+    RunTimers();
+    RunPending();
+}
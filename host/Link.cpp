@@ -0,0 +1,154 @@
+/**
+ *@file Link.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ERROR_WRITE printf
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <lwip/etharp.h>
+#include <lwip/pbuf.h>
+#include <netif/ethernet.h>
+
+#include <Host.hpp>
+
+// Locally administered, the last byte is the access point's own
+static const uint8_t HOST_MAC[ETH_HWADDR_LEN] = { 0x02, 0x4E, 0x45, 0x4B, 0x4F, 0x01 };
+
+int HOST_BOARD::fd = -1;
+struct netif HOST_BOARD::interface;
+
+bool HOST_BOARD::Open(const char* name) {
+    int tap = open("/dev/net/tun", O_RDWR);
+    if (tap < 0) {
+        ERROR_WRITE("HOST: Failed to open /dev/net/tun: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Frames only, without the packet information header
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(tap, TUNSETIFF, &ifr) < 0) {
+        ERROR_WRITE("HOST: Failed to attach to %s: %s\n", name, strerror(errno));
+        close(tap);
+        return false;
+    }
+
+    printf("HOST: Link on %s\n", ifr.ifr_name);
+    return Attach(tap);
+}
+
+bool HOST_BOARD::Attach(int link) {
+    if (link < 0) return false;
+    if (fd >= 0) close(fd);
+
+    // Frames are drained until the descriptor runs dry, never blocking the loop
+    fcntl(link, F_SETFL, fcntl(link, F_GETFL) | O_NONBLOCK);
+    fd = link;
+    return true;
+}
+
+int HOST_BOARD::Wire() {
+    // Sequenced packets keep each frame whole, like a cable
+    int ends[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ends) < 0) {
+        ERROR_WRITE("HOST: Failed to create a wire: %s\n", strerror(errno));
+        return -1;
+    }
+
+    Attach(ends[0]);
+    return ends[1];
+}
+
+err_t HOST_BOARD::Init(struct netif* nif) {
+    nif->name[0] = 'n';
+    nif->name[1] = 'k';
+    nif->output = etharp_output;
+    nif->linkoutput = Output;
+    nif->mtu = HOST_FRAME_MAX - SIZEOF_ETH_HDR;
+    nif->hwaddr_len = ETH_HWADDR_LEN;
+    memcpy(nif->hwaddr, HOST_MAC, ETH_HWADDR_LEN);
+    nif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+    return ERR_OK;
+}
+
+bool HOST_BOARD::Up(const ip4_addr_t* address, const ip4_addr_t* netmask) {
+    if (fd < 0) return false;
+
+    // The access point is its own gateway
+    if (netif_add(&interface, address, netmask, address, NULL, Init, ethernet_input) == NULL) return false;
+    netif_set_default(&interface);
+    netif_set_up(&interface);
+    netif_set_link_up(&interface);
+    return true;
+}
+
+void HOST_BOARD::Down() {
+    netif_remove(&interface);
+
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+err_t HOST_BOARD::Output(struct netif* nif, struct pbuf* p) {
+    (void)nif;
+    static uint8_t frame[HOST_FRAME_MAX];
+
+    if (p->tot_len > sizeof(frame)) return ERR_IF;
+    size_t len = pbuf_copy_partial(p, frame, sizeof(frame), 0);
+
+    // A full peer drops the frame, as a busy radio would
+    if (write(fd, frame, len) != (ssize_t)len) return ERR_IF;
+    return ERR_OK;
+}
+
+bool HOST_BOARD::Receive(uint32_t timeout_ms) {
+    if (fd < 0) {
+        usleep(timeout_ms * 1000);
+        return false;
+    }
+
+    struct pollfd ready = { fd, POLLIN, 0 };
+    if (poll(&ready, 1, timeout_ms) <= 0) return false;
+
+    // Every frame already waiting goes in now, each in one pool pbuf like the cyw43 driver
+    static uint8_t frame[HOST_FRAME_MAX + 4];
+    while (true) {
+        ssize_t len = read(fd, frame, sizeof(frame));
+        if (len == 0) {
+            // The peer hung up, the link is down until another is attached
+            ERROR_WRITE("HOST: Link closed\n");
+            close(fd);
+            fd = -1;
+            break;
+        }
+        if (len < 0) break;
+        if (len > HOST_FRAME_MAX) continue;
+
+        struct pbuf* p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+        if (p == NULL) continue;
+
+        pbuf_take(p, frame, len);
+        if (interface.input(p, &interface) != ERR_OK) pbuf_free(p);
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+/**
+ *@file Host.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef HOST
+#define HOST
+
+#include <cstdint>
+#include <cstddef>
+
+#include <lwip/netif.h>
+
+#include <pico/async_context.h>
+
+#define HOST_TAP_DEFAULT    "tap0"
+#define HOST_FRAME_MAX      (1514)  // Ethernet header and a 1500 byte payload, no FCS
+
+/**
+ * @brief The board for the host build, one thread running lwIP and the async_context.
+ * The network is a link carrying Ethernet frames over a file descriptor, either a TAP device
+ * so real clients can reach it, or one end of a socket pair for a peer in the same process.
+ */
+class HOST_BOARD {
+public:
+    /**
+     * @brief Uses a TAP device as the link, it must already exist and be up.
+     *
+     * @param name
+     * @return bool
+     */
+    static bool Open(const char* name);
+    /**
+     * @brief Uses a descriptor as the link, each read or write is one frame.
+     *
+     * @param fd
+     * @return bool
+     */
+    static bool Attach(int fd);
+    /**
+     * @brief Creates a socket pair and attaches one end as the link.
+     *
+     * @return int The other end for the peer, -1 on failure
+     */
+    static int Wire();
+    /**
+     * @brief Puts the interface up at an address, the access point does this for the board.
+     *
+     * @param address
+     * @param netmask
+     * @return bool false without a link
+     */
+    static bool Up(const ip4_addr_t* address, const ip4_addr_t* netmask);
+    static void Down();
+    /**
+     * @brief One turn of the loop: frames in, lwIP timers, due and pending workers.
+     *
+     * @param timeout_ms Longest to wait for a frame when nothing else is due
+     */
+    static void Poll(uint32_t timeout_ms);
+
+    static struct netif* Interface() { return &interface; }
+    static async_context_t* Context() { return &context; }
+
+private:
+    static bool Receive(uint32_t timeout_ms);
+    static err_t Output(struct netif* nif, struct pbuf* p);
+    static err_t Init(struct netif* nif);
+    static void RunTimers();
+    static void RunPending();
+
+    static int fd;
+    static struct netif interface;
+    static async_context_t context;
+};
+
+#endif /* HOST */
@@ -0,0 +1,19 @@
+/**
+ *@file cyw43_config.h
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief Host stand-in for the cyw43 driver configuration, only the tick source is used.
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CYW43_CONFIG
+#define CYW43_CONFIG
+
+#include <cstdint>
+
+uint32_t cyw43_hal_ticks_ms(void);
+
+#endif /* CYW43_CONFIG */
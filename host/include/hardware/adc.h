@@ -0,0 +1,24 @@
+/**
+ *@file adc.h
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief Host stand-in for the ADC, the temperature sensor reads a steady 27 C.
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef HARDWARE_ADC
+#define HARDWARE_ADC
+
+#include <cstdint>
+
+#define HOST_ADC_READING    (876)   // 0.706 V of 3.3 V in 12 bits
+
+inline void adc_init(void) {}
+inline void adc_set_temp_sensor_enabled(bool enable) { (void)enable; }
+inline void adc_select_input(unsigned int input) { (void)input; }
+inline uint16_t adc_read(void) { return HOST_ADC_READING; }
+
+#endif /* HARDWARE_ADC */
@@ -0,0 +1,52 @@
+/**
+ *@file async_context.h
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief Host stand-in for the pico-sdk async_context, driven by HOST_BOARD::Poll.
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef ASYNC_CONTEXT
+#define ASYNC_CONTEXT
+
+#include <cstdint>
+#include <cstddef>
+
+typedef uint64_t absolute_time_t;  // Microseconds since the host build started
+
+typedef struct async_context async_context_t;
+
+typedef struct async_work_on_timeout {
+    struct async_work_on_timeout* next;
+    void (*do_work)(async_context_t* context, struct async_work_on_timeout* timeout);
+    absolute_time_t next_time;
+    void* user_data;
+} async_at_time_worker_t;
+
+typedef struct async_when_pending_worker {
+    struct async_when_pending_worker* next;
+    void (*do_work)(async_context_t* context, struct async_when_pending_worker* worker);
+    bool work_pending;
+    void* user_data;
+} async_when_pending_worker_t;
+
+struct async_context {
+    async_when_pending_worker_t* when_pending_list;
+    async_at_time_worker_t* at_time_list;  // Soonest first
+};
+
+bool async_context_add_at_time_worker(async_context_t* context, async_at_time_worker_t* worker);
+bool async_context_add_at_time_worker_in_ms(async_context_t* context, async_at_time_worker_t* worker, uint32_t ms);
+bool async_context_remove_at_time_worker(async_context_t* context, async_at_time_worker_t* worker);
+bool async_context_add_when_pending_worker(async_context_t* context, async_when_pending_worker_t* worker);
+bool async_context_remove_when_pending_worker(async_context_t* context, async_when_pending_worker_t* worker);
+void async_context_set_work_pending(async_context_t* context, async_when_pending_worker_t* worker);
+
+// One thread runs everything, there is nothing to lock against
+inline void async_context_acquire_lock_blocking(async_context_t* context) { (void)context; }
+inline void async_context_release_lock(async_context_t* context) { (void)context; }
+
+#endif /* ASYNC_CONTEXT */
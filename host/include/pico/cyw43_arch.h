@@ -0,0 +1,50 @@
+/**
+ *@file cyw43_arch.h
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief Host stand-in for the cyw43 architecture layer.
+ * The access point comes up on a HOST link instead of the radio.
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef CYW43_ARCH
+#define CYW43_ARCH
+
+#include <cstdint>
+
+// The cyw43 driver brings these in for its netif
+#include <lwip/netif.h>
+#include <lwip/dhcp.h>
+
+#include <pico/async_context.h>
+#include <pico/stdlib.h>
+#include <cyw43_config.h>
+
+#define CYW43_WL_GPIO_LED_PIN       (0)
+#define CYW43_COUNTRY(A, B, REV)    ((unsigned char)(A) | ((unsigned char)(B) << 8) | ((REV) << 16))
+#define CYW43_COUNTRY_SINGAPORE     CYW43_COUNTRY('S', 'G', 0)
+#define CYW43_AUTH_OPEN             (0)
+#define CYW43_AUTH_WPA2_AES_PSK     (0x00400004)
+
+int cyw43_arch_init(void);
+int cyw43_arch_init_with_country(uint32_t country);
+void cyw43_arch_deinit(void);
+/**
+ * @brief Brings up the interface at 192.168.4.1/24 on the link set with HOST_BOARD::Open or HOST_BOARD::Attach.
+ * Without one, NEKONET_WIRE_FD names an inherited descriptor, otherwise NEKONET_TAP a TAP device (tap0).
+ *
+ * @param ssid Unused
+ * @param password Unused
+ * @param auth Unused
+ */
+void cyw43_arch_enable_ap_mode(const char* ssid, const char* password, uint32_t auth);
+void cyw43_arch_gpio_put(unsigned int pin, bool value);
+async_context_t* cyw43_arch_async_context(void);
+
+inline void cyw43_arch_lwip_begin(void) {}
+inline void cyw43_arch_lwip_end(void) {}
+
+#endif /* CYW43_ARCH */
@@ -0,0 +1,34 @@
+/**
+ *@file stdlib.h
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief Host stand-in for the pico-sdk standard library.
+ * @version 0.1
+ * @date 2024-07-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef PICO_STDLIB
+#define PICO_STDLIB
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <pico/async_context.h>
+
+bool stdio_init_all(void);
+/**
+ * @brief Runs the network loop until ms have passed, the board idles here while the background does the work.
+ *
+ * @param ms
+ */
+void sleep_ms(uint32_t ms);
+absolute_time_t get_absolute_time(void);
+uint64_t time_us_64(void);
+inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+
+inline void tight_loop_contents(void) {}
+
+#endif /* PICO_STDLIB */
@@ -0,0 +1,59 @@
+/**
+ *@file Assets.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-04-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef ASSETS
+#define ASSETS
+
+#include <cstdint>
+#include <cstddef>
+
+#include <HTTP.hpp>
+
+#define ASSET_INDEX "/index.html"
+
+/**
+ * @brief Web asset packed into flash at build time by tools/assets.py.
+ */
+typedef struct ASSET_T_ {
+    const char* path;
+    const char* content_type;
+    const char* etag;           // Strong ETag, including the quotes
+    const uint8_t* data;
+    uint32_t length;
+    const char* header;         // 200 response header without the Connection line
+    uint16_t header_length;
+    const char* not_modified;   // 304 response header without the Connection line
+    uint16_t not_modified_length;
+    const char* gzip_etag;      // Its own strong ETag, the bytes differ
+    const uint8_t* gzip_data;   // NULL when compression does not pay off
+    uint32_t gzip_length;
+    const char* gzip_header;
+    uint16_t gzip_header_length;
+    const char* gzip_not_modified;
+    uint16_t gzip_not_modified_length;
+} ASSET_T;
+
+class ASSET_STORE {
+public:
+    /**
+     * @brief Looks up the asset for a request path, "/" maps to ASSET_INDEX.
+     *
+     * @param parser
+     * @param path
+     * @return const ASSET_T* or NULL
+     */
+    static const ASSET_T* Find(const HTTP_PARSER& parser, HTTP_VIEW_T path);
+
+    static const ASSET_T table[];
+    static const size_t count;
+};
+
+#endif /* ASSETS */
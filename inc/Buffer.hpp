@@ -0,0 +1,47 @@
+/**
+ *@file Buffer.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef BUFFER
+#define BUFFER
+
+#include <cstring>
+
+#include <lwipopts.h>
+#include <lwip/pbuf.h>
+
+/**
+ * @brief Makes room for a reply of len bytes in a received pbuf, in place when its buffer is big enough.
+ * Pool pbufs are a fixed size, so a reply may run past the request up to the end of the buffer.
+ *
+ * @param p In one piece, freed if the reply has to move
+ * @param len
+ * @return struct pbuf* Holding the message in one piece, NULL when out of memory
+ */
+inline struct pbuf* PbufReserve(struct pbuf* p, size_t len) {
+    size_t room = p->len;
+    if (pbuf_get_allocsrc(p) == PBUF_TYPE_ALLOC_SRC_MASK_STD_MEMP_PBUF_POOL) {
+        room = (uint8_t*)p + LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf)) + LWIP_MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE) -
+            (uint8_t*)p->payload;
+    }
+
+    if (len <= room) {
+        p->len = p->tot_len = len;
+        return p;
+    }
+
+    struct pbuf* reply = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (reply != NULL) memcpy(reply->payload, p->payload, LWIP_MIN(p->len, len));
+
+    pbuf_free(p);
+    return reply;
+}
+
+#endif /* BUFFER */
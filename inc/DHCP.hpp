@@ -12,6 +12,11 @@
 #ifndef DHCP
 #define DHCP
 
+#include <lwip/prot/dhcp.h>
+#include <pico/async_context.h>
+
+#include <Lease.hpp>
+
 #define DHCPDISCOVER    (1)
 #define DHCPOFFER       (2)
 #define DHCPREQUEST     (3)
@@ -21,6 +26,8 @@
 #define DHCPRELEASE     (7)
 #define DHCPINFORM      (8)
 
+#define DHCP_MSG_TYPES  (DHCPINFORM + 1)    // Counted by type, 0 for anything unknown
+
 #define DHCP_OPT_PAD                (0)
 #define DHCP_OPT_SUBNET_MASK        (1)
 #define DHCP_OPT_ROUTER             (3)
@@ -39,8 +46,30 @@
 #define PORT_DHCP_SERVER (67)
 #define PORT_DHCP_CLIENT (68)
 
-#define DHCPS_BASE_IP   (16)
-#define DHCPS_MAX_IP    (8)
+#define BOOTREQUEST             (1)
+#define BOOTREPLY               (2)
+#define DHCP_OPTIONS_OFFSET     (240)   // Fixed fields and the magic cookie
+
+// Longest reply: message type, server id, mask, router, DNS, lease time and the end
+#define DHCP_REPLY_MAX          (DHCP_OPTIONS_OFFSET + 3 + 4 * 6 + 6 + 1)
+
+/**
+ * @brief Options the server reads, each is a slot in the option index.
+ */
+typedef enum DHCP_OPTION_SLOT_ {
+    DHCP_SLOT_MSG_TYPE = 0,
+    DHCP_SLOT_REQUESTED_IP,
+    DHCP_SLOT_SERVER_ID,
+    DHCP_SLOTS,
+} DHCP_OPTION_SLOT;
+
+/**
+ * @brief Where each option read by the server sits in the message, filled in one pass.
+ */
+typedef struct DHCP_OPTION_INDEX_T_ {
+    uint16_t offset[DHCP_SLOTS];    // Of the value, 0 when the option is absent
+    uint8_t length[DHCP_SLOTS];
+} DHCP_OPTION_INDEX_T;
 
 typedef struct {
     uint8_t op;             // message opcode
@@ -60,19 +89,40 @@ typedef struct {
     uint8_t options[312];   // optional parameters, variable, starts with magic
 } Message;
 
-struct Lease {
-    uint8_t mac[6];
-    uint16_t expiry;
-};
+typedef struct DHCP_SERVER_STATS_T_ {
+    uint32_t received[DHCP_MSG_TYPES];  // By message type
+    uint32_t sent[DHCP_MSG_TYPES];
+    uint32_t malformed;                 // Not a request, options past the end or no message type
+    uint32_t exhausted;                 // Discover with every address taken
+} DHCP_SERVER_STATS_T;
 
 class DHCP_SERVER {
 public:
     int SocketNewDatagram(udp_recv_fn cb_udp_recv);
     int SocketBind(uint16_t port);
     void SocketFree();
-    int SocketSendTo(struct netif* nif, const void* buf, size_t len, uint32_t ip, uint16_t port);
+    int SocketSendTo(struct netif* nif, struct pbuf* p, uint32_t ip, uint16_t port);
 
-    static uint8_t* Find(uint8_t* opt, uint8_t cmd);
+    /**
+     * @brief Indexes the options in one pass, checking every length against the message.
+     *
+     * @param msg
+     * @param len
+     * @param index
+     * @return bool false if the cookie is wrong or an option runs past the end
+     */
+    static bool Index(const uint8_t* msg, size_t len, DHCP_OPTION_INDEX_T* index);
+    /**
+     * @brief Value of an indexed option.
+     *
+     * @param msg
+     * @param index
+     * @param slot
+     * @param length Bytes the caller reads
+     * @return const uint8_t* NULL if the option is absent or shorter than length
+     */
+    static const uint8_t* Option(const uint8_t* msg, const DHCP_OPTION_INDEX_T* index, DHCP_OPTION_SLOT slot,
+        size_t length);
     /**
      * @brief Write n unsigned bytes.
      *
@@ -99,6 +149,33 @@ public:
     static void Write(uint8_t** opt, uint8_t cmd, uint32_t val);
 
     static void Process(void* arg, struct udp_pcb* upcb, struct pbuf* p, const ip_addr_t* src_addr, u16_t src_port);
+    /**
+     * @brief Moves lapsed leases back to the pool as soon as they lapse.
+     *
+     * @param context
+     * @param worker
+     */
+    static void Sweep(async_context_t* context, async_at_time_worker_t* worker);
+    /**
+     * @brief Sets the sweep for the next lease to lapse, the lists are in expiry order so one timer covers them all.
+     *
+     * @param now
+     */
+    static void Schedule(uint32_t now);
+    /**
+     * @brief Saves lease changes to flash once enough have built up.
+     * Call from the main loop, never from an lwIP callback.
+     */
+    void Flush();
+    /**
+     * @brief Leases in a state, for the metrics.
+     *
+     * @param state
+     * @return size_t
+     */
+    static size_t Leases(LEASE_STATE state) { return leases.Count(state); }
+
+    static DHCP_SERVER_STATS_T stats;
 
     DHCP_SERVER(ip_addr_t* ip, ip_addr_t* nm);
     ~DHCP_SERVER();
@@ -106,7 +183,8 @@ public:
 private:
     ip_addr_t ipAddress;
     ip_addr_t netmask;
-    Lease lease[DHCPS_MAX_IP];
+    static LEASE_TABLE leases;
+    static async_at_time_worker_t sweeper;
     struct udp_pcb* udp;
 };
 
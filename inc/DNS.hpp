@@ -19,9 +19,52 @@
 #include <lwip/ip_addr.h>
 #include <lwip/udp.h>
 
+#include <Limit.hpp>
+
 #define PORT_DNS_SERVER 53
 
-#define MAX_DNS_MSG_SIZE 300
+#define DNS_MAX_QUESTIONS   4       // Questions answered in one message, more are a format error
+#define DNS_MAX_NAME        255     // Wire length of a name including its length bytes
+#define DNS_MAX_REPLY       512     // Largest reply without EDNS
+#define DNS_TTL             60      // Seconds clients may keep an answer
+#define DNS_NEGATIVE_TTL    60      // Seconds clients may keep a NODATA or NXDOMAIN
+
+#define DNS_RATE_CLIENTS    16      // Clients rate limited at once
+#ifndef DNS_RATE_PER_S
+#define DNS_RATE_PER_S      20      // Queries a client may send per second
+#endif
+#define DNS_RATE_BURST      40      // and in one burst, enough for a phone joining the network
+
+#define DNS_TYPE_A          1
+#define DNS_TYPE_SOA        6
+#define DNS_TYPE_PTR        12
+#define DNS_TYPE_AAAA       28
+#define DNS_TYPE_SVCB       64
+#define DNS_TYPE_HTTPS      65
+#define DNS_TYPE_ANY        255
+
+#define DNS_CLASS_IN        1
+#define DNS_CLASS_ANY       255
+
+#define DNS_RCODE_NOERROR   0
+#define DNS_RCODE_FORMERR   1
+#define DNS_RCODE_NXDOMAIN  3
+#define DNS_RCODE_NOTIMP    4
+#define DNS_RCODE_REFUSED   5
+#define DNS_RCODES          (DNS_RCODE_REFUSED + 1)
+
+// flags from rfc1035
+// +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
+// +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+#define DNS_FLAG_QR         (1 << 15)
+#define DNS_FLAG_AA         (1 << 10)
+#define DNS_FLAG_TC         (1 << 9)
+#define DNS_FLAG_RD         (1 << 8)
+#define DNS_FLAG_RA         (1 << 7)
+
+#define DNS_ANSWER_LENGTH   16      // A record with the name compressed to a pointer
+#define DNS_SOA_LENGTH      36      // SOA record with both names compressed to pointers
 
 typedef struct DNS_HEADER_T_ {
     uint16_t id;
@@ -32,19 +75,108 @@ typedef struct DNS_HEADER_T_ {
     uint16_t additional_record_count;
 } DNS_HEADER_T;
 
+typedef struct DNS_QUESTION_T_ {
+    uint16_t name;      // Offset of the name in the message, answers point back to it
+    uint16_t type;
+    uint16_t klass;
+} DNS_QUESTION_T;
+
+// Big-endian field access for building and reading records in place
+inline uint8_t* DnsPut16(uint8_t* out, uint16_t value) {
+    *out++ = value >> 8;
+    *out++ = value & 0xFF;
+    return out;
+}
+
+inline uint8_t* DnsPut32(uint8_t* out, uint32_t value) {
+    out = DnsPut16(out, value >> 16);
+    return DnsPut16(out, value & 0xFFFF);
+}
+
+inline uint16_t DnsGet16(const uint8_t* in) {
+    return in[0] << 8 | in[1];
+}
+
+inline uint32_t DnsGet32(const uint8_t* in) {
+    return static_cast<uint32_t>(DnsGet16(in)) << 16 | DnsGet16(in + 2);
+}
+
+typedef enum DNS_QUERY_KIND_ {
+    DNS_QUERY_A = 0,
+    DNS_QUERY_AAAA,
+    DNS_QUERY_PTR,
+    DNS_QUERY_SVCB,         // SVCB and HTTPS, asked for by every recent browser
+    DNS_QUERY_OTHER,
+    DNS_QUERY_KINDS,
+} DNS_QUERY_KIND;
+
+typedef struct DNS_SERVER_STATS_T_ {
+    uint32_t questions[DNS_QUERY_KINDS];
+    uint32_t responses[DNS_RCODES];     // By RCODE, forwarded queries are counted by the forwarder
+    uint32_t ignored;                   // Not a query or malformed, no reply
+} DNS_SERVER_STATS_T;
+
+typedef enum DNS_ANSWER_ {
+    DNS_ANSWER_ADDRESS = 0, // A record with our address
+    DNS_ANSWER_NODATA,      // Name exists, nothing of this type
+    DNS_ANSWER_NXDOMAIN,    // Name does not exist
+} DNS_ANSWER;
+
 class DNS_SERVER {
 public:
     int SocketNewdatagram(void* cb_data, udp_recv_fn cb_udp_recv);
     int SocketBind(uint32_t ip, uint16_t port);
-    int SocketSendTo(const void* buf, size_t len, const ip_addr_t* dest, uint16_t port);
+    int SocketSendTo(struct pbuf* p, const ip_addr_t* dest, uint16_t port);
 
     void SocketFree();
 
+    /**
+     * @brief Answers a query by writing the reply over it in the received pbuf.
+     *
+     * @param arg
+     * @param upcb
+     * @param p
+     * @param src_addr
+     * @param src_port
+     */
     static void Process(void* arg, struct udp_pcb* upcb, struct pbuf* p, const ip_addr_t* src_addr, u16_t src_port);
+    /**
+     * @brief Finds every question in msg.
+     *
+     * @param msg
+     * @param len
+     * @param questions
+     * @param count Question count from the header
+     * @return int Offset just past the last question, -1 if the message is malformed
+     */
+    static int ParseQuestions(const uint8_t* msg, size_t len, DNS_QUESTION_T* questions, size_t count);
+    /**
+     * @brief Local zone entry first, then the portal catch-all by type.
+     *
+     * @param msg
+     * @param question
+     * @param address Set for DNS_ANSWER_ADDRESS, 0 for our own address
+     * @return DNS_ANSWER
+     */
+    static DNS_ANSWER Classify(const uint8_t* msg, const DNS_QUESTION_T* question, uint32_t* address);
+
+    /**
+     * @brief Clients over their query rate, checked before anything is parsed.
+     */
+    static RATE_LIMITER<DNS_RATE_CLIENTS, DNS_RATE_PER_S, DNS_RATE_BURST> limiter;
+    static DNS_SERVER_STATS_T stats;
 
     DNS_SERVER(ip_addr_t* ip);
     ~DNS_SERVER();
 
+    /**
+     * @brief Relays names outside the local zone to a resolver, through the answer cache.
+     *
+     * @param upstream
+     * @return true if forwarding started
+     */
+    bool SetUpstream(const ip_addr_t* upstream);
+
 private:
     ip_addr_t ipAddress;
     struct udp_pcb* udp;
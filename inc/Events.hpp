@@ -0,0 +1,73 @@
+/**
+ *@file Events.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef EVENTS
+#define EVENTS
+
+#include <cstdint>
+#include <cstddef>
+
+#define EVENT_RING_SIZE     (2048)  // Bytes of formatted events kept for subscribers to catch up on
+#define EVENT_RING_EVENTS   (32)    // Events kept, at most
+#define EVENT_MAX_LENGTH    (256)   // Largest formatted event
+
+/**
+ * @brief Server-Sent Events, formatted once and shared by every subscriber.
+ * Subscribers keep only the id of the next event they need; events are
+ * dropped oldest first when the ring is full, and a subscriber that falls
+ * behind skips to the oldest event still held.
+ */
+class EVENT_RING {
+public:
+    EVENT_RING();
+
+    /**
+     * @brief Formats an event into the ring, dropping the oldest events to make room.
+     *
+     * @param name Event type, NULL for the default "message"
+     * @param data Newlines split it into several data lines
+     * @param len
+     * @return uint32_t Event id, 0 if the event is larger than EVENT_MAX_LENGTH
+     */
+    uint32_t Publish(const char* name, const char* data, size_t len);
+    /**
+     * @brief Bytes of event id, in two pieces when it wraps around the end of the ring.
+     *
+     * @return true if the event is still held
+     */
+    bool Read(uint32_t id, const char** first, size_t* first_len, const char** second, size_t* second_len) const;
+    /**
+     * @brief Formats the marker sent in place of the events between id and First.
+     * Its id is the one before First, so a client reconnecting with it as
+     * Last-Event-ID resumes at the oldest event still held.
+     *
+     * @param buffer
+     * @param max_len
+     * @param id First event the subscriber missed
+     * @return size_t Marker length, 0 if it does not fit
+     */
+    size_t Gap(char* buffer, size_t max_len, uint32_t id) const;
+
+    uint32_t First() const { return first; }
+    uint32_t Next() const { return next; }
+
+private:
+    char ring[EVENT_RING_SIZE];
+    struct {
+        uint32_t position;  // Byte position, wraps around the ring
+        uint16_t length;
+    } events[EVENT_RING_EVENTS];
+    uint32_t first;         // Oldest event still held
+    uint32_t next;          // Id of the next event published
+    uint32_t head;          // Position the next event is written at
+};
+
+#endif /* EVENTS */
@@ -0,0 +1,80 @@
+/**
+ *@file Flash.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef FLASH
+#define FLASH
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef NEKONET_HOST
+#define FLASH_SECTOR_SIZE       (4096)
+#define FLASH_PAGE_SIZE         (256)
+#else
+#include <hardware/flash.h>
+#endif
+
+// Sectors reserved at the end of flash, the binary must stay below them
+#ifndef FLASH_STORE_SECTORS
+#define FLASH_STORE_SECTORS     (4)
+#endif
+
+#define FLASH_STORE_SIZE        (FLASH_STORE_SECTORS * FLASH_SECTOR_SIZE)
+#define FLASH_STORE_TIMEOUT_MS  (100)   // Wait for the other core to step out of flash
+
+typedef struct FLASH_STORE_STATS_T_ {
+    uint32_t erases[FLASH_STORE_SECTORS];
+    uint32_t programs;
+    uint32_t failures;      // Erase or program refused, or read back wrong
+} FLASH_STORE_STATS_T;
+
+/**
+ * @brief Sectors at the end of flash for data that outlives a reboot.
+ * Reads are memory mapped. Erases and programs stop execute in place, so they
+ * must come from the main loop, never from an lwIP callback.
+ * NEKONET_HOST swaps the flash for a RAM image that keeps NOR rules,
+ * programming only clears bits and only an erase sets them again.
+ */
+class FLASH_STORE {
+public:
+    /**
+     * @brief Checks the reserved sectors are clear of the binary.
+     *
+     * @return bool
+     */
+    static bool Start();
+    /**
+     * @brief Memory mapped view of the reserved sectors.
+     *
+     * @param offset From the start of the reserved sectors
+     * @return const uint8_t*
+     */
+    static const uint8_t* Read(uint32_t offset);
+    /**
+     * @brief Sets a whole sector to 0xFF.
+     *
+     * @param sector
+     * @return bool
+     */
+    static bool Erase(size_t sector);
+    /**
+     * @brief Writes one page, which must be erased or only clear more bits.
+     *
+     * @param offset Page aligned, from the start of the reserved sectors
+     * @param data FLASH_PAGE_SIZE bytes in RAM
+     * @return bool false if the page did not read back as written
+     */
+    static bool Program(uint32_t offset, const uint8_t* data);
+
+    static FLASH_STORE_STATS_T stats;
+};
+
+#endif /* FLASH */
@@ -0,0 +1,120 @@
+/**
+ *@file Forward.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef FORWARD
+#define FORWARD
+
+#include <cstdint>
+#include <cstddef>
+
+#include <lwip/ip_addr.h>
+#include <lwip/udp.h>
+
+#include <DNS.hpp>
+
+#define DNS_CACHE_ENTRIES           (16)
+#define DNS_CACHE_DATA              (256)   // Question and records of one cached reply
+#define DNS_CACHE_RECORDS           (8)     // Answer and authority records of one cached reply
+#define DNS_FORWARD_PENDING         (8)     // Questions waiting on the upstream at once
+#define DNS_FORWARD_WAITERS         (4)     // Clients sharing one upstream query
+#define DNS_FORWARD_TIMEOUT_MS      (2000)  // Upstream query given up on, the clients retry
+#define DNS_FORWARD_MAX_TTL_S       (3600)
+#define DNS_FORWARD_MAX_NEGATIVE_S  (300)
+
+/**
+ * @brief Upstream reply kept for its TTL, served with the asking client's own question.
+ * Additional records are dropped, the OPT record of EDNS among them.
+ */
+typedef struct DNS_CACHE_T_ {
+    uint32_t hash;                      // Name, type and class, 0 when free
+    uint32_t expires;                   // sys_now() the reply goes stale
+    uint32_t last_used;
+    uint16_t flags;                     // Reply flags, RCODE included
+    uint16_t answers;
+    uint16_t authority;
+    uint16_t question;                  // Length of the question at the start of data
+    uint16_t length;
+    uint8_t ttl_count;
+    uint16_t ttls[DNS_CACHE_RECORDS];   // Offsets of every TTL after the question, rewritten when served
+    uint8_t data[DNS_CACHE_DATA];
+} DNS_CACHE_T;
+
+typedef struct DNS_WAITER_T_ {
+    ip_addr_t address;
+    uint16_t port;
+    uint16_t id;                        // Query id of the client
+} DNS_WAITER_T;
+
+typedef struct DNS_PENDING_T_ {
+    uint32_t hash;                      // 0 when free
+    uint32_t sent;
+    uint16_t id;                        // Query id sent upstream
+    uint8_t waiter_count;
+    DNS_WAITER_T waiters[DNS_FORWARD_WAITERS];
+} DNS_PENDING_T;
+
+typedef struct DNS_FORWARD_STATS_T_ {
+    uint32_t queries;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t coalesced;                 // Answered by a query another client already sent
+    uint32_t upstream;                  // Queries sent upstream
+    uint32_t replies;                   // Upstream replies matched to a query
+    uint32_t timeouts;
+    uint32_t dropped;                   // No room to track the query
+    uint32_t latency_total_ms;          // Over every matched reply
+    uint32_t latency_max_ms;
+} DNS_FORWARD_STATS_T;
+
+class DNS_FORWARDER {
+public:
+    /**
+     * @brief Opens the upstream socket.
+     *
+     * @param server Socket clients are answered from
+     * @param upstream Resolver address, port 53
+     * @return true on success
+     */
+    static bool Start(struct udp_pcb* server, const ip_addr_t* upstream);
+    static void Stop();
+    static bool Enabled() { return udp != NULL; }
+
+    /**
+     * @brief Answers from the cache, joins a query already sent for the same question or sends one.
+     *
+     * @param p Query with one question, freed here
+     * @param end Offset just past the question
+     * @param question
+     * @param client
+     * @param port
+     */
+    static void Forward(struct pbuf* p, size_t end, const DNS_QUESTION_T* question, const ip_addr_t* client,
+        uint16_t port);
+    static void Receive(void* arg, struct udp_pcb* upcb, struct pbuf* p, const ip_addr_t* addr, u16_t port);
+
+    static DNS_FORWARD_STATS_T stats;
+
+private:
+    static uint32_t Key(const uint8_t* msg, const DNS_QUESTION_T* question);
+    static DNS_CACHE_T* Lookup(uint32_t hash, const uint8_t* question, size_t length, uint32_t now);
+    static void Insert(uint32_t hash, const uint8_t* msg, size_t len, size_t end, uint32_t now);
+    static void Serve(struct pbuf* p, size_t end, DNS_CACHE_T* entry, uint32_t now, const ip_addr_t* client,
+        uint16_t port);
+    static DNS_PENDING_T* Pending(uint32_t hash, uint32_t now);
+
+    static struct udp_pcb* udp;
+    static struct udp_pcb* server;
+    static ip_addr_t upstream;
+    static DNS_CACHE_T cache[DNS_CACHE_ENTRIES];
+    static DNS_PENDING_T pending[DNS_FORWARD_PENDING];
+};
+
+#endif /* FORWARD */
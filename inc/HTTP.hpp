@@ -0,0 +1,283 @@
+/**
+ *@file HTTP.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-04-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef HTTP
+#define HTTP
+
+#include <cstdint>
+#include <cstddef>
+
+#include <lwip/pbuf.h>
+
+#define HTTP_MAX_HEADERS        (24)
+#define HTTP_MAX_REQUEST_SIZE   (4096)
+
+#define HTTP_HASH_BASIS         (2166136261u)   // FNV-1a
+#define HTTP_HASH_PRIME         (16777619u)
+
+#define HTTP_CONNECTION_CLOSE       (1 << 0)
+#define HTTP_CONNECTION_KEEP_ALIVE  (1 << 1)
+#define HTTP_CONNECTION_UPGRADE     (1 << 2)
+
+typedef enum HTTP_METHOD_ {
+    HTTP_METHOD_UNKNOWN = 0,
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_OPTIONS,
+} HTTP_METHOD;
+
+typedef enum HTTP_STATUS_ {
+    HTTP_INCOMPLETE = 0,    // Need more data
+    HTTP_COMPLETE,          // A full request (including body) is buffered
+    HTTP_BAD_REQUEST,       // Malformed request line or header
+    HTTP_TOO_LARGE,         // Request exceeds HTTP_MAX_REQUEST_SIZE or HTTP_MAX_HEADERS
+    HTTP_BODY_TOO_LARGE,    // Content-Length takes the request past HTTP_MAX_REQUEST_SIZE
+} HTTP_STATUS;
+
+/**
+ * @brief Byte range inside the buffered pbuf chain.
+ * Views stay valid until HTTP_PARSER::Consume or HTTP_PARSER::Reset.
+ */
+typedef struct HTTP_VIEW_T_ {
+    uint16_t offset;
+    uint16_t length;
+} HTTP_VIEW_T;
+
+typedef struct HTTP_HEADER_T_ {
+    HTTP_VIEW_T name;
+    HTTP_VIEW_T value;
+} HTTP_HEADER_T;
+
+typedef struct HTTP_REQUEST_T_ {
+    HTTP_METHOD method;
+    HTTP_VIEW_T method_name;
+    HTTP_VIEW_T path;       // Without the query string
+    HTTP_VIEW_T query;      // Without the leading '?'
+    HTTP_VIEW_T body;
+    uint32_t path_hash;     // HttpHash of method and path, built while parsing
+    uint8_t version_minor;  // HTTP/1.x
+    uint8_t connection;     // HTTP_CONNECTION_* tokens of the Connection header
+    bool keep_alive;        // Connection persists after the response
+    uint8_t header_count;
+    HTTP_HEADER_T headers[HTTP_MAX_HEADERS];
+    uint32_t content_length;
+    uint16_t length;        // Bytes occupied by the whole request
+} HTTP_REQUEST_T;
+
+/**
+ * @brief FNV-1a step, shared by the parser and the compile-time route table.
+ */
+constexpr uint32_t HttpHash(uint32_t hash, uint8_t c) {
+    return (hash ^ c) * HTTP_HASH_PRIME;
+}
+
+constexpr uint32_t HttpHash(HTTP_METHOD method, const char* path) {
+    uint32_t hash = HttpHash(HTTP_HASH_BASIS, method);
+    while (*path != '\0') hash = HttpHash(hash, *path++);
+    return hash;
+}
+
+const char* HttpReason(int status);
+
+#define HTTP_LENGTH_UNKNOWN     (-1)    // Body ends when the connection closes
+#define HTTP_LENGTH_CHUNKED     (-2)
+
+#define HTTP_HEADER_CACHE_SIZE  (8)
+#define HTTP_HEADER_BLOCK_SIZE  (96)
+
+/**
+ * @brief Status line and Content-Type of a response, formatted once and reused.
+ */
+typedef struct HTTP_HEADER_BLOCK_T_ {
+    int status;
+    const char* content_type;   // NULL for responses without a body
+    uint16_t length;
+    char data[HTTP_HEADER_BLOCK_SIZE];
+} HTTP_HEADER_BLOCK_T;
+
+/**
+ * @brief Writes value in decimal without going through printf.
+ *
+ * @param buffer At least 10 bytes
+ * @param value
+ * @return size_t Number of digits written
+ */
+size_t HttpDecimal(char* buffer, uint32_t value);
+
+/**
+ * @brief Appends n bytes of s at *len if they fit.
+ *
+ * @param buffer
+ * @param max_len
+ * @param len Bytes already in buffer, advanced past s
+ * @param s
+ * @param n
+ * @return bool false if s does not fit, buffer is left as it was
+ */
+bool HttpPut(char* buffer, size_t max_len, size_t* len, const char* s, size_t n);
+bool HttpPut(char* buffer, size_t max_len, size_t* len, const char* s);
+
+/**
+ * @brief Response headers built from cached blocks.
+ * Only the length and Connection lines change between responses that share a
+ * status and content type, so the rest is formatted on first use and copied after.
+ */
+class HTTP_HEADER_CACHE {
+public:
+    /**
+     * @brief Cached block for status and content_type, formatted on first use.
+     *
+     * @param status
+     * @param content_type NULL for no Content-Type line
+     * @return const HTTP_HEADER_BLOCK_T* or NULL when the cache is full
+     */
+    static const HTTP_HEADER_BLOCK_T* Find(int status, const char* content_type);
+    /**
+     * @brief Writes a complete response header.
+     *
+     * @param buffer
+     * @param max_len
+     * @param status
+     * @param content_type NULL for no Content-Type line
+     * @param content_length Body length, HTTP_LENGTH_UNKNOWN or HTTP_LENGTH_CHUNKED
+     * @param keep_alive
+     * @return size_t Header length, 0 if it does not fit
+     */
+    static size_t Build(char* buffer, size_t max_len, int status, const char* content_type,
+        int32_t content_length, bool keep_alive);
+    /**
+     * @brief Writes the length and Connection lines and the blank line that end a header.
+     *
+     * @param buffer
+     * @param max_len
+     * @param content_length Body length, HTTP_LENGTH_UNKNOWN or HTTP_LENGTH_CHUNKED
+     * @param keep_alive
+     * @return size_t Bytes written, 0 if they do not fit
+     */
+    static size_t Finish(char* buffer, size_t max_len, int32_t content_length, bool keep_alive);
+
+private:
+    static bool Format(HTTP_HEADER_BLOCK_T* block, int status, const char* content_type);
+
+    static HTTP_HEADER_BLOCK_T blocks[HTTP_HEADER_CACHE_SIZE];
+    static uint8_t count;
+};
+
+/**
+ * @brief Resumable HTTP/1.x request parser.
+ * Received pbufs are chained in place and scanned once; the parser stops
+ * wherever the data runs out and continues from there on the next Feed.
+ */
+class HTTP_PARSER {
+public:
+    /**
+     * @brief Takes ownership of p and continues parsing.
+     *
+     * @param p
+     * @return HTTP_STATUS
+     */
+    HTTP_STATUS Feed(struct pbuf* p);
+    /**
+     * @brief Takes ownership of p without parsing it yet.
+     * Used to hold pipelined requests while a response is pending.
+     *
+     * @param p
+     */
+    void Append(struct pbuf* p);
+    /**
+     * @brief Continues parsing data that is already buffered.
+     *
+     * @return HTTP_STATUS
+     */
+    HTTP_STATUS Parse();
+    /**
+     * @brief Releases the bytes of the completed request and gets ready for the next one.
+     * Bytes of a following (pipelined) request stay buffered.
+     */
+    void Consume();
+    /**
+     * @brief Releases every buffered byte.
+     */
+    void Reset();
+    /**
+     * @brief Hands over the bytes buffered after the completed request and resets.
+     * Used when the connection switches protocol after a Consume.
+     *
+     * @return struct pbuf* or NULL
+     */
+    struct pbuf* Detach();
+
+    bool Buffered() const;
+    /**
+     * @brief Bytes still buffered, the received data not yet released.
+     *
+     * @return uint16_t
+     */
+    uint16_t Size() const;
+
+    const HTTP_VIEW_T* Header(const char* name) const;
+    bool Equals(HTTP_VIEW_T view, const char* s) const;
+    bool EqualsIgnoreCase(HTTP_VIEW_T view, const char* s) const;
+    /**
+     * @brief Checks a comma separated header value for token, ignoring case.
+     *
+     * @param view
+     * @param token
+     * @return true if token is in the list
+     */
+    bool HasToken(HTTP_VIEW_T view, const char* token) const;
+    /**
+     * @brief Checks a comma separated list of entity tags for tag, byte for byte.
+     * Entity tags are opaque, so unlike HasToken case counts and nothing is a parameter.
+     *
+     * @param view
+     * @param tag Including the quotes, and W/ for a weak tag
+     * @return true if tag is in the list
+     */
+    bool HasEntityTag(HTTP_VIEW_T view, const char* tag) const;
+    /**
+     * @brief Pointer to the bytes of view if they do not straddle two pbufs.
+     *
+     * @param view
+     * @return const char* or NULL
+     */
+    const char* Contiguous(HTTP_VIEW_T view) const;
+    /**
+     * @brief Copies view into buf and NUL terminates it.
+     *
+     * @param view
+     * @param buf
+     * @param max_len
+     * @return size_t Number of bytes copied
+     */
+    size_t Copy(HTTP_VIEW_T view, char* buf, size_t max_len) const;
+
+public:
+    HTTP_REQUEST_T request;
+    HTTP_STATUS status;
+
+private:
+    HTTP_STATUS Step(uint8_t c);
+    HTTP_STATUS EndHeader();
+
+    struct pbuf* data;      // Buffered chain, views are offsets into it
+    struct pbuf* cursor;    // pbuf holding the next unread byte
+    uint16_t index;         // Next unread byte in cursor
+    uint16_t offset;        // Next unread byte in data
+    uint8_t state;
+    uint16_t mark;          // Start of the token being scanned
+    uint16_t end;           // End of the header value, without trailing blanks
+};
+
+#endif /* HTTP */
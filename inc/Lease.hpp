@@ -0,0 +1,156 @@
+/**
+ *@file Lease.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef LEASE
+#define LEASE
+
+#include <cstdint>
+#include <cstddef>
+
+#define DHCPS_BASE_IP   (16)    // Last octet of the first address handed out
+
+// Addresses handed out, up to the rest of the /24
+#ifndef DHCPS_MAX_IP
+#define DHCPS_MAX_IP    (64)
+#endif
+
+#define LEASE_OFFER_HOLD_S  (30)    // An offered address is kept back this long for the REQUEST
+#define LEASE_DECLINE_HOLD_S (60)   // A declined address is in use by someone, it is left alone this long
+#define LEASE_NONE          (0xFF)
+
+static_assert(DHCPS_MAX_IP > 0 && DHCPS_BASE_IP + DHCPS_MAX_IP <= 255, "DHCP pool must fit below .255");
+
+typedef enum LEASE_STATE_ {
+    LEASE_FREE = 0,     // Never handed out or released, no client attached
+    LEASE_IDLE,         // Lapsed, kept for its client until the address is needed
+    LEASE_OFFERED,
+    LEASE_BOUND,
+    LEASE_DECLINED,     // Found in use by another host, no client attached
+    LEASE_STATES,
+} LEASE_STATE;
+
+typedef struct LEASE_T_ {
+    uint8_t mac[6];
+    uint8_t state;
+    uint8_t chain;      // Next lease in the same MAC bucket
+    uint8_t prev;       // Neighbours in the list for its state
+    uint8_t next;
+    uint32_t expiry;    // Ticks the lease lapses at, offered and bound leases only
+} LEASE_T;
+
+/**
+ * @brief DHCP leases with a hashed MAC index and one list per state.
+ * Offered and bound leases all last the same time, so appending renewals keeps
+ * their lists in expiry order and lapsed leases are always at the head.
+ * Allocation takes a free address first, then the lease that lapsed longest ago.
+ */
+class LEASE_TABLE {
+    static constexpr size_t BUCKETS = [] {
+        size_t buckets = 1;
+        while (buckets < DHCPS_MAX_IP) buckets <<= 1;
+        return buckets;
+    }();
+
+public:
+    LEASE_TABLE();
+
+    /**
+     * @brief Lease held or last held by a client.
+     *
+     * @param mac
+     * @return LEASE_T* or NULL
+     */
+    LEASE_T* Find(const uint8_t* mac);
+    /**
+     * @brief The client's own lease, otherwise a free or lapsed one taken over for it.
+     *
+     * @param mac
+     * @param now
+     * @return LEASE_T* or NULL when every address is offered or bound
+     */
+    LEASE_T* Allocate(const uint8_t* mac, uint32_t now);
+    /**
+     * @brief The lease for a requested address, if the client may have it.
+     *
+     * @param address Last octet
+     * @param mac
+     * @param now
+     * @return LEASE_T* or NULL when the address is outside the pool or belongs to someone else
+     */
+    LEASE_T* Claim(uint8_t address, const uint8_t* mac, uint32_t now);
+    void Offer(LEASE_T* lease, uint32_t now);
+    void Bind(LEASE_T* lease, uint32_t now, uint32_t seconds);
+    /**
+     * @brief Gives the address up, the client gets a fresh one next time.
+     *
+     * @param lease
+     */
+    void Release(LEASE_T* lease);
+    /**
+     * @brief Binds an address to a client from a saved record.
+     * Unlike Claim the record wins, whoever held the address before loses it.
+     *
+     * @param address Last octet
+     * @param mac
+     * @param now
+     * @param seconds
+     * @return LEASE_T* or NULL when the address is outside the pool
+     */
+    LEASE_T* Restore(uint8_t address, const uint8_t* mac, uint32_t now, uint32_t seconds);
+    /**
+     * @brief Takes an address out of the pool for a while, its client has to pick another.
+     *
+     * @param lease
+     * @param now
+     */
+    void Decline(LEASE_T* lease, uint32_t now);
+    /**
+     * @brief Moves offered and bound leases that have lapsed to idle, and declined ones back to free.
+     *
+     * @param now
+     */
+    void Expire(uint32_t now);
+    /**
+     * @brief Ticks the next lease lapses at.
+     *
+     * @param at
+     * @return bool false when nothing is offered, bound or declined
+     */
+    bool Deadline(uint32_t* at) const;
+
+    /**
+     * @brief Walks the leases in one state, offered and bound ones soonest to expire first.
+     *
+     * @param state
+     * @return const LEASE_T* or NULL at the end
+     */
+    const LEASE_T* First(LEASE_STATE state) const { return heads[state] != LEASE_NONE ? &leases[heads[state]] : NULL; }
+    const LEASE_T* Next(const LEASE_T* lease) const { return lease->next != LEASE_NONE ? &leases[lease->next] : NULL; }
+    uint8_t Address(const LEASE_T* lease) const { return DHCPS_BASE_IP + (lease - leases); }
+    size_t Count(LEASE_STATE state) const { return counts[state]; }
+    static constexpr size_t Capacity() { return DHCPS_MAX_IP; }
+
+private:
+    static size_t Bucket(const uint8_t* mac);
+
+    void Link(LEASE_T* lease, LEASE_STATE state);
+    void Unlink(LEASE_T* lease);
+    void Hash(LEASE_T* lease, const uint8_t* mac);
+    void Unhash(LEASE_T* lease);
+
+    LEASE_T leases[DHCPS_MAX_IP];
+    uint8_t buckets[BUCKETS];
+    uint8_t heads[LEASE_STATES];
+    uint8_t tails[LEASE_STATES];
+    uint8_t counts[LEASE_STATES];
+};
+
+#endif /* LEASE */
@@ -0,0 +1,121 @@
+/**
+ *@file LeaseLog.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef LEASELOG
+#define LEASELOG
+
+#include <cstdint>
+#include <cstddef>
+
+#include <Flash.hpp>
+#include <Lease.hpp>
+
+#define LEASE_LOG_MAGIC     (0x4C4B454Eu)   // "NEKL"
+#define LEASE_LOG_VERSION   (1)
+#define LEASE_LOG_SLOTS     (FLASH_SECTOR_SIZE / sizeof(LEASE_RECORD_T))    // Header in slot 0, records after it
+#define LEASE_LOG_QUEUE     (16)    // Changes held in RAM between flushes
+#define LEASE_LOG_FLUSH_MS  (5000)  // Oldest change waits at most this long for more to batch with
+
+/**
+ * @brief One change to a lease, or the sector header in slot 0.
+ * An erased slot reads all 0xFF, so the first one ends the log.
+ */
+typedef struct LEASE_RECORD_T_ {
+    uint8_t mac[6];
+    uint8_t address;
+    uint8_t state;      // LEASE_BOUND, or LEASE_FREE once given up
+    uint32_t seconds;   // Lease time left when written
+    uint8_t unused[3];
+    uint8_t check;
+} LEASE_RECORD_T;
+
+typedef struct LEASE_LOG_HEADER_T_ {
+    uint32_t magic;
+    uint32_t generation;    // Highest valid one is the live sector
+    uint8_t version;
+    uint8_t unused[6];
+    uint8_t check;
+} LEASE_LOG_HEADER_T;
+
+typedef struct LEASE_LOG_STATS_T_ {
+    uint32_t restored;      // Records replayed at boot
+    uint32_t corrupt;       // Records skipped for a bad check, torn by a reset mid write
+    uint32_t recorded;
+    uint32_t coalesced;     // Changes to a client that already had one queued
+    uint32_t flushes;
+    uint32_t compactions;
+    uint32_t overflows;     // Queue full, the next flush writes a whole snapshot instead
+} LEASE_LOG_STATS_T;
+
+static_assert(sizeof(LEASE_RECORD_T) == 16 && sizeof(LEASE_LOG_HEADER_T) == 16, "Lease log slots are 16 bytes");
+static_assert(FLASH_PAGE_SIZE % sizeof(LEASE_RECORD_T) == 0, "Lease log slots must not straddle a page");
+static_assert(DHCPS_MAX_IP + LEASE_LOG_QUEUE < LEASE_LOG_SLOTS, "A snapshot and a full queue must fit in one sector");
+static_assert(FLASH_STORE_SECTORS >= 2, "Compaction needs a sector to move to");
+
+/**
+ * @brief Append only log of lease changes in the flash store.
+ * Changes are queued from the DHCP callback and written a page at a time by Flush
+ * from the main loop. A full sector is compacted into the next one by writing a
+ * snapshot of the bound leases, header last, so a reset at any point leaves
+ * the previous sector live. Sectors are used in turn to spread the erases.
+ */
+class LEASE_LOG {
+public:
+    /**
+     * @brief Finds the live sector and replays it into the table.
+     *
+     * @param table
+     * @param now
+     * @return size_t Leases restored
+     */
+    static size_t Start(LEASE_TABLE* table, uint32_t now);
+    /**
+     * @brief Queues a change for the next flush, safe from lwIP callbacks.
+     *
+     * @param mac
+     * @param address Last octet
+     * @param seconds Lease time granted, 0 once released
+     * @param now
+     */
+    static void Record(const uint8_t* mac, uint8_t address, uint32_t seconds, uint32_t now);
+    /**
+     * @brief Writes queued changes once they are old enough or the queue is filling up.
+     * Erases and programs flash, call from the main loop only.
+     *
+     * @param table
+     * @param now
+     * @param force Write whatever is queued now
+     */
+    static void Flush(const LEASE_TABLE* table, uint32_t now, bool force = false);
+
+    static LEASE_LOG_STATS_T stats;
+
+private:
+    static uint8_t Check(const void* slot);
+    static bool Valid(size_t sector, uint32_t* generation);
+    static size_t Replay(LEASE_TABLE* table, uint32_t now);
+    static size_t Snapshot(const LEASE_TABLE* table, uint32_t now, LEASE_RECORD_T* records);
+    static bool Append(const LEASE_RECORD_T* records, size_t count);
+    static bool Compact(const LEASE_RECORD_T* records, size_t count);
+    static bool WriteSlots(size_t sector, size_t slot, const void* slots, size_t count);
+
+    static bool started;
+    static size_t sector;       // Live sector
+    static uint32_t generation;
+    static size_t position;     // Next free slot in the live sector
+
+    static LEASE_RECORD_T queue[LEASE_LOG_QUEUE];
+    static size_t queued;
+    static bool overflowed;
+    static uint32_t oldest;     // Ticks the first queued change was made
+};
+
+#endif /* LEASELOG */
@@ -0,0 +1,115 @@
+/**
+ *@file Limit.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-29
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef LIMIT
+#define LIMIT
+
+#include <cstdint>
+#include <cstddef>
+
+typedef enum RATE_DECISION_ {
+    RATE_ALLOW = 0,
+    RATE_REFUSE,    // First one over the limit, worth a cheap refusal so the client backs off
+    RATE_DROP,      // Still over the limit, not worth any reply
+} RATE_DECISION;
+
+typedef struct RATE_LIMIT_STATS_T_ {
+    uint32_t allowed;
+    uint32_t refused;
+    uint32_t dropped;
+    uint32_t evictions;     // Clients pushed out of the table by a new one
+} RATE_LIMIT_STATS_T;
+
+/**
+ * @brief Token bucket per client address, in a fixed table with least recently seen replacement.
+ * Tokens are kept in thousandths so slow rates refill smoothly from millisecond ticks.
+ *
+ * @tparam N Clients tracked at once
+ * @tparam RATE Tokens added per second
+ * @tparam BURST Bucket size
+ */
+template <size_t N, uint32_t RATE, uint32_t BURST>
+class RATE_LIMITER {
+    static_assert(N > 0 && RATE > 0 && BURST > 0, "RATE_LIMITER needs a table, a rate and a burst");
+
+    static constexpr uint32_t TOKEN = 1000;
+    static constexpr uint32_t FULL = BURST * TOKEN;
+
+    typedef struct ENTRY_T_ {
+        uint32_t address;   // 0 when free
+        uint32_t tokens;
+        uint32_t last;      // Ticks of the last refill, also the last time the client was seen
+        bool refused;       // Told to back off since the bucket ran dry
+    } ENTRY_T;
+
+public:
+    /**
+     * @brief Takes a token from the client's bucket.
+     *
+     * @param address
+     * @param now Millisecond ticks
+     * @return RATE_DECISION
+     */
+    RATE_DECISION Check(uint32_t address, uint32_t now) {
+        ENTRY_T* entry = Find(address, now);
+
+        // Idle clients come back to a full bucket, and the product cannot overflow past it
+        uint32_t elapsed = now - entry->last;
+        entry->tokens = elapsed >= FULL / RATE ? FULL : LimitAdd(entry->tokens, elapsed * RATE);
+        entry->last = now;
+
+        if (entry->tokens >= TOKEN) {
+            entry->tokens -= TOKEN;
+            entry->refused = false;
+            stats.allowed++;
+            return RATE_ALLOW;
+        }
+
+        if (!entry->refused) {
+            entry->refused = true;
+            stats.refused++;
+            return RATE_REFUSE;
+        }
+
+        stats.dropped++;
+        return RATE_DROP;
+    }
+
+    RATE_LIMIT_STATS_T stats;
+
+private:
+    static uint32_t LimitAdd(uint32_t tokens, uint32_t added) {
+        return tokens + added > FULL ? FULL : tokens + added;
+    }
+
+    ENTRY_T* Find(uint32_t address, uint32_t now) {
+        ENTRY_T* oldest = &entries[0];
+        for (ENTRY_T& entry : entries) {
+            if (entry.address == address) return &entry;
+            if (entry.address == 0) {
+                oldest = &entry;
+                break;
+            }
+            if (now - entry.last > now - oldest->last) oldest = &entry;
+        }
+
+        if (oldest->address != 0) stats.evictions++;
+        oldest->address = address;
+        oldest->tokens = FULL;
+        oldest->last = now;
+        oldest->refused = false;
+        return oldest;
+    }
+
+    ENTRY_T entries[N];
+};
+
+#endif /* LIMIT */
@@ -0,0 +1,154 @@
+/**
+ *@file Metrics.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef METRICS
+#define METRICS
+
+#include <cstdint>
+#include <cstddef>
+
+#include <Routes.hpp>
+
+#define METRIC_PREFIX           "nekonet_"
+#define METRIC_CONTENT_TYPE     "text/plain; version=0.0.4; charset=utf-8"
+
+#define METRIC_BUCKETS          (16)    // Bounds from 16 us doubling up to 524 ms, then +Inf
+#define METRIC_BUCKET_SHIFT     (4)     // log2 of the first bound in microseconds
+#define METRIC_LINE_MAX         (192)   // Longest line of the exposition, HELP and TYPE together
+#define METRIC_SCRAPES          (2)     // Scrapes streamed at once
+#define METRIC_SCRAPE_STALE_MS  (30000) // A scrape not pulled for this long went with its connection
+
+/**
+ * @brief Latency histogram with power of two buckets, in fixed memory.
+ * Observe is a subtract, a count leading zeros and two adds. Buckets are
+ * kept apart and only added up into cumulative counts when scraped.
+ */
+class METRIC_HISTOGRAM {
+public:
+    void Observe(uint32_t us) {
+        uint32_t scaled = (us > 0 ? us - 1 : 0) >> METRIC_BUCKET_SHIFT;
+        uint32_t bucket = scaled == 0 ? 0 : 32 - __builtin_clz(scaled);
+        counts[bucket < METRIC_BUCKETS ? bucket : METRIC_BUCKETS]++;
+        sum_us += us;
+    }
+
+    /**
+     * @brief Upper bound of bucket i, inclusive.
+     *
+     * @param i Below METRIC_BUCKETS, the last bucket has no bound
+     * @return uint32_t Microseconds
+     */
+    static constexpr uint32_t Bound(size_t i) { return uint32_t(1) << (METRIC_BUCKET_SHIFT + i); }
+
+    uint32_t counts[METRIC_BUCKETS + 1];    // Observations in each bucket, the last is above every bound
+    uint64_t sum_us;
+};
+
+typedef enum METRIC_TYPE_ {
+    METRIC_TYPE_COUNTER = 0,
+    METRIC_TYPE_GAUGE,
+    METRIC_TYPE_HISTOGRAM,
+} METRIC_TYPE;
+
+/**
+ * @brief One series of a metric, filled in when it is scraped.
+ */
+typedef struct METRIC_SAMPLE_T_ {
+    const char* series;                 // Label value, ignored without METRIC_T::label
+    uint32_t value;
+    const METRIC_HISTOGRAM* histogram;  // For METRIC_TYPE_HISTOGRAM instead of value
+} METRIC_SAMPLE_T;
+
+/**
+ * @brief Fills series i of a metric.
+ *
+ * @param i
+ * @param sample
+ * @return bool false past the last series
+ */
+typedef bool (*METRIC_SOURCE)(size_t i, METRIC_SAMPLE_T* sample);
+
+/**
+ * @brief Entry of the registry. Counters already kept in the stats structs are
+ * read in place, so only what no stats struct holds costs anything to record.
+ * Consecutive entries with the same name are one family under one HELP and TYPE.
+ */
+typedef struct METRIC_T_ {
+    const char* name;           // After METRIC_PREFIX, counters end in _total
+    const char* help;
+    METRIC_TYPE type;
+    const char* label;          // Label name telling series apart, NULL for a single series
+    const char* series;         // Label value of value
+    const uint32_t* value;      // A single series read straight from a stats struct
+    METRIC_SOURCE source;       // or any number of series filled in at scrape time
+} METRIC_T;
+
+/**
+ * @brief Position of a scrape in the registry, kept between calls to the producer.
+ * The line being sent is kept too, so a send buffer smaller than a line cannot tear it
+ * and a value changing between calls cannot change its length.
+ */
+typedef struct METRIC_SCRAPE_T_ {
+    bool busy;                  // Set by Start, cleared once the body is done
+    uint16_t generation;        // Changes each time the slot is taken, a stale handle resolves to NULL
+    uint32_t last_active;       // Ticks of the last call to the producer
+    uint32_t offset;            // Body bytes produced so far
+    uint16_t metric;            // Registry entry
+    uint16_t series;
+    uint8_t row;                // Line within a histogram series
+    bool described;             // HELP and TYPE of the entry are out
+    uint8_t line_len;
+    uint8_t line_sent;
+    char line[METRIC_LINE_MAX];
+    uint32_t counts[METRIC_BUCKETS + 1];    // Histogram taken at its first line, its lines then agree
+    uint64_t sum_us;
+} METRIC_SCRAPE_T;
+
+/**
+ * @brief Registry of every counter, gauge and histogram, streamed in the Prometheus text format.
+ * Everything is recorded on core 0 by one writer into aligned words, which the Cortex-M0+
+ * loads and stores whole, so a scrape never reads a torn value and nothing needs locking.
+ */
+class METRIC_REGISTRY {
+public:
+    /**
+     * @brief Takes a scrape slot and points the response at Produce, 503 when every slot is taken.
+     * The /metrics route is pinned to core 0, where Produce runs too, so taking a slot needs no lock.
+     *
+     * @param response
+     */
+    static void Start(HTTP_RESPONSE_T* response);
+    /**
+     * @brief HTTP_PRODUCER writing whole lines as far as max_len, the next call carries on the line.
+     *
+     * @param context Handle from Start
+     * @param offset
+     * @param buffer
+     * @param max_len
+     * @return int
+     */
+    static int Produce(void* context, uint32_t offset, char* buffer, size_t max_len);
+
+private:
+    /**
+     * @brief Renders the next line of a scrape into its line buffer.
+     *
+     * @param scrape
+     * @return bool false once the registry is done
+     */
+    static bool Next(METRIC_SCRAPE_T* scrape);
+    static bool Sample(const METRIC_T* metric, size_t i, METRIC_SAMPLE_T* sample);
+    static bool Line(METRIC_SCRAPE_T* scrape, const char* format, ...);
+
+    static METRIC_SCRAPE_T scrapes[METRIC_SCRAPES];
+};
+
+#endif /* METRICS */
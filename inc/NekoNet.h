@@ -15,6 +15,8 @@
 #include <pico/stdlib.h>
 
  // For Intellisense
+#ifndef NEKONET_HOST
 #include <../../pico-sdk/src/boards/include/boards/pico_w.h>
+#endif
 
 void Heartbeat(int ms);
\ No newline at end of file
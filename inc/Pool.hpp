@@ -0,0 +1,129 @@
+/**
+ *@file Pool.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-04-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef POOL
+#define POOL
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+
+/**
+ * @brief Fixed capacity pool of T with O(1) acquire and release.
+ * Slots are handed out together with an opaque handle that carries the
+ * slot's generation, so a handle kept past Release resolves to NULL instead
+ * of to whatever reuses the slot.
+ *
+ * @tparam T Default constructible type, value-initialised on Acquire and destroyed on Release
+ * @tparam N Number of slots, at most 255
+ */
+template <typename T, size_t N>
+class SLAB_POOL {
+    static_assert(N > 0 && N < 0xFF, "SLAB_POOL holds 1 to 254 slots");
+
+public:
+    SLAB_POOL() {
+        for (size_t i = 0; i < N; ++i) {
+            next_free[i] = i + 1;
+            generation[i] = 1;
+        }
+        free_head = 0;
+        used = 0;
+        high_water = 0;
+    }
+
+    /**
+     * @brief Takes a slot off the free list and constructs a value-initialised T in it,
+     * zeroed for the plain structs kept here.
+     *
+     * @return T* or NULL when every slot is in use
+     */
+    T* Acquire() {
+        if (free_head >= N) return nullptr;
+
+        uint8_t i = free_head;
+        free_head = next_free[i];
+        next_free[i] = IN_USE;
+
+        if (++used > high_water) high_water = used;
+
+        return new (slots[i]) T{};
+    }
+
+    /**
+     * @brief Puts a slot back on the free list and invalidates its handles.
+     *
+     * @param item
+     */
+    void Release(T* item) {
+        size_t i = Index(item);
+        if (i >= N || next_free[i] != IN_USE) return;
+
+        Slot(i)->~T();
+
+        // Generation 0 is never handed out so a handle is never NULL
+        if (++generation[i] == 0) generation[i] = 1;
+
+        next_free[i] = free_head;
+        free_head = i;
+        used--;
+    }
+
+    void* Handle(const T* item) const {
+        size_t i = Index(item);
+        return reinterpret_cast<void*>(static_cast<uintptr_t>(generation[i]) << 8 | i);
+    }
+
+    /**
+     * @brief Maps a handle back to its slot.
+     *
+     * @param handle
+     * @return T* or NULL if the slot was released since the handle was taken
+     */
+    T* Resolve(void* handle) {
+        uintptr_t value = reinterpret_cast<uintptr_t>(handle);
+        size_t i = value & 0xFF;
+
+        if (i >= N || next_free[i] != IN_USE || generation[i] != (value >> 8)) return nullptr;
+        return Slot(i);
+    }
+
+    /**
+     * @brief Slot i if it is in use, for walking every live item.
+     *
+     * @param i
+     * @return T* or NULL
+     */
+    T* At(size_t i) {
+        return (i < N && next_free[i] == IN_USE) ? Slot(i) : nullptr;
+    }
+
+    size_t Occupancy() const { return used; }
+    size_t HighWater() const { return high_water; }
+    static constexpr size_t Capacity() { return N; }
+
+private:
+    static constexpr uint8_t IN_USE = 0xFF;
+
+    T* Slot(size_t i) { return std::launder(reinterpret_cast<T*>(slots[i])); }
+    size_t Index(const T* item) const {
+        return (reinterpret_cast<const uint8_t*>(item) - slots[0]) / sizeof(T);
+    }
+
+    alignas(T) uint8_t slots[N][sizeof(T)];  // Raw storage, a T lives in a slot only while it is acquired
+    uint16_t generation[N];
+    uint8_t next_free[N];   // Free list link, IN_USE while acquired
+    uint8_t free_head;
+    uint8_t used;
+    uint8_t high_water;
+};
+
+#endif /* POOL */
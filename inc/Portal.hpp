@@ -0,0 +1,87 @@
+/**
+ *@file Portal.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef PORTAL
+#define PORTAL
+
+#include <cstdint>
+#include <cstddef>
+
+#include <lwip/ip_addr.h>
+
+#include <HTTP.hpp>
+
+#define PORTAL_PATH             "/NekoNet"
+#define PORTAL_RESPONSE_SIZE    (160)
+
+typedef enum PORTAL_CLIENT_ {
+    PORTAL_ANDROID = 0,
+    PORTAL_APPLE,
+    PORTAL_WINDOWS,
+    PORTAL_FIREFOX,
+    PORTAL_CLIENT_COUNT,
+} PORTAL_CLIENT;
+
+/**
+ * @brief Connectivity check an OS sends right after it joins a network.
+ */
+typedef struct PORTAL_PROBE_T_ {
+    const char* path;
+    const char* host;       // NULL to match the path on any host
+    PORTAL_CLIENT client;
+    uint32_t hash;          // HttpHash of GET and path
+} PORTAL_PROBE_T;
+
+/**
+ * @brief Canned response for a probe.
+ */
+typedef struct PORTAL_RESPONSE_T_ {
+    char header[PORTAL_RESPONSE_SIZE];  // Without the Connection line
+    size_t header_len;
+    const char* body;
+    size_t body_len;
+} PORTAL_RESPONSE_T;
+
+/**
+ * @brief Recognises OS connectivity probes and answers them so the OS opens the portal.
+ * Responses are formatted once for the gateway address, a probe costs a few
+ * hash compares and a copy.
+ */
+class PORTAL_PROBES {
+public:
+    /**
+     * @brief Formats the canned responses for the portal at address.
+     *
+     * @param address
+     */
+    static void Build(const ip_addr_t* address);
+    /**
+     * @brief Matches the request against the known probes.
+     *
+     * @param parser
+     * @return const PORTAL_PROBE_T* or NULL
+     */
+    static const PORTAL_PROBE_T* Classify(const HTTP_PARSER& parser);
+    /**
+     * @brief Canned response for a probe.
+     *
+     * @param probe
+     * @return const PORTAL_RESPONSE_T* or NULL before Build
+     */
+    static const PORTAL_RESPONSE_T* Response(const PORTAL_PROBE_T* probe);
+
+    static uint32_t hits[PORTAL_CLIENT_COUNT];
+
+private:
+    static PORTAL_RESPONSE_T responses[PORTAL_CLIENT_COUNT];
+};
+
+#endif /* PORTAL */
@@ -0,0 +1,75 @@
+/**
+ *@file Ring.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-01
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef RING
+#define RING
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Lock-free single producer, single consumer ring.
+ * One core pushes and the other pops. Only loads and stores of the indices
+ * are atomic, which the Cortex-M0+ does without locks, and the same code runs
+ * between two host threads.
+ *
+ * @tparam T Copyable item
+ * @tparam N Capacity, a power of two
+ */
+template <typename T, size_t N>
+class SPSC_RING {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SPSC_RING capacity must be a power of two");
+
+public:
+    /**
+     * @brief Producer side.
+     *
+     * @param item
+     * @return false if the ring is full
+     */
+    bool Push(const T& item) {
+        uint32_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - head.load(std::memory_order_acquire) >= N) return false;
+
+        items[tail & (N - 1)] = item;
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Consumer side.
+     *
+     * @param item
+     * @return false if the ring is empty
+     */
+    bool Pop(T* item) {
+        uint32_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire)) return false;
+
+        *item = items[head & (N - 1)];
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t Capacity() { return N; }
+
+private:
+    T items[N];
+    std::atomic<uint32_t> head { 0 };   // Next item to pop, written by the consumer only
+    std::atomic<uint32_t> tail { 0 };   // Next slot to push, written by the producer only
+};
+
+#endif /* RING */
@@ -0,0 +1,155 @@
+/**
+ *@file Routes.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef ROUTES
+#define ROUTES
+
+#include <cstdint>
+#include <cstddef>
+
+#include <HTTP.hpp>
+#include <Task.hpp>
+#include <WebSocket.hpp>
+
+#define ROUTE_CONTENT_TYPE_HTML "text/html; charset=utf-8"
+
+class METRIC_HISTOGRAM;
+
+/**
+ * @brief Writes the next part of a streamed body into buffer.
+ *
+ * @param context HTTP_RESPONSE_T::context
+ * @param offset Body bytes produced so far
+ * @param buffer
+ * @param max_len
+ * @return int Bytes written, 0 at the end of the body, negative to abort the connection
+ */
+typedef int (*HTTP_PRODUCER)(void* context, uint32_t offset, char* buffer, size_t max_len);
+
+typedef struct HTTP_RESPONSE_T_ {
+    int status;                 // 200 unless the handler says otherwise
+    const char* content_type;   // ROUTE_CONTENT_TYPE_HTML unless the handler says otherwise
+    char* body;                 // Per-connection buffer for the body
+    size_t body_max;
+    size_t body_len;
+    HTTP_PRODUCER producer;     // Set to stream a body of any size instead of using body
+    void* context;
+    int32_t content_length;     // Streamed body length, HTTP_LENGTH_UNKNOWN to send it chunked
+    WS_HANDLER websocket;       // Set to upgrade the connection to a WebSocket instead of sending a body
+    bool event_stream;          // Set to subscribe the connection to TCP_SERVER::Publish instead of sending a body
+} HTTP_RESPONSE_T;
+
+typedef void (*ROUTE_HANDLER)(const HTTP_PARSER& request, HTTP_RESPONSE_T* response);
+/**
+ * @brief Handler that may co_await before the response is sent.
+ * request and response stay valid until the task finishes, other clients are served meanwhile.
+ */
+typedef ASYNC_TASK (*ROUTE_ASYNC_HANDLER)(const HTTP_PARSER& request, HTTP_RESPONSE_T* response);
+
+typedef struct ROUTE_T_ {
+    HTTP_METHOD method;
+    const char* path;
+    ROUTE_HANDLER handler;
+    ROUTE_ASYNC_HANDLER async;  // Used instead of handler when set
+    bool pinned;                // Never offloaded to core 1, for handlers sharing state with core 0
+} ROUTE_T;
+
+/**
+ * @brief Route lookup by a perfect hash found at compile time.
+ * The parser hashes method and path while it scans them, so a lookup is one
+ * multiply, one slot read and a single compare to confirm the match.
+ *
+ * @tparam N Number of routes
+ */
+template <size_t N>
+class ROUTE_TABLE {
+    static_assert(N > 0 && N < 0xFF, "ROUTE_TABLE holds 1 to 254 routes");
+
+    static constexpr size_t BITS = [] {
+        size_t bits = 2;
+        while ((size_t(1) << bits) < 4 * N) bits++;
+        return bits;
+    }();
+    static constexpr size_t SIZE = size_t(1) << BITS;
+    static constexpr uint8_t EMPTY = 0xFF;
+
+public:
+    constexpr ROUTE_TABLE(const ROUTE_T (&list)[N]) : routes(list), hashes(), slots(), seed(0) {
+        for (size_t i = 0; i < N; ++i) hashes[i] = HttpHash(list[i].method, list[i].path);
+
+        // Try seeds until every route lands in its own slot. A table four
+        // times the route count takes a handful of attempts.
+        for (seed = 0; seed < 0x10000; ++seed) {
+            if (Place()) return;
+        }
+        throw "ROUTE_TABLE: no perfect hash seed, check for duplicate routes";
+    }
+
+    const ROUTE_T* Find(const HTTP_PARSER& parser) const {
+        const HTTP_REQUEST_T& request = parser.request;
+
+        uint8_t i = slots[Slot(request.path_hash)];
+        if (i == EMPTY || hashes[i] != request.path_hash) return nullptr;
+        if (routes[i].method != request.method || !parser.Equals(request.path, routes[i].path)) return nullptr;
+
+        return &routes[i];
+    }
+
+private:
+    constexpr size_t Slot(uint32_t hash) const {
+        return static_cast<uint32_t>((hash ^ seed) * 0x9E3779B1u) >> (32 - BITS);
+    }
+
+    constexpr bool Place() {
+        for (size_t i = 0; i < SIZE; ++i) slots[i] = EMPTY;
+
+        for (size_t i = 0; i < N; ++i) {
+            size_t slot = Slot(hashes[i]);
+            if (slots[slot] != EMPTY) return false;
+            slots[slot] = i;
+        }
+        return true;
+    }
+
+    const ROUTE_T* routes;
+    uint32_t hashes[N];
+    uint8_t slots[SIZE];
+    uint32_t seed;
+};
+
+class ROUTER {
+public:
+    /**
+     * @brief Route registered for the request's method and path.
+     *
+     * @param parser
+     * @return const ROUTE_T* or NULL
+     */
+    static const ROUTE_T* Find(const HTTP_PARSER& parser);
+
+    static size_t Count();
+    /**
+     * @brief Route i in the order they are listed.
+     *
+     * @param i Below Count
+     * @return const ROUTE_T*
+     */
+    static const ROUTE_T* At(size_t i);
+    /**
+     * @brief Time from a complete request to its response being queued, kept for each route.
+     *
+     * @param route From Find or At
+     * @return METRIC_HISTOGRAM*
+     */
+    static METRIC_HISTOGRAM* Timing(const ROUTE_T* route);
+};
+
+#endif /* ROUTES */
@@ -14,39 +14,289 @@
 
 #define TCP_PORT 80
 
+#define HTTP_KEEPALIVE_TIMEOUT_S        (5)     // Idle time before a persistent connection is closed
+#define HTTP_KEEPALIVE_MAX_REQUESTS     (100)   // Requests served before a persistent connection is closed
+#define HTTP_RESPONSE_TIMEOUT_S         (30)    // Time a response still being built or sent may go without progress
+
 #include <pico/cyw43_arch.h>
 
 #include <lwip/tcp.h>
 
+#include <Assets.hpp>
+#include <Events.hpp>
+#include <HTTP.hpp>
+#include <Metrics.hpp>
+#include <Pool.hpp>
+#include <Portal.hpp>
+#include <Routes.hpp>
+
+#ifdef NEKONET_DUAL_CORE
+#include <Ring.hpp>
+#endif
+
+#define TCP_SERVER_BACKLOG      (4)     // Connections lwIP may hold before Accept
+#define TCP_RESERVED_PCBS       (1)     // pcbs kept free so a full server can still answer 503
+#define TCP_MAX_CONNECTIONS     (MEMP_NUM_TCP_PCB - TCP_RESERVED_PCBS)
+#define TCP_RETRY_AFTER_S       2
+
+#define WS_PING_INTERVAL_S      20      // Ping a quiet WebSocket client this often
+#define WS_IDLE_TIMEOUT_S       60      // and give up on it after this long without a frame
+#define EVENT_KEEPALIVE_S       15      // Comment sent to a quiet event stream so proxies keep it open
+
+// lwIP kills the lowest priority pcb first when it runs out, so idle
+// keep-alive connections go before connections that are serving a request
+#define TCP_PRIO_ACTIVE         (TCP_PRIO_NORMAL + 1)
+#define TCP_PRIO_IDLE           (TCP_PRIO_MIN)
+
+// Spans shorter than this are copied even when they could be referenced
+#define TCP_SPAN_COPY_BELOW     (64)
+
+/**
+ * @brief Responses not made by a route, timed apart from the routes.
+ */
+typedef enum TCP_TIMING_ {
+    TCP_TIMING_ASSET = 0,
+    TCP_TIMING_PROBE,
+    TCP_TIMING_REDIRECT,
+    TCP_TIMING_REJECT,      // 404 and 405
+    TCP_TIMINGS,
+} TCP_TIMING;
+
+typedef enum TCP_SPAN_LIFETIME_ {
+    TCP_SPAN_FLASH = 0,     // Read-only data in flash, referenced
+    TCP_SPAN_STATIC,        // RAM that outlives the connection and does not change, referenced
+    TCP_SPAN_CONNECTION,    // Connection buffers, reused by the next request so copied
+    TCP_SPAN_TRANSIENT,     // Stack memory, copied
+} TCP_SPAN_LIFETIME;
+
+/**
+ * @brief Piece of a response for TCP_SERVER::Write.
+ */
+typedef struct TCP_SPAN_T_ {
+    const void* data;
+    uint16_t length;
+    TCP_SPAN_LIFETIME lifetime;
+} TCP_SPAN_T;
+
 typedef struct TCP_CONNECT_STATE_T_ {
     struct tcp_pcb* pcb;
-    int sent_len;
-    char header[128];
+    char header[256];
     char result[256];
     int header_len;
     int result_len;
-    ip_addr_t* gw;
+    HTTP_PARSER parser;
+    uint32_t last_active;   // Ticks of the last receive or acknowledgement
+    uint16_t unacked;       // Received bytes still buffered, the window reopens as they are released
+    uint16_t requests;      // Requests answered on this connection
+    const uint8_t* body;    // Flash body still to be queued, sent without copying
+    uint32_t body_left;
+    HTTP_PRODUCER producer; // Streamed body, pulled into result as send buffer frees up
+    void* producer_context;
+    uint32_t produced;
+    int32_t produce_left;   // Bytes the producer still owes, HTTP_LENGTH_UNKNOWN when not known
+    bool chunked;
+    bool closing;           // Close once everything sent is acknowledged
+    WS_HANDLER websocket;   // Set once the connection is upgraded, frames go to ws instead of parser
+    WS_PARSER ws;
+    uint32_t last_ping;
+    bool event_stream;      // Subscribed to the event ring, nothing more is read from the client
+    uint32_t event_cursor;  // Id of the next event to send
+    ASYNC_TASK task;        // Asynchronous handler still running, it fills response
+    HTTP_RESPONSE_T response;
+    METRIC_HISTOGRAM* timing;   // Where the request being answered is timed, NULL for none
+    uint32_t started;       // Microseconds the request was complete
+#ifdef NEKONET_DUAL_CORE
+    bool pending;           // Request handed to core 1, its response has not come back yet
+    bool orphaned;          // Closed while pending, the slot is released when the response comes back
+    struct pbuf* held;      // Received while pending
+#endif
 } TCP_CONNECT_STATE_T;
 
+#ifdef NEKONET_DUAL_CORE
+#define TCP_WORK_QUEUE          (8)     // Requests in flight to core 1, a power of two
+
+/**
+ * @brief Request handed to the route handler on core 1, and its response on the way back.
+ */
+typedef struct TCP_WORK_T_ {
+    TCP_CONNECT_STATE_T* connection;
+    const ROUTE_T* route;
+    HTTP_RESPONSE_T response;
+} TCP_WORK_T;
+
+static_assert(TCP_WORK_QUEUE >= TCP_MAX_CONNECTIONS, "TCP_WORK_QUEUE must hold a request from every connection");
+#endif
+
+typedef struct TCP_SERVER_STATS_T_ {
+    uint32_t accepts;
+    uint32_t rejections;    // Turned away with 503, no free connection slot
+    uint32_t evictions;     // Idle connections closed to make room
+    uint32_t timeouts;      // Closed by the idle timer
+    uint32_t aborts;        // Lost to a reset or an abort inside lwIP
+    uint32_t upgrades;      // Connections switched to WebSocket
+    uint32_t ws_dropped;    // WebSocket messages not sent for lack of send buffer
+    uint32_t subscriptions; // Event streams opened
+    uint32_t event_gaps;    // Times a subscriber fell behind the event ring
+} TCP_SERVER_STATS_T;
+
 class TCP_SERVER {
 public:
     static err_t Poll(void* arg, struct tcp_pcb* pcb);
     static err_t Sent(void* arg, struct tcp_pcb* pcb, u16_t len);
     static err_t Accept(void* arg, struct tcp_pcb* client_pcb, err_t err);
+    /**
+     * @brief Hands p to the parser and answers whatever requests it completes.
+     * p belongs to the connection once it is buffered, so anything but ERR_ABRT would
+     * have lwIP keep a chain that may already be freed. Errors after that point close
+     * the connection and are not reported back.
+     *
+     * @return err_t ERR_OK, or ERR_ABRT once the pcb is aborted
+     */
     static err_t Receive(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err);
     static err_t CloseClient(TCP_CONNECT_STATE_T* con_state, struct tcp_pcb* client_pcb, err_t close_err);
+    static err_t Abort(struct tcp_pcb* pcb);
+    static err_t Refuse(struct tcp_pcb* pcb);
+    static bool Evict();
+    static void Release(TCP_CONNECT_STATE_T* con_state);
+
+    static err_t Dispatch(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    static err_t Respond(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    static err_t Complete(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, const HTTP_RESPONSE_T* response);
+    static void NextRequest(TCP_CONNECT_STATE_T* connection);
+    /**
+     * @brief Reopens the receive window by what the parsers released since the last call.
+     * Unread data keeps the window shut, so a client can never have more than TCP_WND buffered.
+     *
+     * @param connection
+     */
+    static void Acknowledge(TCP_CONNECT_STATE_T* connection);
+    static err_t Await(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, const ROUTE_T* route,
+        const HTTP_RESPONSE_T* response);
+    static void Finished(async_context_t* context, async_when_pending_worker_t* worker);
+    static err_t SendHeader(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, int status, const char* content_type,
+        int32_t content_length, const char* body, size_t body_len);
+    static err_t SendAsset(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, const ASSET_T* asset);
+    static err_t SendProbe(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, const PORTAL_RESPONSE_T* response);
+    static err_t SendStream(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, const HTTP_RESPONSE_T* response);
+    static err_t SendBody(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    static err_t Produce(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    /**
+     * @brief Queues spans back to back so they share segments, then flushes once.
+     * Either every span is queued or the connection is closed.
+     *
+     * @param connection
+     * @param pcb
+     * @param spans
+     * @param count
+     * @param more More of the response follows, do not flush yet
+     * @return err_t
+     */
+    static err_t Write(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, const TCP_SPAN_T* spans, size_t count,
+        bool more);
+    static err_t Upgrade(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, WS_HANDLER handler);
+    static err_t WsDispatch(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    static err_t WsClose(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, uint16_t code);
+    /**
+     * @brief Sends one unfragmented frame if the send buffer has room for all of it.
+     *
+     * @return err_t ERR_MEM when there is no room, the connection stays open
+     */
+    static err_t SendFrame(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, uint8_t opcode, const void* data,
+        size_t len);
+    static err_t Subscribe(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    static err_t SendEvents(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb);
+    static bool Streaming(const TCP_CONNECT_STATE_T* connection);
+    static err_t Reject(TCP_CONNECT_STATE_T* connection, struct tcp_pcb* pcb, int status);
+    /**
+     * @brief Adds the time since the request was complete to its histogram, once its response is queued.
+     *
+     * @param connection
+     */
+    static void Observe(TCP_CONNECT_STATE_T* connection);
 
     static void Error(void* arg, err_t err);
-    static int Content(const char* request, const char* params, char* result, size_t max_result_len);
+
+#ifdef NEKONET_DUAL_CORE
+    /**
+     * @brief Queues a routed request for core 1.
+     * The connection stays pending until Completed writes the response on core 0.
+     *
+     * @return bool false if the queue is full, the handler then runs here
+     */
+    static bool Offload(TCP_CONNECT_STATE_T* connection, const ROUTE_T* route, const HTTP_RESPONSE_T* response);
+    static void Worker();
+    static void Completed(async_context_t* context, async_when_pending_worker_t* worker);
+#endif
 
     TCP_SERVER(const char* ap_name);
     ~TCP_SERVER();
 
+    /**
+     * @brief Sets the portal address and builds the redirect and probe responses for it.
+     *
+     * @param address
+     */
+    void SetGateway(const ip_addr_t* address);
+
+    /**
+     * @brief Sends a message to one WebSocket client.
+     *
+     * @param client Handle passed to the WS_HANDLER
+     * @param data
+     * @param len
+     * @param text
+     * @return err_t ERR_CLSD if the client is gone, ERR_MEM if its send buffer is full
+     */
+    static err_t SendMessage(void* client, const void* data, size_t len, bool text);
+    /**
+     * @brief Sends a message to every WebSocket client.
+     * Clients without room in their send buffer miss the message rather than have it queued.
+     *
+     * @param data
+     * @param len
+     * @param text
+     * @return size_t Number of clients the message was queued for
+     */
+    static size_t Broadcast(const void* data, size_t len, bool text);
+    /**
+     * @brief Adds an event to the ring and pushes it to every event stream with room for it.
+     * Streams without room catch up from the ring as their send buffer drains.
+     *
+     * @param name Event type, NULL for the default "message"
+     * @param data
+     * @param len
+     * @return uint32_t Event id, 0 if the event is too large
+     */
+    static uint32_t Publish(const char* name, const char* data, size_t len);
+
 public:
     struct tcp_pcb* server_pcb;
     bool complete;
     ip_addr_t gw;
     async_context* context;
+
+    /**
+     * @brief Connection states, sized to the lwIP pcb pool.
+     * lwIP callbacks get a generation checked handle to a slot as arg.
+     */
+    static SLAB_POOL<TCP_CONNECT_STATE_T, TCP_MAX_CONNECTIONS> connections;
+    static TCP_SERVER_STATS_T stats;
+    static EVENT_RING events;
+    static METRIC_HISTOGRAM timings[TCP_TIMINGS];
+
+private:
+    static async_when_pending_worker_t task_worker;   // Set pending when an asynchronous handler finishes
+    static struct tcp_pcb* aborted; // Last pcb CloseClient had to abort, tells a callback what to report to lwIP
+
+    static char redirect[HTTP_HEADER_BLOCK_SIZE];  // Redirect header without the length and Connection lines
+    static size_t redirect_len;
+
+#ifdef NEKONET_DUAL_CORE
+    static SPSC_RING<TCP_WORK_T, TCP_WORK_QUEUE> requests;      // Core 0 to core 1
+    static SPSC_RING<TCP_WORK_T, TCP_WORK_QUEUE> completions;   // Core 1 to core 0
+    static async_when_pending_worker_t completion_worker;
+    static async_context_t* worker_context;
+#endif
 };
 
 #endif /* TCP */
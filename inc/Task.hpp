@@ -0,0 +1,125 @@
+/**
+ *@file Task.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef TASK
+#define TASK
+
+#include <coroutine>
+#include <cstdint>
+#include <cstddef>
+
+#include <pico/async_context.h>
+
+#include <Pool.hpp>
+
+#define TASK_FRAME_SIZE     (256)   // Largest coroutine frame, locals kept across a co_await count towards it
+#define TASK_FRAMES         (4)     // Tasks suspended at once
+
+typedef struct TASK_FRAME_T_ {
+    alignas(8) uint8_t data[TASK_FRAME_SIZE];
+} TASK_FRAME_T;
+
+typedef struct TASK_STATS_T_ {
+    uint32_t started;
+    uint32_t exhausted;     // No free frame, or the frame is larger than TASK_FRAME_SIZE
+} TASK_STATS_T;
+
+/**
+ * @brief Coroutine run on the async_context, for handlers that wait on timers or I/O.
+ * Frames come from a fixed pool. When none is free the coroutine does not run and
+ * the returned task is not Valid.
+ * A task starts suspended. Start runs it to its first co_await, and the worker
+ * given to Start is set pending once it has finished.
+ */
+class ASYNC_TASK {
+public:
+    struct promise_type {
+        async_when_pending_worker_t* notify;
+
+        struct FINAL_AWAITER {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() const noexcept {}
+        };
+
+        ASYNC_TASK get_return_object() { return ASYNC_TASK(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        static ASYNC_TASK get_return_object_on_allocation_failure() { return ASYNC_TASK(); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FINAL_AWAITER final_suspend() const noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception();
+
+        static void* operator new(size_t size) noexcept;
+        static void operator delete(void* frame);
+    };
+
+    ASYNC_TASK() : handle(nullptr) {}
+    ASYNC_TASK(ASYNC_TASK&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    ASYNC_TASK& operator=(ASYNC_TASK&& other) noexcept;
+    ASYNC_TASK(const ASYNC_TASK&) = delete;
+    ASYNC_TASK& operator=(const ASYNC_TASK&) = delete;
+    ~ASYNC_TASK() { Destroy(); }
+
+    bool Valid() const { return static_cast<bool>(handle); }
+    bool Done() const { return handle && handle.done(); }
+
+    /**
+     * @brief Runs the task up to its first suspension.
+     *
+     * @param notify Set pending on the async_context when the task finishes
+     */
+    void Start(async_when_pending_worker_t* notify);
+    /**
+     * @brief Frees the frame, finished or not. Awaiters cancel whatever they wait on as they are destroyed.
+     */
+    void Destroy();
+
+    /**
+     * @brief Sets the async_context tasks are resumed on.
+     *
+     * @param context
+     */
+    static void Attach(async_context_t* context);
+
+    static async_context_t* context;
+    static TASK_STATS_T stats;
+
+private:
+    explicit ASYNC_TASK(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+
+    static SLAB_POOL<TASK_FRAME_T, TASK_FRAMES> frames;
+};
+
+/**
+ * @brief co_await ASYNC_SLEEP(ms) resumes the task from an at-time worker after ms.
+ * ASYNC_SLEEP(0) gives every other client a turn before carrying on.
+ */
+class ASYNC_SLEEP {
+public:
+    explicit ASYNC_SLEEP(uint32_t ms) : worker(), ms(ms), armed(false) {}
+    ~ASYNC_SLEEP();
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+private:
+    static void Wake(async_context_t* context, async_at_time_worker_t* worker);
+
+    async_at_time_worker_t worker;
+    std::coroutine_handle<> handle;
+    uint32_t ms;
+    bool armed;
+};
+
+#endif /* TASK */
@@ -0,0 +1,121 @@
+/**
+ *@file WebSocket.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef WEBSOCKET
+#define WEBSOCKET
+
+#include <cstdint>
+#include <cstddef>
+
+#include <lwip/pbuf.h>
+
+#define WS_GUID                 "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_LENGTH           (24)    // Base64 of the client's 16 byte nonce
+#define WS_ACCEPT_LENGTH        (28)    // Base64 of a SHA-1 digest
+#define WS_MAX_HEADER           (14)
+#define WS_MAX_CONTROL          (125)
+
+#define WS_OPCODE_CONTINUATION  (0x0)
+#define WS_OPCODE_TEXT          (0x1)
+#define WS_OPCODE_BINARY        (0x2)
+#define WS_OPCODE_CLOSE         (0x8)
+#define WS_OPCODE_PING          (0x9)
+#define WS_OPCODE_PONG          (0xA)
+
+#define WS_CLOSE_NORMAL         (1000)
+#define WS_CLOSE_PROTOCOL_ERROR (1002)
+#define WS_CLOSE_TOO_LARGE      (1009)
+
+typedef enum WS_STATUS_ {
+    WS_INCOMPLETE = 0,      // Need more data
+    WS_MESSAGE,             // A whole text or binary message was reassembled
+    WS_CONTROL,             // A ping, pong or close frame, payload in WS_PARSER::control
+    WS_PROTOCOL_ERROR,
+    WS_TOO_LARGE,           // Message does not fit the buffer given to Parse
+} WS_STATUS;
+
+/**
+ * @brief Called for every message a WebSocket client sends.
+ *
+ * @param client Handle for TCP_SERVER::SendMessage, stays safe to use after the client leaves
+ * @param data
+ * @param len
+ * @param text Text or binary message
+ */
+typedef void (*WS_HANDLER)(void* client, const uint8_t* data, size_t len, bool text);
+
+void WsSha1(const uint8_t* data, size_t len, uint8_t digest[20]);
+size_t WsBase64(const uint8_t* data, size_t len, char* out);
+/**
+ * @brief Sec-WebSocket-Accept for a Sec-WebSocket-Key.
+ *
+ * @param key
+ * @param key_len
+ * @param out WS_ACCEPT_LENGTH + 1 bytes, NUL terminated
+ * @return true if key has the expected length
+ */
+bool WsAccept(const char* key, size_t key_len, char* out);
+/**
+ * @brief Writes an unmasked server frame header.
+ *
+ * @param header WS_MAX_HEADER bytes
+ * @param opcode
+ * @param len Payload length, at most 65535
+ * @return size_t Header length
+ */
+size_t WsFrameHeader(uint8_t* header, uint8_t opcode, size_t len);
+
+/**
+ * @brief Resumable WebSocket frame parser.
+ * Received pbufs are chained until a whole frame is in; frames may straddle
+ * pbufs and fragmented messages are reassembled into the caller's buffer.
+ */
+class WS_PARSER {
+public:
+    /**
+     * @brief Takes ownership of p.
+     *
+     * @param p
+     */
+    void Append(struct pbuf* p);
+    /**
+     * @brief Unmasks the next complete message or control frame.
+     *
+     * @param message Reassembly buffer, must be the same on every call
+     * @param max_len
+     * @return WS_STATUS
+     */
+    WS_STATUS Parse(uint8_t* message, size_t max_len);
+    /**
+     * @brief Releases every buffered byte.
+     */
+    void Reset();
+
+    bool Buffered() const;
+    /**
+     * @brief Bytes still buffered, frames are released as Parse returns them.
+     *
+     * @return uint16_t
+     */
+    uint16_t Size() const;
+
+public:
+    uint8_t opcode;         // Of the message or control frame Parse returned
+    size_t length;          // Its payload length
+    uint8_t control[WS_MAX_CONTROL];
+
+private:
+    struct pbuf* data;
+    uint8_t message_opcode; // Opcode of the fragmented message in progress, 0 if none
+    size_t message_length;  // Bytes of it reassembled so far
+};
+
+#endif /* WEBSOCKET */
@@ -0,0 +1,182 @@
+/**
+ *@file Zone.hpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef ZONE
+#define ZONE
+
+#include <cstdint>
+#include <cstddef>
+
+#include <DNS.hpp>
+
+#define DNS_HASH_BASIS  2166136261u
+#define DNS_HASH_PRIME  16777619u
+
+// Address of a zone entry, 0 answers with the portal address
+#define DNS_ADDRESS(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+
+typedef struct DNS_ZONE_T_ {
+    const char* name;   // Dotted name, a leading "*." matches every name below it
+    DNS_ANSWER answer;
+    uint32_t address;   // DNS_ADDRESS for DNS_ANSWER_ADDRESS entries
+} DNS_ZONE_T;
+
+constexpr uint8_t DnsLower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+/**
+ * @brief Case-insensitive FNV-1a step over one label.
+ * Labels are hashed last to first so every suffix of a name is hashed on the way to the whole name.
+ */
+constexpr uint32_t DnsHash(uint32_t hash, const char* label, size_t length) {
+    hash = (hash ^ length) * DNS_HASH_PRIME;
+    for (size_t i = 0; i < length; ++i) hash = (hash ^ DnsLower(label[i])) * DNS_HASH_PRIME;
+    return hash;
+}
+
+constexpr uint32_t DnsHash(const char* dotted) {
+    size_t end = 0;
+    while (dotted[end] != '\0') end++;
+
+    uint32_t hash = DNS_HASH_BASIS;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && dotted[start - 1] != '.') start--;
+
+        hash = DnsHash(hash, dotted + start, end - start);
+        end = start > 0 ? start - 1 : 0;
+    }
+    return hash;
+}
+
+/**
+ * @brief Compares a wire format name to a dotted one, ignoring case.
+ */
+bool DnsNameEquals(const uint8_t* name, const char* dotted);
+/**
+ * @brief Compares two wire format names, ignoring case.
+ */
+bool DnsNameEquals(const uint8_t* a, const uint8_t* b);
+
+/**
+ * @brief Local zone looked up by a perfect hash found at compile time.
+ * A lookup hashes the wire format name once and confirms with one compare.
+ * Wildcards cost one more slot read per label, and only when the zone has any.
+ *
+ * @tparam N Number of entries
+ */
+template <size_t N>
+class DNS_ZONE_TABLE {
+    static_assert(N > 0 && N < 0xFF, "DNS_ZONE_TABLE holds 1 to 254 names");
+
+    static constexpr size_t BITS = [] {
+        size_t bits = 2;
+        while ((size_t(1) << bits) < 4 * N) bits++;
+        return bits;
+    }();
+    static constexpr size_t SIZE = size_t(1) << BITS;
+    static constexpr uint8_t EMPTY = 0xFF;
+
+public:
+    constexpr DNS_ZONE_TABLE(const DNS_ZONE_T (&list)[N]) : entries(list), hashes(), slots(), seed(0), wildcards(false) {
+        for (size_t i = 0; i < N; ++i) {
+            const char* name = list[i].name;
+            if (name[0] == '*' && name[1] == '.') {
+                // "*.neko" hashes as the label "*" in front of "neko"
+                hashes[i] = DnsHash(DnsHash(name + 2), "*", 1);
+                wildcards = true;
+            } else {
+                hashes[i] = DnsHash(name);
+            }
+        }
+
+        for (seed = 0; seed < 0x10000; ++seed) {
+            if (Place()) return;
+        }
+        throw "DNS_ZONE_TABLE: no perfect hash seed, check for duplicate names";
+    }
+
+    /**
+     * @brief Entry for a name, an exact match before the longest matching wildcard.
+     *
+     * @param name Wire format name, already checked by DNS_SERVER::ParseQuestions
+     * @return const DNS_ZONE_T* or NULL
+     */
+    const DNS_ZONE_T* Find(const uint8_t* name) const {
+        uint8_t labels[DNS_MAX_NAME / 2 + 1];
+        size_t count = 0;
+        for (size_t offset = 0; name[offset] != 0; offset += name[offset] + 1) labels[count++] = offset;
+
+        const DNS_ZONE_T* match = nullptr;
+        uint32_t hash = DNS_HASH_BASIS;
+        for (size_t i = count; i-- > 0;) {
+            const uint8_t* label = name + labels[i];
+            hash = DnsHash(hash, reinterpret_cast<const char*>(label + 1), *label);
+
+            // Wildcards only cover names below them, so the whole name is never tried as one
+            if (wildcards && i > 0) {
+                const DNS_ZONE_T* entry = Lookup(DnsHash(hash, "*", 1), label, 2);
+                if (entry != nullptr) match = entry;
+            }
+        }
+
+        const DNS_ZONE_T* entry = Lookup(hash, name, 0);
+        return entry != nullptr ? entry : match;
+    }
+
+private:
+    constexpr size_t Slot(uint32_t hash) const {
+        return static_cast<uint32_t>((hash ^ seed) * 0x9E3779B1u) >> (32 - BITS);
+    }
+
+    constexpr bool Place() {
+        for (size_t i = 0; i < SIZE; ++i) slots[i] = EMPTY;
+
+        for (size_t i = 0; i < N; ++i) {
+            size_t slot = Slot(hashes[i]);
+            if (slots[slot] != EMPTY) return false;
+            slots[slot] = i;
+        }
+        return true;
+    }
+
+    const DNS_ZONE_T* Lookup(uint32_t hash, const uint8_t* name, size_t skip) const {
+        uint8_t i = slots[Slot(hash)];
+        if (i == EMPTY || hashes[i] != hash) return nullptr;
+
+        // skip drops the "*." of a wildcard entry
+        const char* entry = entries[i].name;
+        if ((skip > 0) != (entry[0] == '*' && entry[1] == '.')) return nullptr;
+        if (!DnsNameEquals(name, entry + skip)) return nullptr;
+
+        return &entries[i];
+    }
+
+    const DNS_ZONE_T* entries;
+    uint32_t hashes[N];
+    uint8_t slots[SIZE];
+    uint32_t seed;
+    bool wildcards;
+};
+
+class DNS_ZONE {
+public:
+    /**
+     * @brief Zone entry for a name in a DNS message.
+     *
+     * @param name Wire format name
+     * @return const DNS_ZONE_T* or NULL for the portal catch-all
+     */
+    static const DNS_ZONE_T* Find(const uint8_t* name);
+};
+
+#endif /* ZONE */
@@ -17,9 +17,15 @@
 #define LWIP_SOCKET                 0
 
 #define MEM_LIBC_MALLOC             0
+#ifdef NEKONET_HOST
+#define MEM_ALIGNMENT               8   // Pool elements hold 64 bit pointers on the host
+#else
 #define MEM_ALIGNMENT               4
+#endif
 #define MEM_SIZE                    4000
 #define MEMP_NUM_TCP_SEG            32
+#define MEMP_NUM_TCP_PCB            6
+#define TCP_LISTEN_BACKLOG          1
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
@@ -34,10 +40,13 @@
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
-#define MEM_STATS                   0
+// Heap, pool and link counters are served at /metrics, 32 bits so they do not wrap within the hour
+#define LWIP_STATS                  1
+#define LWIP_STATS_LARGE            1
+#define MEM_STATS                   1
 #define SYS_STATS                   0
-#define MEMP_STATS                  0
-#define LINK_STATS                  0
+#define MEMP_STATS                  1
+#define LINK_STATS                  1
 
 #define LWIP_CHKSUM_ALGORITHM       3
 #define LWIP_DHCP                   1
@@ -50,9 +59,13 @@
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
+#ifdef NEKONET_HOST
+// One thread runs lwIP on the host, the same pools as the board so it behaves the same
+#define SYS_LIGHTWEIGHT_PROT        0
+#endif
+
 #ifdef DEBUG
 #define LWIP_DEBUG                  1
-#define LWIP_STATS                  1
 #define LWIP_STATS_DISPLAY          1
 #endif
 
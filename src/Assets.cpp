@@ -0,0 +1,24 @@
+/**
+ *@file Assets.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-04-27
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstring>
+
+#include <Assets.hpp>
+
+const ASSET_T* ASSET_STORE::Find(const HTTP_PARSER& parser, HTTP_VIEW_T path) {
+    bool index = parser.Equals(path, "/");
+
+    for (size_t i = 0; i < count; ++i) {
+        if (index ? strcmp(table[i].path, ASSET_INDEX) == 0 : parser.Equals(path, table[i].path)) return &table[i];
+    }
+
+    return nullptr;
+}
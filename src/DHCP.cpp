@@ -23,22 +23,37 @@
 #define MAKE_IP4(a, b, c, d) ((a) << 24 | (b) << 16 | (c) << 8 | (d))
 
 #include <cassert>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
 
 #include <cyw43_config.h>
+#include <pico/cyw43_arch.h>
 
 #include <lwipopts.h>
 #include <lwip/udp.h>
 #include <lwip/ip_addr.h>
 
+#include <Buffer.hpp>
 #include <DHCP.hpp>
+#include <LeaseLog.hpp>
+
+LEASE_TABLE DHCP_SERVER::leases;
+async_at_time_worker_t DHCP_SERVER::sweeper;
+DHCP_SERVER_STATS_T DHCP_SERVER::stats;
 
 DHCP_SERVER::DHCP_SERVER(ip_addr_t* ip, ip_addr_t* nm) {
     ip_addr_copy(ipAddress, *ip);
     ip_addr_copy(netmask, *nm);
-    memset(lease, 0, sizeof(lease));
+
+    // Clients get back the addresses they had before the reboot
+    size_t restored = LEASE_LOG::Start(&leases, cyw43_hal_ticks_ms());
+    DEBUG_WRITE("DHCP: %u leases restored\n", (unsigned)restored);
+    (void)restored;
+
+    sweeper.do_work = Sweep;
+    Schedule(cyw43_hal_ticks_ms());
 
     if (SocketNewDatagram(Process) != ERR_OK) {
         ERROR_WRITE("DHCP: Failed to Start\n");
@@ -54,7 +69,33 @@ DHCP_SERVER::DHCP_SERVER(ip_addr_t* ip, ip_addr_t* nm) {
 }
 
 DHCP_SERVER::~DHCP_SERVER() {
+    async_context_remove_at_time_worker(cyw43_arch_async_context(), &sweeper);
     SocketFree();
+    LEASE_LOG::Flush(&leases, cyw43_hal_ticks_ms(), true);
+}
+
+void DHCP_SERVER::Sweep(async_context_t* context, async_at_time_worker_t* worker) {
+    uint32_t now = cyw43_hal_ticks_ms();
+
+    leases.Expire(now);
+    DEBUG_WRITE("DHCP: Sweep, %u bound %u free %u idle\n", (unsigned)leases.Count(LEASE_BOUND),
+        (unsigned)leases.Count(LEASE_FREE), (unsigned)leases.Count(LEASE_IDLE));
+    Schedule(now);
+}
+
+void DHCP_SERVER::Schedule(uint32_t now) {
+    async_context_t* context = cyw43_arch_async_context();
+    async_context_remove_at_time_worker(context, &sweeper);
+
+    uint32_t at;
+    if (!leases.Deadline(&at)) return;
+
+    int32_t wait = at - now;
+    async_context_add_at_time_worker_in_ms(context, &sweeper, wait > 0 ? wait : 0);
+}
+
+void DHCP_SERVER::Flush() {
+    LEASE_LOG::Flush(&leases, cyw43_hal_ticks_ms());
 }
 
 int DHCP_SERVER::SocketNewDatagram(udp_recv_fn cb_udp_recv) {
@@ -87,18 +128,8 @@ void DHCP_SERVER::SocketFree() {
     udp = NULL;
 }
 
-int DHCP_SERVER::SocketSendTo(netif* nif, const void* buf, size_t len, uint32_t ip, uint16_t port) {
-    // Limit buffer size to 65535 bytes [32-bit register address]
-    if (len > 0xFFFF) len = 0xFFFF;
-
-    // Allocate RAM space
-    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-    if (p == NULL) {
-        ERROR_WRITE("DHCP: Failed to send message out of memory\n");
-        return -ENOMEM;
-    }
-
-    memcpy(p->payload, buf, len);
+int DHCP_SERVER::SocketSendTo(netif* nif, pbuf* p, uint32_t ip, uint16_t port) {
+    size_t len = p->tot_len;
 
     ip_addr_t dest;
     IP4_ADDR(ip_2_ip4(&dest), ip >> 24 & 0xFF, ip >> 16 & 0xFF, ip >> 8 & 0xFF, ip & 0xFF);
@@ -108,24 +139,56 @@ int DHCP_SERVER::SocketSendTo(netif* nif, const void* buf, size_t len, uint32_t
     if (nif != NULL) err = udp_sendto_if(udp, p, &dest, port, nif);
     else err = udp_sendto(udp, p, &dest, port);
 
-    // Free RAM space
-    pbuf_free(p);
-
     if (err != ERR_OK) {
-        ERROR_WRITE("DNS: Failed to send message %d\n", err);
+        ERROR_WRITE("DHCP: Failed to send message %d\n", err);
         return err;
     }
 
     return len;
 }
 
-uint8_t* DHCP_SERVER::Find(uint8_t* opt, uint8_t cmd) {
-    for (int i = 0;i < 308 && opt[i] != DHCP_OPT_END;) {
-        if (opt[i] == cmd) return &opt[i];
-        i += 2 + opt[i + 1];
+bool DHCP_SERVER::Index(const uint8_t* msg, size_t len, DHCP_OPTION_INDEX_T* index) {
+    memset(index, 0, sizeof(*index));
+
+    if (len < DHCP_OPTIONS_OFFSET) return false;
+    const uint8_t* cookie = msg + offsetof(Message, options);
+    if ((uint32_t)(cookie[0] << 24 | cookie[1] << 16 | cookie[2] << 8 | cookie[3]) != DHCP_MAGIC_COOKIE) return false;
+
+    for (size_t i = DHCP_OPTIONS_OFFSET; i < len;) {
+        uint8_t code = msg[i];
+        if (code == DHCP_OPT_END) return true;
+        if (code == DHCP_OPT_PAD) {
+            i++;
+            continue;
+        }
+
+        // Code and length, then the value, all inside the message
+        if (i + 2 > len || i + 2 + msg[i + 1] > len) return false;
+
+        int slot;
+        switch (code) {
+            case DHCP_OPT_MSG_TYPE: slot = DHCP_SLOT_MSG_TYPE; break;
+            case DHCP_OPT_REQUESTED_IP: slot = DHCP_SLOT_REQUESTED_IP; break;
+            case DHCP_OPT_SERVER_ID: slot = DHCP_SLOT_SERVER_ID; break;
+            default: slot = -1; break;
+        }
+
+        // The first copy of an option wins
+        if (slot >= 0 && index->offset[slot] == 0) {
+            index->offset[slot] = i + 2;
+            index->length[slot] = msg[i + 1];
+        }
+        i += 2 + msg[i + 1];
     }
 
-    return NULL;
+    // Ran out without an end option, what was indexed is still whole
+    return true;
+}
+
+const uint8_t* DHCP_SERVER::Option(const uint8_t* msg, const DHCP_OPTION_INDEX_T* index, DHCP_OPTION_SLOT slot,
+    size_t length) {
+    if (index->offset[slot] == 0 || index->length[slot] < length) return NULL;
+    return msg + index->offset[slot];
 }
 
 void DHCP_SERVER::Write(uint8_t** opt, uint8_t cmd, size_t n, const void* data) {
@@ -159,85 +222,141 @@ void DHCP_SERVER::Process(void* arg, udp_pcb* upcb, pbuf* p, const ip_addr_t* sr
     (void)src_addr;
     (void)src_port;
 
-    // This is around 548 bytes
-    Message msg;
-    size_t len;
-    uint8_t* opt, * msgtype;
+    DHCP_OPTION_INDEX_T index;
+    uint8_t* msg, * yiaddr, * ciaddr, * chaddr, * opt;
+    const uint8_t* msgtype;
+    uint8_t requested[4];
     struct netif* nif;
+    LEASE_T* lease;
+    uint32_t now = cyw43_hal_ticks_ms();
+    uint32_t dest = 0xFFFFFFFF;
+    bool lease_time = true;
+    const uint8_t* server = (const uint8_t*)&ip4_addr_get_u32(ip_2_ip4(&d->ipAddress));
+
+    // The reply is written over the request, which has to be in one piece
+    if (p->next != NULL) {
+        p = pbuf_coalesce(p, PBUF_TRANSPORT);
+        if (p->next != NULL) goto malformed_request;
+    }
 
 #define DHCP_MIN_SIZE (240+3)
-    if (p->tot_len < DHCP_MIN_SIZE) goto ignore_request;
+    if (p->len < DHCP_MIN_SIZE) goto malformed_request;
+    if (((uint8_t*)p->payload)[0] != BOOTREQUEST) goto malformed_request;
+    if (!Index((uint8_t*)p->payload, p->len, &index)) goto malformed_request;
 
-    len = pbuf_copy_partial(p, &msg, sizeof(msg), 0);
-    if (len < DHCP_MIN_SIZE) goto ignore_request;
+    msgtype = Option((uint8_t*)p->payload, &index, DHCP_SLOT_MSG_TYPE, 1);
+    if (msgtype == NULL) goto malformed_request;
+    stats.received[msgtype[0] < DHCP_MSG_TYPES ? msgtype[0] : 0]++;
 
-    msg.op = DHCPOFFER;
-    memcpy(&msg.yiaddr, &ip4_addr_get_u32(ip_2_ip4(&d->ipAddress)), 4);
+    // Offsets in the index still hold if the message has to move
+    p = PbufReserve(p, LWIP_MAX(p->len, DHCP_REPLY_MAX));
+    if (p == NULL) {
+        ERROR_WRITE("DHCP: Failed to send message out of memory\n");
+        return;
+    }
 
-    opt = (uint8_t*)msg.options;
-    opt += 4; // Assume magic cookie: 99, 130, 83, 99
+    msg = (uint8_t*)p->payload;
+    yiaddr = msg + offsetof(Message, yiaddr);
+    ciaddr = msg + offsetof(Message, ciaddr);
+    chaddr = msg + offsetof(Message, chaddr);
+    msgtype = Option(msg, &index, DHCP_SLOT_MSG_TYPE, 1);
 
-    msgtype = Find(opt, DHCP_OPT_MSG_TYPE);
-    if (msgtype == NULL) goto ignore_request;
+    // Options are read before the reply is written over them
+    opt = msg + DHCP_OPTIONS_OFFSET;
+    msg[0] = BOOTREPLY;
+    memcpy(yiaddr, server, 4);
 
-    switch (msgtype[2]) {
+    switch (msgtype[0]) {
         case DHCPDISCOVER: {
-            int yi = DHCPS_MAX_IP;
-
-            // Look up leases
-            for (int i = 0;i < DHCPS_MAX_IP;++i) {
-                if (memcmp(d->lease[i].mac, msg.chaddr, MAC_LEN) == 0) {
-                    // MAC match, use this IP address
-                    yi = i;
-                    break;
-                }
-                if (yi == DHCPS_MAX_IP) {
-                    // Look for a free IP address
-                    if (memcmp(d->lease[i].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) yi = i; // IP available
-
-                    uint32_t expiry = d->lease[i].expiry << 16 | 0xFFFF;
-                    if ((int32_t)(expiry - cyw43_hal_ticks_ms()) < 0) {
-                        // IP expired, reuse it
-                        memset(d->lease[i].mac, 0, MAC_LEN);
-                        yi = i;
-                    }
-                }
-            }
+            // The client's own lease, or a free or lapsed address
+            lease = leases.Allocate(chaddr, now);
 
             // No more IP addresses left
-            if (yi == DHCPS_MAX_IP) goto ignore_request;
+            if (lease == NULL) {
+                stats.exhausted++;
+                goto ignore_request;
+            }
 
-            // Send IP address offer
-            msg.yiaddr[3] = DHCPS_BASE_IP + yi;
+            // Send IP address offer, held back for the client until it requests
+            leases.Offer(lease, now);
+            Schedule(now);
+            yiaddr[3] = leases.Address(lease);
             Write(&opt, DHCP_OPT_MSG_TYPE, (uint8_t)DHCPOFFER);
 
             break;
         }
         case DHCPREQUEST: {
-            uint8_t* o = Find(opt, DHCP_OPT_REQUESTED_IP);
-
-            if (o == NULL) goto ignore_request; // Should be NACK
-            if (memcmp(o + 2, &ip4_addr_get_u32(ip_2_ip4(&d->ipAddress)), 3) != 0) goto ignore_request; // Should be NACK
+            const uint8_t* id = Option(msg, &index, DHCP_SLOT_SERVER_ID, 4);
+            const uint8_t* o = Option(msg, &index, DHCP_SLOT_REQUESTED_IP, 4);
 
-            uint8_t yi = o[5] - DHCPS_BASE_IP;
-            if (yi >= DHCPS_MAX_IP) goto ignore_request; // Should be NACK
+            if (id != NULL && memcmp(id, server, 4) != 0) {
+                // The client took another server's offer, ours goes back to the pool
+                lease = leases.Find(chaddr);
+                if (lease != NULL && lease->state == LEASE_OFFERED) leases.Release(lease);
+                goto ignore_request;
+            }
 
-            if (memcmp(d->lease[yi].mac, msg.chaddr, MAC_LEN) == 0) {
-                // MAC match, ok to use this IP address
-            } else if (memcmp(d->lease[yi].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                memcpy(d->lease[yi].mac, msg.chaddr, MAC_LEN);
+            // Renewing and rebinding clients already have the address and send it in ciaddr
+            if (o != NULL) {
+                memcpy(requested, o, 4);
+            } else if (memcmp(ciaddr, "\0\0\0", 4) != 0) {
+                memcpy(requested, ciaddr, 4);
+                dest = MAKE_IP4(ciaddr[0], ciaddr[1], ciaddr[2], ciaddr[3]);
             } else {
-                // IP already in use
-                // SHould be NACK
                 goto ignore_request;
             }
 
-            d->lease[yi].expiry = (cyw43_hal_ticks_ms() + DEFAULT_LEASE_TIME_S * 1000) >> 16;
-            msg.yiaddr[3] = DHCPS_BASE_IP + yi;
+            // Another subnet, outside the pool or in use by another client, the client starts over at once
+            if (memcmp(requested, server, 3) != 0) goto nak_request;
+            lease = leases.Claim(requested[3], chaddr, now);
+            if (lease == NULL) goto nak_request;
+
+            leases.Bind(lease, now, DEFAULT_LEASE_TIME_S);
+            Schedule(now);
+            yiaddr[3] = leases.Address(lease);
+            LEASE_LOG::Record(chaddr, yiaddr[3], DEFAULT_LEASE_TIME_S, now);
             Write(&opt, DHCP_OPT_MSG_TYPE, (uint8_t)DHCPACK);
             DEBUG_WRITE("DHCP: Client Connected\nMAC = %02x:%02x:%02x:%02x:%02x:%02x\nIP = %u.%u.%u.%u\n",
-                msg.chaddr[0], msg.chaddr[1], msg.chaddr[2], msg.chaddr[3], msg.chaddr[4], msg.chaddr[5],
-                msg.yiaddr[0], msg.yiaddr[1], msg.yiaddr[2], msg.yiaddr[3]);
+                chaddr[0], chaddr[1], chaddr[2], chaddr[3], chaddr[4], chaddr[5],
+                yiaddr[0], yiaddr[1], yiaddr[2], yiaddr[3]);
+
+            break;
+        }
+        case DHCPDECLINE: {
+            // Another host answered for the address, keep it out of the pool for a while
+            const uint8_t* o = Option(msg, &index, DHCP_SLOT_REQUESTED_IP, 4);
+            lease = leases.Find(chaddr);
+            if (o == NULL || lease == NULL || memcmp(o, server, 3) != 0 || o[3] != leases.Address(lease)) {
+                goto ignore_request;
+            }
+
+            DEBUG_WRITE("DHCP: Address %u.%u.%u.%u declined\n", o[0], o[1], o[2], o[3]);
+            LEASE_LOG::Record(chaddr, o[3], 0, now);
+            leases.Decline(lease, now);
+            Schedule(now);
+            goto ignore_request;
+        }
+        case DHCPRELEASE: {
+            // Back in the pool at once, not when the lease would have lapsed
+            lease = leases.Find(chaddr);
+            if (lease == NULL || memcmp(ciaddr, server, 3) != 0 || ciaddr[3] != leases.Address(lease)) {
+                goto ignore_request;
+            }
+
+            DEBUG_WRITE("DHCP: Address %u.%u.%u.%u released\n", ciaddr[0], ciaddr[1], ciaddr[2], ciaddr[3]);
+            LEASE_LOG::Record(chaddr, ciaddr[3], 0, now);
+            leases.Release(lease);
+            Schedule(now);
+            goto ignore_request;
+        }
+        case DHCPINFORM: {
+            // The client set its own address and only wants the rest of the configuration
+            if (memcmp(ciaddr, "\0\0\0", 4) == 0) goto ignore_request;
+
+            memset(yiaddr, 0, 4);
+            dest = MAKE_IP4(ciaddr[0], ciaddr[1], ciaddr[2], ciaddr[3]);
+            lease_time = false;
+            Write(&opt, DHCP_OPT_MSG_TYPE, (uint8_t)DHCPACK);
 
             break;
         }
@@ -245,17 +364,37 @@ void DHCP_SERVER::Process(void* arg, udp_pcb* upcb, pbuf* p, const ip_addr_t* sr
             goto ignore_request;
     }
 
-    Write(&opt, DHCP_OPT_SERVER_ID, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ipAddress)));
+    Write(&opt, DHCP_OPT_SERVER_ID, 4, server);
     Write(&opt, DHCP_OPT_SUBNET_MASK, 4, &ip4_addr_get_u32(ip_2_ip4(&d->netmask)));
-    Write(&opt, DHCP_OPT_ROUTER, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ipAddress)));
-    Write(&opt, DHCP_OPT_DNS, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ipAddress)));
-
-    Write(&opt, DHCP_OPT_IP_LEASE_TIME, (uint32_t)DEFAULT_LEASE_TIME_S);
+    Write(&opt, DHCP_OPT_ROUTER, 4, server);
+    Write(&opt, DHCP_OPT_DNS, 4, server);
+
+    if (lease_time) Write(&opt, DHCP_OPT_IP_LEASE_TIME, (uint32_t)DEFAULT_LEASE_TIME_S);
+    goto send_reply;
+
+nak_request:
+    // No address and no configuration, only who said no
+    DEBUG_WRITE("DHCP: NAK for %u.%u.%u.%u\n", requested[0], requested[1], requested[2], requested[3]);
+    memset(yiaddr, 0, 4);
+    memset(ciaddr, 0, 4);
+    dest = 0xFFFFFFFF;
+    Write(&opt, DHCP_OPT_MSG_TYPE, (uint8_t)DHCPNACK);
+    Write(&opt, DHCP_OPT_SERVER_ID, 4, server);
+
+send_reply:
     *opt++ = DHCP_OPT_END;
+    pbuf_realloc(p, opt - msg);
 
     nif = ip_current_input_netif();
 
-    d->SocketSendTo(nif, &msg, opt - (uint8_t*)&msg, 0xFFFFFFFF, PORT_DHCP_CLIENT);
+    // The message type is always the first option of a reply
+    stats.sent[msg[DHCP_OPTIONS_OFFSET + 2]]++;
+    d->SocketSendTo(nif, p, dest, PORT_DHCP_CLIENT);
+    pbuf_free(p);
+    return;
+
+malformed_request:
+    stats.malformed++;
 
 ignore_request:
     pbuf_free(p);
@@ -18,7 +18,15 @@
 #define ERROR_WRITE printf
 
 #include <lwipopts.h>
+#include <lwip/timeouts.h>
+
+#include <Buffer.hpp>
 #include <DNS.hpp>
+#include <Forward.hpp>
+#include <Zone.hpp>
+
+RATE_LIMITER<DNS_RATE_CLIENTS, DNS_RATE_PER_S, DNS_RATE_BURST> DNS_SERVER::limiter;
+DNS_SERVER_STATS_T DNS_SERVER::stats;
 
 DNS_SERVER::DNS_SERVER(ip_addr_t* ip) {
     if (SocketNewdatagram(this, Process) != ERR_OK) {
@@ -36,9 +44,14 @@ DNS_SERVER::DNS_SERVER(ip_addr_t* ip) {
 }
 
 DNS_SERVER::~DNS_SERVER() {
+    DNS_FORWARDER::Stop();
     SocketFree();
 }
 
+bool DNS_SERVER::SetUpstream(const ip_addr_t* upstream) {
+    return DNS_FORWARDER::Start(udp, upstream);
+}
+
 int DNS_SERVER::SocketNewdatagram(void* cb_data, udp_recv_fn cb_udp_recv) {
     udp = udp_new();
 
@@ -62,20 +75,10 @@ int DNS_SERVER::SocketBind(uint32_t ip, uint16_t port) {
     return err;
 }
 
-int DNS_SERVER::SocketSendTo(const void* buf, size_t len, const ip_addr_t* dest, uint16_t port) {
-    if (len > 0xFFFF) len = 0xFFFF;
-
-    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-    if (p == NULL) {
-        ERROR_WRITE("DNS: Failed to send message out of memory\n");
-        return -ENOMEM;
-    }
-
-    memcpy(p->payload, buf, len);
+int DNS_SERVER::SocketSendTo(struct pbuf* p, const ip_addr_t* dest, uint16_t port) {
+    size_t len = p->tot_len;
     err_t err = udp_sendto(udp, p, dest, port);
 
-    pbuf_free(p);
-
     if (err != ERR_OK) {
         ERROR_WRITE("DNS: Failed to send message %d\n", err);
         return err;
@@ -92,21 +95,138 @@ void DNS_SERVER::SocketFree() {
 }
 
 
+// Bucket of the question counters, the types clients actually ask for get one each
+static DNS_QUERY_KIND QueryKind(uint16_t type) {
+    switch (type) {
+        case DNS_TYPE_A: return DNS_QUERY_A;
+        case DNS_TYPE_AAAA: return DNS_QUERY_AAAA;
+        case DNS_TYPE_PTR: return DNS_QUERY_PTR;
+        case DNS_TYPE_SVCB:
+        case DNS_TYPE_HTTPS: return DNS_QUERY_SVCB;
+        default: return DNS_QUERY_OTHER;
+    }
+}
+
+// Record header with the owner name compressed to a pointer
+static uint8_t* PutRecord(uint8_t* out, uint16_t name, uint16_t type, uint32_t ttl, uint16_t length) {
+    out = DnsPut16(out, 0xC000 | name);
+    out = DnsPut16(out, type);
+    out = DnsPut16(out, DNS_CLASS_IN);
+    out = DnsPut32(out, ttl);
+    return DnsPut16(out, length);
+}
+
+int DNS_SERVER::ParseQuestions(const uint8_t* msg, size_t len, DNS_QUESTION_T* questions, size_t count) {
+    size_t offset = sizeof(DNS_HEADER_T);
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t name = offset;
+
+        DEBUG_WRITE("Question: ");
+        while (true) {
+            if (offset >= len) return -1;
+
+            uint8_t label = msg[offset++];
+            if (label == 0) break;
+
+            // Compression pointers have no place in a question
+            if (label > 63) {
+                DEBUG_WRITE("Invalid label\n");
+                return -1;
+            }
+
+            if (offset - 1 > name) DEBUG_WRITE(".");
+            DEBUG_WRITE("%.*s", label, msg + offset);
+            offset += label;
+        }
+
+        if (offset - name > DNS_MAX_NAME || offset + 4 > len) {
+            DEBUG_WRITE("Invalid question length\n");
+            return -1;
+        }
+
+        questions[i].name = name;
+        questions[i].type = DnsGet16(msg + offset);
+        questions[i].klass = DnsGet16(msg + offset + 2);
+        offset += 4;
+        DEBUG_WRITE(" type %u\n", questions[i].type);
+    }
+
+    return offset;
+}
+
+DNS_ANSWER DNS_SERVER::Classify(const uint8_t* msg, const DNS_QUESTION_T* question, uint32_t* address) {
+    *address = 0;
+
+    const DNS_ZONE_T* entry = DNS_ZONE::Find(msg + question->name);
+    if (entry != nullptr && entry->answer != DNS_ANSWER_ADDRESS) return entry->answer;
+    if (entry != nullptr) *address = entry->address;
+
+    if (question->klass != DNS_CLASS_IN && question->klass != DNS_CLASS_ANY) return DNS_ANSWER_NODATA;
+
+    switch (question->type) {
+        case DNS_TYPE_A:
+        case DNS_TYPE_ANY:
+            return DNS_ANSWER_ADDRESS;
+        case DNS_TYPE_PTR:
+            // Nothing here has a name to give back
+            return entry != nullptr ? DNS_ANSWER_NODATA : DNS_ANSWER_NXDOMAIN;
+        default:
+            // AAAA, HTTPS and the rest. An empty answer stops clients waiting on them
+            return DNS_ANSWER_NODATA;
+    }
+}
+
 void DNS_SERVER::Process(void* arg, struct udp_pcb* upcb, struct pbuf* p, const ip_addr_t* src_addr, u16_t src_port) {
     DNS_SERVER* d = reinterpret_cast<DNS_SERVER*>(arg);
     DEBUG_WRITE("DNS Process %u\n", p->tot_len);
 
-    uint8_t msg[MAX_DNS_MSG_SIZE];
-    DNS_HEADER_T* header = reinterpret_cast<DNS_HEADER_T*>(msg);
+    // A client retrying in a loop costs one table lookup per datagram and nothing more
+    RATE_DECISION decision = limiter.Check(ip4_addr_get_u32(ip_2_ip4(src_addr)), sys_now());
+    if (decision != RATE_ALLOW) {
+        DEBUG_WRITE("DNS: %s over its rate\n", ipaddr_ntoa(src_addr));
+        if (decision == RATE_REFUSE && p->len >= sizeof(DNS_HEADER_T)) {
+            // Header alone with REFUSED, written over the query
+            DNS_HEADER_T* header = static_cast<DNS_HEADER_T*>(p->payload);
+            uint16_t flags = lwip_ntohs(header->flags);
+            if ((flags & DNS_FLAG_QR) == 0) {
+                header->flags = lwip_htons(DNS_FLAG_QR | (flags & 0x7800) | (flags & DNS_FLAG_RD) | DNS_RCODE_REFUSED);
+                header->question_count = 0;
+                header->answer_record_count = 0;
+                header->authority_record_count = 0;
+                header->additional_record_count = 0;
+                pbuf_realloc(p, sizeof(DNS_HEADER_T));
+
+                ip_addr_t dest;
+                ip_addr_copy(dest, *src_addr);
+                d->SocketSendTo(p, &dest, src_port);
+                stats.responses[DNS_RCODE_REFUSED]++;
+            }
+        }
+        pbuf_free(p);
+        return;
+    }
 
+    DNS_QUESTION_T questions[DNS_MAX_QUESTIONS];
+    DNS_ANSWER kinds[DNS_MAX_QUESTIONS];
+    uint32_t addresses[DNS_MAX_QUESTIONS];
+    uint8_t* msg;
+    DNS_HEADER_T* header;
+    uint16_t flags, question_count, rcode, answers, negative;
     size_t len;
+    int end;
+    ip_addr_t dest;
 
-    uint16_t flags, question_count;
-    const uint8_t* question_ptr_start, * question_ptr_end, * question_ptr;
-    uint8_t* answer_ptr;
+    // The reply is written over the query, which has to be in one piece
+    if (p->next != NULL) {
+        p = pbuf_coalesce(p, PBUF_TRANSPORT);
+        if (p->next != NULL) goto ignore_request;
+    }
 
-    len = pbuf_copy_partial(p, msg, sizeof(msg), 0);
-    if (len < sizeof(header)) {
+    msg = static_cast<uint8_t*>(p->payload);
+    header = reinterpret_cast<DNS_HEADER_T*>(msg);
+    len = p->len;
+    if (len < sizeof(DNS_HEADER_T)) {
         goto ignore_request;
     }
 
@@ -117,94 +237,118 @@ void DNS_SERVER::Process(void* arg, struct udp_pcb* upcb, struct pbuf* p, const
     DEBUG_WRITE("DNS Flags 0x%x\n", flags);
     DEBUG_WRITE("DNS Question Count 0x%x\n", question_count);
 
-    // flags from rfc1035
-    // +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-    // |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
-    // +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-
-    if (((flags >> 15) & 0x01) != 0) {
+    if ((flags & DNS_FLAG_QR) != 0) {
         DEBUG_WRITE("Ignoring non-query\n");
         goto ignore_request;
     }
 
-    if (((flags >> 11) & 0x0F) != 0) {
-        DEBUG_WRITE("Ignoring non-standard query\n");
-        goto ignore_request;
-    }
-
     if (question_count < 1) {
         DEBUG_WRITE("Invalid Question Count\n");
         goto ignore_request;
     }
 
-#pragma region Print Question
-    DEBUG_WRITE("Question: ");
-    question_ptr_start = msg + sizeof(header);
-    question_ptr_end = msg + len;
-    question_ptr = question_ptr_start;
-    while (question_ptr < question_ptr_end) {
-        if (*question_ptr == 0) {
-            question_ptr++;
-            break;
-        } else {
-            if (question_ptr > question_ptr_start) DEBUG_WRITE(".");
-
-            int label_len = *question_ptr++;
-            if (label_len > 63) {
-                DEBUG_WRITE("Invalid label\n");
-                goto ignore_request;
+    rcode = DNS_RCODE_NOERROR;
+    answers = 0;
+    negative = 0;
+
+    // Anything but a standard query, or more questions than we take, gets the header back with an error
+    if (((flags >> 11) & 0x0F) != 0 || question_count > DNS_MAX_QUESTIONS) {
+        DEBUG_WRITE("Refusing non-standard query\n");
+        rcode = ((flags >> 11) & 0x0F) != 0 ? DNS_RCODE_NOTIMP : DNS_RCODE_FORMERR;
+        question_count = 0;
+        end = sizeof(DNS_HEADER_T);
+    } else {
+        end = ParseQuestions(msg, len, questions, question_count);
+        if (end < 0) goto ignore_request;
+        for (uint16_t i = 0; i < question_count; ++i) stats.questions[QueryKind(questions[i].type)]++;
+
+        // With an upstream, names outside the local zone are resolved for real
+        if (question_count == 1 && DNS_FORWARDER::Enabled() && DNS_ZONE::Find(msg + questions[0].name) == nullptr) {
+            ip_addr_copy(dest, *src_addr);
+            DNS_FORWARDER::Forward(p, end, &questions[0], &dest, src_port);
+            return;
+        }
+    }
+
+#pragma region Generate Answer
+    {
+        size_t reply_len = end;
+        bool soa = false;
+        for (uint16_t i = 0; i < question_count; ++i) {
+            DNS_ANSWER answer = kinds[i] = Classify(msg, &questions[i], &addresses[i]);
+            if (answer == DNS_ANSWER_ADDRESS) {
+                reply_len += DNS_ANSWER_LENGTH;
+                answers++;
+                continue;
             }
 
-            DEBUG_WRITE("%.*s", label_len, question_ptr);
-            question_ptr += label_len;
+            if (answer == DNS_ANSWER_NXDOMAIN) rcode = DNS_RCODE_NXDOMAIN;
+            if (!soa) {
+                // One SOA lets clients cache the negative answer
+                reply_len += DNS_SOA_LENGTH;
+                negative = i + 1;
+                soa = true;
+            }
         }
-    }
-    DEBUG_WRITE("\n");
-#pragma endregion
 
-    if (question_ptr - question_ptr_start > 255) {
-        DEBUG_WRITE("Invalid question length\n");
-        goto ignore_request;
-    }
+        // Whatever followed the questions, EDNS included, is overwritten
+        p = PbufReserve(p, reply_len);
+        if (p == NULL) {
+            ERROR_WRITE("DNS: Failed to send message out of memory\n");
+            return;
+        }
+        msg = static_cast<uint8_t*>(p->payload);
+        header = reinterpret_cast<DNS_HEADER_T*>(msg);
+
+        uint8_t* answer_ptr = msg + end;
+        for (uint16_t i = 0; i < question_count; ++i) {
+            if (kinds[i] != DNS_ANSWER_ADDRESS) continue;
+
+            answer_ptr = PutRecord(answer_ptr, questions[i].name, DNS_TYPE_A, DNS_TTL, 4);
+            if (addresses[i] != 0) {
+                answer_ptr = DnsPut32(answer_ptr, addresses[i]);
+            } else {
+                memcpy(answer_ptr, &d->ipAddress, 4);   // Use our address
+                answer_ptr += 4;
+            }
+        }
 
-    // Skip QNAME and QTYPE
-    question_ptr += 4;
+        if (negative > 0) {
+            uint16_t name = questions[negative - 1].name;
+            answer_ptr = PutRecord(answer_ptr, name, DNS_TYPE_SOA, DNS_NEGATIVE_TTL, DNS_SOA_LENGTH - 12);
+            answer_ptr = DnsPut16(answer_ptr, 0xC000 | name);  // Primary server
+            answer_ptr = DnsPut16(answer_ptr, 0xC000 | name);  // Responsible mailbox
+            answer_ptr = DnsPut32(answer_ptr, 1);              // Serial
+            answer_ptr = DnsPut32(answer_ptr, DNS_TTL);        // Refresh
+            answer_ptr = DnsPut32(answer_ptr, DNS_TTL);        // Retry
+            answer_ptr = DnsPut32(answer_ptr, DNS_TTL);        // Expire
+            answer_ptr = DnsPut32(answer_ptr, DNS_NEGATIVE_TTL);
+        }
 
-#pragma region Generate Answer
-    answer_ptr = msg + (question_ptr - msg);
-    *answer_ptr++ = 0xC0;                   // Pointer
-    *answer_ptr++ = question_ptr - msg;     // Pointer to Question
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 1;                      // Host Address
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 1;                      // Internet Class
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 60;                     // TTL 60s
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 4;                      // Length
-    memcpy(answer_ptr, &d->ipAddress, 4);   // Use our address
-    answer_ptr += 4;
-
-    header->flags = lwip_htons(
-        0x1 << 15 | // QR = Response
-        0x1 << 10 | // AA = Authoritive
-        0x1 << 7    // RA = Authenticated
-    );
-    header->question_count = lwip_htons(1);
-    header->answer_record_count = lwip_htons(1);
-    header->authority_record_count = 0;
-    header->additional_record_count = 0;
+        header->flags = lwip_htons(
+            DNS_FLAG_QR |           // Response
+            (flags & 0x7800) |      // Opcode, copied from the query
+            DNS_FLAG_AA |           // Authoritative
+            (flags & DNS_FLAG_RD) | // Recursion desired, copied from the query
+            DNS_FLAG_RA |           // Recursion available
+            rcode
+        );
+        header->question_count = lwip_htons(question_count);
+        header->answer_record_count = lwip_htons(answers);
+        header->authority_record_count = lwip_htons(negative > 0 ? 1 : 0);
+        header->additional_record_count = 0;
+    }
 #pragma endregion
 
-    DEBUG_WRITE("Sending %d byte reply to %s:%d\n", answer_ptr - msg, ipaddr_ntoa(src_addr), src_port);
-    d->SocketSendTo(&msg, answer_ptr - msg, src_addr, src_port);
+    // src_addr belongs to lwIP's state for the packet being processed, keep our own
+    ip_addr_copy(dest, *src_addr);
+    DEBUG_WRITE("Sending %d byte reply to %s:%d\n", p->len, ipaddr_ntoa(&dest), src_port);
+    d->SocketSendTo(p, &dest, src_port);
+    stats.responses[rcode]++;
+    pbuf_free(p);
+    return;
 
 ignore_request:
+    stats.ignored++;
     pbuf_free(p);
-}
\ No newline at end of file
+}
@@ -0,0 +1,109 @@
+/**
+ *@file Events.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-25
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_EVENTS
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+#include <cstdio>
+#include <cstring>
+
+#include <Events.hpp>
+#include <HTTP.hpp>
+
+static bool PutNumber(char* buffer, size_t max_len, size_t* len, uint32_t value) {
+    char digits[10];
+    return HttpPut(buffer, max_len, len, digits, HttpDecimal(digits, value));
+}
+
+EVENT_RING::EVENT_RING() {
+    // Id 0 is never used so a Last-Event-ID of 0 means nothing was seen
+    first = 1;
+    next = 1;
+    head = 0;
+}
+
+uint32_t EVENT_RING::Publish(const char* name, const char* data, size_t len) {
+    char event[EVENT_MAX_LENGTH];
+    size_t event_len = 0;
+
+    bool fits = HttpPut(event, sizeof(event), &event_len, "id: ", 4) &&
+        PutNumber(event, sizeof(event), &event_len, next) &&
+        HttpPut(event, sizeof(event), &event_len, "\n", 1);
+    if (fits && name != nullptr) {
+        fits = HttpPut(event, sizeof(event), &event_len, "event: ", 7) &&
+            HttpPut(event, sizeof(event), &event_len, name, strlen(name)) &&
+            HttpPut(event, sizeof(event), &event_len, "\n", 1);
+    }
+
+    // One data line per line of data, the client joins them back with newlines
+    size_t start = 0;
+    while (fits) {
+        const char* newline = static_cast<const char*>(memchr(data + start, '\n', len - start));
+        size_t end = newline != nullptr ? newline - data : len;
+
+        fits = HttpPut(event, sizeof(event), &event_len, "data: ", 6) &&
+            HttpPut(event, sizeof(event), &event_len, data + start, end - start) &&
+            HttpPut(event, sizeof(event), &event_len, "\n", 1);
+        if (newline == nullptr) break;
+        start = end + 1;
+    }
+    fits = fits && HttpPut(event, sizeof(event), &event_len, "\n", 1);
+    if (!fits) {
+        DEBUG_WRITE("EVENTS: Event of %u bytes too large\n", (unsigned)len);
+        return 0;
+    }
+
+    // Drop the oldest events until this one has a slot and its bytes do not overwrite a held event
+    while (first < next &&
+        (next - first >= EVENT_RING_EVENTS || head + event_len - events[first % EVENT_RING_EVENTS].position > EVENT_RING_SIZE)) {
+        first++;
+    }
+
+    size_t offset = head % EVENT_RING_SIZE;
+    size_t part = event_len < EVENT_RING_SIZE - offset ? event_len : EVENT_RING_SIZE - offset;
+    memcpy(ring + offset, event, part);
+    memcpy(ring, event + part, event_len - part);
+
+    events[next % EVENT_RING_EVENTS].position = head;
+    events[next % EVENT_RING_EVENTS].length = event_len;
+    head += event_len;
+
+    DEBUG_WRITE("EVENTS: Published %lu, holding %lu\n", (unsigned long)next, (unsigned long)(next + 1 - first));
+    return next++;
+}
+
+bool EVENT_RING::Read(uint32_t id, const char** first_part, size_t* first_len, const char** second_part,
+    size_t* second_len) const {
+    if (id < first || id >= next) return false;
+
+    size_t offset = events[id % EVENT_RING_EVENTS].position % EVENT_RING_SIZE;
+    size_t length = events[id % EVENT_RING_EVENTS].length;
+
+    *first_part = ring + offset;
+    *first_len = length < EVENT_RING_SIZE - offset ? length : EVENT_RING_SIZE - offset;
+    *second_part = ring;
+    *second_len = length - *first_len;
+    return true;
+}
+
+size_t EVENT_RING::Gap(char* buffer, size_t max_len, uint32_t id) const {
+    size_t len = 0;
+    bool fits = HttpPut(buffer, max_len, &len, "event: gap\nid: ", 15) &&
+        PutNumber(buffer, max_len, &len, first - 1) &&
+        HttpPut(buffer, max_len, &len, "\ndata: ", 7) &&
+        PutNumber(buffer, max_len, &len, first - id) &&
+        HttpPut(buffer, max_len, &len, "\n\n", 2);
+
+    return fits ? len : 0;
+}
@@ -0,0 +1,130 @@
+/**
+ *@file Flash.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ERROR_WRITE printf
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef NEKONET_HOST
+#include <pico/flash.h>
+#include <hardware/regs/addressmap.h>
+#endif
+
+#include <Flash.hpp>
+
+FLASH_STORE_STATS_T FLASH_STORE::stats;
+
+#ifdef NEKONET_HOST
+
+// Comes up erased like a fresh part, and keeps its contents across Start like flash across a reboot
+static uint8_t* const image = [] {
+    static uint8_t sectors[FLASH_STORE_SIZE];
+    memset(sectors, 0xFF, sizeof(sectors));
+    return sectors;
+}();
+
+bool FLASH_STORE::Start() {
+    return true;
+}
+
+const uint8_t* FLASH_STORE::Read(uint32_t offset) {
+    return &image[offset];
+}
+
+bool FLASH_STORE::Erase(size_t sector) {
+    if (sector >= FLASH_STORE_SECTORS) return false;
+
+    memset(&image[sector * FLASH_SECTOR_SIZE], 0xFF, FLASH_SECTOR_SIZE);
+    stats.erases[sector]++;
+    return true;
+}
+
+bool FLASH_STORE::Program(uint32_t offset, const uint8_t* data) {
+    if (offset % FLASH_PAGE_SIZE != 0 || offset >= FLASH_STORE_SIZE) return false;
+
+    for (size_t i = 0; i < FLASH_PAGE_SIZE; ++i) image[offset + i] &= data[i];
+    stats.programs++;
+
+    if (memcmp(&image[offset], data, FLASH_PAGE_SIZE) != 0) {
+        stats.failures++;
+        return false;
+    }
+    return true;
+}
+
+#else
+
+#define FLASH_STORE_OFFSET  (PICO_FLASH_SIZE_BYTES - FLASH_STORE_SIZE)
+
+extern char __flash_binary_end;
+
+typedef struct FLASH_OP_T_ {
+    uint32_t offset;
+    const uint8_t* data;
+} FLASH_OP_T;
+
+static void EraseSector(void* param) {
+    const FLASH_OP_T* op = (const FLASH_OP_T*)param;
+    flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+}
+
+static void ProgramPage(void* param) {
+    const FLASH_OP_T* op = (const FLASH_OP_T*)param;
+    flash_range_program(op->offset, op->data, FLASH_PAGE_SIZE);
+}
+
+bool FLASH_STORE::Start() {
+    if ((uintptr_t)&__flash_binary_end > XIP_BASE + FLASH_STORE_OFFSET) {
+        ERROR_WRITE("FLASH: Binary overlaps the reserved sectors\n");
+        return false;
+    }
+    return true;
+}
+
+const uint8_t* FLASH_STORE::Read(uint32_t offset) {
+    return (const uint8_t*)(uintptr_t)(XIP_BASE + FLASH_STORE_OFFSET + offset);
+}
+
+bool FLASH_STORE::Erase(size_t sector) {
+    if (sector >= FLASH_STORE_SECTORS) return false;
+
+    // Interrupts are off and the other core is parked while flash is busy
+    FLASH_OP_T op = { (uint32_t)(FLASH_STORE_OFFSET + sector * FLASH_SECTOR_SIZE), NULL };
+    if (flash_safe_execute(EraseSector, &op, FLASH_STORE_TIMEOUT_MS) != PICO_OK) {
+        ERROR_WRITE("FLASH: Failed to erase sector %u\n", (unsigned)sector);
+        stats.failures++;
+        return false;
+    }
+
+    stats.erases[sector]++;
+    return true;
+}
+
+bool FLASH_STORE::Program(uint32_t offset, const uint8_t* data) {
+    if (offset % FLASH_PAGE_SIZE != 0 || offset >= FLASH_STORE_SIZE) return false;
+
+    FLASH_OP_T op = { FLASH_STORE_OFFSET + offset, data };
+    if (flash_safe_execute(ProgramPage, &op, FLASH_STORE_TIMEOUT_MS) != PICO_OK) {
+        ERROR_WRITE("FLASH: Failed to program page %lu\n", (unsigned long)offset);
+        stats.failures++;
+        return false;
+    }
+    stats.programs++;
+
+    if (memcmp(Read(offset), data, FLASH_PAGE_SIZE) != 0) {
+        stats.failures++;
+        return false;
+    }
+    return true;
+}
+
+#endif
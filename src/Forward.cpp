@@ -0,0 +1,326 @@
+/**
+ *@file Forward.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-22
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_DNS
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+#define ERROR_WRITE printf
+
+#include <cstdio>
+
+#include <lwipopts.h>
+#include <lwip/timeouts.h>
+
+#include <Buffer.hpp>
+#include <Forward.hpp>
+#include <Zone.hpp>
+
+struct udp_pcb* DNS_FORWARDER::udp;
+struct udp_pcb* DNS_FORWARDER::server;
+ip_addr_t DNS_FORWARDER::upstream;
+DNS_CACHE_T DNS_FORWARDER::cache[DNS_CACHE_ENTRIES];
+DNS_PENDING_T DNS_FORWARDER::pending[DNS_FORWARD_PENDING];
+DNS_FORWARD_STATS_T DNS_FORWARDER::stats;
+
+bool DNS_FORWARDER::Start(struct udp_pcb* server, const ip_addr_t* upstream) {
+    if (udp != NULL) Stop();
+
+    udp = udp_new();
+    if (udp == NULL) {
+        ERROR_WRITE("DNS: Failed to open upstream socket\n");
+        return false;
+    }
+
+    // Any local port, replies are matched by id and question
+    if (udp_bind(udp, IP_ANY_TYPE, 0) != ERR_OK) {
+        ERROR_WRITE("DNS: Failed to bind upstream socket\n");
+        Stop();
+        return false;
+    }
+    udp_recv(udp, Receive, NULL);
+
+    DNS_FORWARDER::server = server;
+    ip_addr_copy(DNS_FORWARDER::upstream, *upstream);
+    DEBUG_WRITE("DNS: Forwarding to %s\n", ipaddr_ntoa(upstream));
+    return true;
+}
+
+void DNS_FORWARDER::Stop() {
+    if (udp == NULL) return;
+
+    udp_remove(udp);
+    udp = NULL;
+}
+
+uint32_t DNS_FORWARDER::Key(const uint8_t* msg, const DNS_QUESTION_T* question) {
+    uint32_t hash = DNS_HASH_BASIS;
+    for (const uint8_t* label = msg + question->name; *label != 0; label += *label + 1) {
+        hash = DnsHash(hash, reinterpret_cast<const char*>(label + 1), *label);
+    }
+    hash = (hash ^ question->type) * DNS_HASH_PRIME;
+    hash = (hash ^ question->klass) * DNS_HASH_PRIME;
+
+    // 0 marks a free slot
+    return hash != 0 ? hash : 1;
+}
+
+DNS_CACHE_T* DNS_FORWARDER::Lookup(uint32_t hash, const uint8_t* question, size_t length, uint32_t now) {
+    for (DNS_CACHE_T& entry : cache) {
+        if (entry.hash != hash || entry.question != length) continue;
+
+        // Same name in any case, then type and class exactly
+        if (!DnsNameEquals(entry.data, question) || memcmp(entry.data + length - 4, question + length - 4, 4) != 0) {
+            continue;
+        }
+
+        if (static_cast<int32_t>(entry.expires - now) <= 0) {
+            entry.hash = 0;
+            return NULL;
+        }
+
+        entry.last_used = now;
+        return &entry;
+    }
+    return NULL;
+}
+
+void DNS_FORWARDER::Insert(uint32_t hash, const uint8_t* msg, size_t len, size_t end, uint32_t now) {
+    uint16_t flags = DnsGet16(msg + 2);
+    uint16_t rcode = flags & 0x0F;
+    if ((flags & DNS_FLAG_TC) != 0 || (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) return;
+
+    uint16_t answers = DnsGet16(msg + 6);
+    uint16_t authority = DnsGet16(msg + 8);
+    if (answers + authority > DNS_CACHE_RECORDS) return;
+
+    // Walk the records for their TTLs, the shortest decides how long the reply is kept
+    uint16_t ttls[DNS_CACHE_RECORDS];
+    uint32_t ttl = DNS_FORWARD_MAX_TTL_S;
+    bool soa = false;
+    size_t offset = end;
+    for (uint16_t i = 0; i < answers + authority; ++i) {
+        while (offset < len && msg[offset] != 0 && msg[offset] < 0xC0) offset += msg[offset] + 1;
+        if (offset >= len) return;
+        offset += msg[offset] >= 0xC0 ? 2 : 1;
+        if (offset + 10 > len) return;
+
+        uint16_t type = DnsGet16(msg + offset);
+        uint32_t record_ttl = DnsGet32(msg + offset + 4);
+        uint16_t rdlength = DnsGet16(msg + offset + 8);
+        if (offset + 10 + rdlength > len) return;
+
+        ttls[i] = offset + 4 - end;
+        if (answers > 0) {
+            if (record_ttl < ttl) ttl = record_ttl;
+        } else if (type == DNS_TYPE_SOA && rdlength >= 20) {
+            // Negative answers last as long as the SOA and its minimum allow
+            uint32_t minimum = DnsGet32(msg + offset + 10 + rdlength - 4);
+            uint32_t negative = record_ttl < minimum ? record_ttl : minimum;
+            ttl = soa && ttl < negative ? ttl : negative;
+            soa = true;
+        }
+        offset += 10 + rdlength;
+    }
+
+    // Without an SOA there is nothing saying how long a negative answer holds, RFC 2308 section 5
+    if (answers == 0 && !soa) return;
+    if (answers == 0 && ttl > DNS_FORWARD_MAX_NEGATIVE_S) ttl = DNS_FORWARD_MAX_NEGATIVE_S;
+    if (ttl == 0 || offset - sizeof(DNS_HEADER_T) > DNS_CACHE_DATA) return;
+
+    // Same question, then a free or stale entry, then the least recently used
+    DNS_CACHE_T* victim = &cache[0];
+    for (DNS_CACHE_T& entry : cache) {
+        if (entry.hash == hash || entry.hash == 0 || static_cast<int32_t>(entry.expires - now) <= 0) {
+            victim = &entry;
+            break;
+        }
+        if (now - entry.last_used > now - victim->last_used) victim = &entry;
+    }
+
+    victim->hash = hash;
+    victim->expires = now + ttl * 1000;
+    victim->last_used = now;
+    victim->flags = flags;
+    victim->answers = answers;
+    victim->authority = authority;
+    victim->question = end - sizeof(DNS_HEADER_T);
+    victim->length = offset - sizeof(DNS_HEADER_T);
+    victim->ttl_count = answers + authority;
+    memcpy(victim->ttls, ttls, victim->ttl_count * sizeof(ttls[0]));
+    memcpy(victim->data, msg + sizeof(DNS_HEADER_T), victim->length);
+    DEBUG_WRITE("DNS: Cached %u byte reply for %lu s\n", victim->length, (unsigned long)ttl);
+}
+
+void DNS_FORWARDER::Serve(struct pbuf* p, size_t end, DNS_CACHE_T* entry, uint32_t now, const ip_addr_t* client,
+    uint16_t port) {
+    // The client's question stays as it was asked, the cached records go after it
+    size_t records = entry->length - entry->question;
+    p = PbufReserve(p, end + records);
+    if (p == NULL) {
+        ERROR_WRITE("DNS: Failed to send message out of memory\n");
+        return;
+    }
+
+    uint8_t* msg = static_cast<uint8_t*>(p->payload);
+    memcpy(msg + end, entry->data + entry->question, records);
+
+    // Count down from the TTL the upstream gave
+    uint32_t ttl = (entry->expires - now + 999) / 1000;
+    for (uint8_t i = 0; i < entry->ttl_count; ++i) DnsPut32(msg + end + entry->ttls[i], ttl);
+
+    DNS_HEADER_T* header = reinterpret_cast<DNS_HEADER_T*>(msg);
+    header->flags = lwip_htons(entry->flags);
+    header->answer_record_count = lwip_htons(entry->answers);
+    header->authority_record_count = lwip_htons(entry->authority);
+    header->additional_record_count = 0;
+
+    err_t err = udp_sendto(server, p, client, port);
+    if (err != ERR_OK) ERROR_WRITE("DNS: Failed to send message %d\n", err);
+    pbuf_free(p);
+}
+
+DNS_PENDING_T* DNS_FORWARDER::Pending(uint32_t hash, uint32_t now) {
+    DNS_PENDING_T* free = NULL;
+    for (DNS_PENDING_T& query : pending) {
+        if (query.hash != 0 && now - query.sent >= DNS_FORWARD_TIMEOUT_MS) {
+            DEBUG_WRITE("DNS: Upstream query %u timed out\n", query.id);
+            stats.timeouts++;
+            query.hash = 0;
+        }
+
+        if (query.hash == hash) return &query;
+        if (query.hash == 0 && free == NULL) free = &query;
+    }
+
+    if (free != NULL) {
+        free->hash = hash;
+        free->sent = now;
+        free->waiter_count = 0;
+
+        // Fresh ids make a spoofed reply a guess
+        free->id = LWIP_RAND();
+    }
+    return free;
+}
+
+void DNS_FORWARDER::Forward(struct pbuf* p, size_t end, const DNS_QUESTION_T* question, const ip_addr_t* client,
+    uint16_t port) {
+    uint8_t* msg = static_cast<uint8_t*>(p->payload);
+    DNS_HEADER_T* header = reinterpret_cast<DNS_HEADER_T*>(msg);
+    uint32_t now = sys_now();
+    uint32_t hash = Key(msg, question);
+    stats.queries++;
+
+    DNS_CACHE_T* entry = Lookup(hash, msg + sizeof(DNS_HEADER_T), end - sizeof(DNS_HEADER_T), now);
+    if (entry != NULL) {
+        stats.hits++;
+        Serve(p, end, entry, now, client, port);
+        return;
+    }
+    stats.misses++;
+
+    DNS_PENDING_T* query = Pending(hash, now);
+    if (query == NULL || query->waiter_count >= DNS_FORWARD_WAITERS) {
+        DEBUG_WRITE("DNS: No room to forward query\n");
+        stats.dropped++;
+        pbuf_free(p);
+        return;
+    }
+
+    DNS_WAITER_T* waiter = &query->waiters[query->waiter_count++];
+    ip_addr_copy(waiter->address, *client);
+    waiter->port = port;
+    waiter->id = lwip_ntohs(header->id);
+
+    // Someone asked the same question already, the one upstream reply answers both
+    if (query->waiter_count > 1) {
+        stats.coalesced++;
+        pbuf_free(p);
+        return;
+    }
+
+    // The query goes upstream as it came in, only the id changes
+    header->id = lwip_htons(query->id);
+    err_t err = udp_sendto(udp, p, &upstream, PORT_DNS_SERVER);
+    if (err != ERR_OK) {
+        ERROR_WRITE("DNS: Failed to forward query %d\n", err);
+        query->hash = 0;
+    } else {
+        stats.upstream++;
+    }
+    pbuf_free(p);
+}
+
+void DNS_FORWARDER::Receive(void* arg, struct udp_pcb* upcb, struct pbuf* p, const ip_addr_t* addr, u16_t port) {
+    DNS_QUESTION_T question;
+    DNS_PENDING_T* query = NULL;
+    uint8_t* msg;
+    size_t len;
+    int end;
+    uint16_t id;
+    uint32_t hash, now, latency;
+
+    if (p->next != NULL) {
+        p = pbuf_coalesce(p, PBUF_TRANSPORT);
+        if (p->next != NULL) goto ignore_reply;
+    }
+
+    msg = static_cast<uint8_t*>(p->payload);
+    len = p->len;
+    if (!ip_addr_cmp(addr, &upstream) || port != PORT_DNS_SERVER || len < sizeof(DNS_HEADER_T)) goto ignore_reply;
+    if ((DnsGet16(msg + 2) & DNS_FLAG_QR) == 0 || DnsGet16(msg + 4) != 1) goto ignore_reply;
+
+    end = DNS_SERVER::ParseQuestions(msg, len, &question, 1);
+    if (end < 0) goto ignore_reply;
+
+    // Both the id and the question have to match what was sent
+    id = DnsGet16(msg);
+    hash = Key(msg, &question);
+    for (DNS_PENDING_T& candidate : pending) {
+        if (candidate.hash == hash && candidate.id == id) query = &candidate;
+    }
+    if (query == NULL) {
+        DEBUG_WRITE("DNS: Unexpected upstream reply %u\n", id);
+        goto ignore_reply;
+    }
+
+    now = sys_now();
+    latency = now - query->sent;
+    stats.replies++;
+    stats.latency_total_ms += latency;
+    if (latency > stats.latency_max_ms) stats.latency_max_ms = latency;
+    DEBUG_WRITE("DNS: Upstream replied in %lu ms\n", (unsigned long)latency);
+
+    Insert(hash, msg, len, end, now);
+
+    // Sending adds headers in front of the payload, so the copies are made before the original goes
+    for (uint8_t i = query->waiter_count; i-- > 0;) {
+        DNS_WAITER_T* waiter = &query->waiters[i];
+        struct pbuf* reply = p;
+        if (i > 0) {
+            reply = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+            if (reply == NULL) continue;
+            memcpy(reply->payload, msg, len);
+        }
+
+        DnsPut16(static_cast<uint8_t*>(reply->payload), waiter->id);
+        err_t err = udp_sendto(server, reply, &waiter->address, waiter->port);
+        if (err != ERR_OK) ERROR_WRITE("DNS: Failed to send message %d\n", err);
+        if (reply != p) pbuf_free(reply);
+    }
+    query->hash = 0;
+
+ignore_reply:
+    pbuf_free(p);
+}
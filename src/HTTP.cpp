@@ -0,0 +1,575 @@
+/**
+ *@file HTTP.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-04-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_HTTP
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+#define ERROR_WRITE printf
+
+#include <cstdio>
+#include <cstring>
+
+#include <lwipopts.h>
+#include <HTTP.hpp>
+
+enum {
+    STATE_METHOD = 0,
+    STATE_PATH,
+    STATE_QUERY,
+    STATE_VERSION,
+    STATE_REQUEST_LF,
+    STATE_HEADER_START,
+    STATE_HEADER_NAME,
+    STATE_HEADER_VALUE_START,
+    STATE_HEADER_VALUE,
+    STATE_HEADER_LF,
+    STATE_HEADERS_LF,
+    STATE_BODY,
+};
+
+static const struct {
+    const char* name;
+    HTTP_METHOD method;
+} METHODS[] = {
+    { "GET",     HTTP_METHOD_GET },
+    { "HEAD",    HTTP_METHOD_HEAD },
+    { "POST",    HTTP_METHOD_POST },
+    { "PUT",     HTTP_METHOD_PUT },
+    { "DELETE",  HTTP_METHOD_DELETE },
+    { "OPTIONS", HTTP_METHOD_OPTIONS },
+};
+
+static const struct {
+    int status;
+    const char* reason;
+} REASONS[] = {
+    { 101, "Switching Protocols" },
+    { 200, "OK" },
+    { 204, "No Content" },
+    { 302, "Found" },
+    { 304, "Not Modified" },
+    { 400, "Bad Request" },
+    { 404, "Not Found" },
+    { 405, "Method Not Allowed" },
+    { 413, "Content Too Large" },
+    { 426, "Upgrade Required" },
+    { 431, "Request Header Fields Too Large" },
+    { 500, "Internal Server Error" },
+    { 503, "Service Unavailable" },
+};
+
+/**
+ * @brief Reads the byte at offset i of the chain starting at q, advancing both.
+ *
+ * @return int The byte, or -1 past the end of the chain
+ */
+static int Next(const pbuf** q, uint16_t* i) {
+    while (*q != nullptr && *i >= (*q)->len) {
+        *i -= (*q)->len;
+        *q = (*q)->next;
+    }
+    if (*q == nullptr) return -1;
+
+    return reinterpret_cast<const uint8_t*>((*q)->payload)[(*i)++];
+}
+
+static char Lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static bool IsTokenChar(uint8_t c) {
+    return c > ' ' && c < 0x7F && strchr("()<>@,;:\\\"/[]?={}", c) == nullptr;
+}
+
+const char* HttpReason(int status) {
+    for (size_t i = 0; i < sizeof(REASONS) / sizeof(REASONS[0]); ++i) {
+        if (REASONS[i].status == status) return REASONS[i].reason;
+    }
+
+    return "Unknown";
+}
+
+bool HttpPut(char* buffer, size_t max_len, size_t* len, const char* s, size_t n) {
+    if (*len + n > max_len) return false;
+
+    memcpy(buffer + *len, s, n);
+    *len += n;
+    return true;
+}
+
+bool HttpPut(char* buffer, size_t max_len, size_t* len, const char* s) {
+    return HttpPut(buffer, max_len, len, s, strlen(s));
+}
+
+size_t HttpDecimal(char* buffer, uint32_t value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (size_t i = 0; i < n; ++i) buffer[i] = digits[n - 1 - i];
+    return n;
+}
+
+HTTP_HEADER_BLOCK_T HTTP_HEADER_CACHE::blocks[HTTP_HEADER_CACHE_SIZE];
+uint8_t HTTP_HEADER_CACHE::count;
+
+bool HTTP_HEADER_CACHE::Format(HTTP_HEADER_BLOCK_T* block, int status, const char* content_type) {
+    char code[10];
+    size_t len = 0;
+    bool fits = HttpPut(block->data, sizeof(block->data), &len, "HTTP/1.1 ") &&
+        HttpPut(block->data, sizeof(block->data), &len, code, HttpDecimal(code, status)) &&
+        HttpPut(block->data, sizeof(block->data), &len, " ") &&
+        HttpPut(block->data, sizeof(block->data), &len, HttpReason(status)) &&
+        HttpPut(block->data, sizeof(block->data), &len, "\r\n");
+    if (fits && content_type != nullptr) {
+        fits = HttpPut(block->data, sizeof(block->data), &len, "Content-Type: ") &&
+            HttpPut(block->data, sizeof(block->data), &len, content_type) &&
+            HttpPut(block->data, sizeof(block->data), &len, "\r\n");
+    }
+    if (!fits) return false;
+
+    block->status = status;
+    block->content_type = content_type;
+    block->length = len;
+    return true;
+}
+
+const HTTP_HEADER_BLOCK_T* HTTP_HEADER_CACHE::Find(int status, const char* content_type) {
+    for (size_t i = 0; i < count; ++i) {
+        const HTTP_HEADER_BLOCK_T* block = &blocks[i];
+        if (block->status != status) continue;
+
+        // Content types are nearly always the same literal, compare pointers first
+        if (block->content_type == content_type ||
+            (block->content_type != nullptr && content_type != nullptr && strcmp(block->content_type, content_type) == 0)) {
+            return block;
+        }
+    }
+
+    if (count >= HTTP_HEADER_CACHE_SIZE) {
+        DEBUG_WRITE("HTTP: Header cache full, not caching %d %s\n", status, content_type ? content_type : "");
+        return nullptr;
+    }
+    if (!Format(&blocks[count], status, content_type)) return nullptr;
+
+    return &blocks[count++];
+}
+
+size_t HTTP_HEADER_CACHE::Build(char* buffer, size_t max_len, int status, const char* content_type,
+    int32_t content_length, bool keep_alive) {
+    // Once the cache is full, odd combinations are formatted each time
+    HTTP_HEADER_BLOCK_T uncached;
+    const HTTP_HEADER_BLOCK_T* block = Find(status, content_type);
+    if (block == nullptr) {
+        if (!Format(&uncached, status, content_type)) return 0;
+        block = &uncached;
+    }
+
+    size_t len = 0;
+    if (!HttpPut(buffer, max_len, &len, block->data, block->length)) return 0;
+
+    size_t end = Finish(buffer + len, max_len - len, content_length, keep_alive);
+    return end > 0 ? len + end : 0;
+}
+
+size_t HTTP_HEADER_CACHE::Finish(char* buffer, size_t max_len, int32_t content_length, bool keep_alive) {
+    size_t len = 0;
+    bool fits = true;
+
+    if (content_length >= 0) {
+        char digits[10];
+        fits = HttpPut(buffer, max_len, &len, "Content-Length: ") &&
+            HttpPut(buffer, max_len, &len, digits, HttpDecimal(digits, content_length)) &&
+            HttpPut(buffer, max_len, &len, "\r\n");
+    } else if (content_length == HTTP_LENGTH_CHUNKED) {
+        fits = HttpPut(buffer, max_len, &len, "Transfer-Encoding: chunked\r\n");
+    }
+
+    fits = fits &&
+        HttpPut(buffer, max_len, &len, keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    return fits ? len : 0;
+}
+
+HTTP_STATUS HTTP_PARSER::Feed(pbuf* p) {
+    Append(p);
+    return Parse();
+}
+
+void HTTP_PARSER::Append(pbuf* p) {
+    if (data == nullptr) {
+        data = p;
+        cursor = p;
+        index = 0;
+    } else {
+        pbuf_cat(data, p);
+    }
+}
+
+HTTP_STATUS HTTP_PARSER::Parse() {
+    if (status != HTTP_INCOMPLETE || cursor == nullptr) return status;
+
+    for (;;) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(cursor->payload);
+
+        while (index < cursor->len) {
+            if (state == STATE_BODY) {
+                // Skip the body in bulk, handlers read it through request.body
+                uint16_t end = request.body.offset + request.body.length;
+                uint16_t skip = LWIP_MIN(cursor->len - index, end - offset);
+                index += skip;
+                offset += skip;
+                if (offset == end) {
+                    request.length = offset;
+                    return status = HTTP_COMPLETE;
+                }
+                continue;
+            }
+
+            if (offset >= HTTP_MAX_REQUEST_SIZE) return status = HTTP_TOO_LARGE;
+
+            HTTP_STATUS result = Step(bytes[index]);
+            index++;
+            offset++;
+            if (result != HTTP_INCOMPLETE) return status = result;
+        }
+
+        if (cursor->next == nullptr) break;
+        cursor = cursor->next;
+        index = 0;
+    }
+
+    return status;
+}
+
+HTTP_STATUS HTTP_PARSER::Step(uint8_t c) {
+    switch (state) {
+        case STATE_METHOD:
+            if (c == ' ') {
+                if (offset == mark) return HTTP_BAD_REQUEST;
+
+                request.method_name = { mark, (uint16_t)(offset - mark) };
+                for (size_t i = 0; i < sizeof(METHODS) / sizeof(METHODS[0]); ++i) {
+                    if (Equals(request.method_name, METHODS[i].name)) {
+                        request.method = METHODS[i].method;
+                        break;
+                    }
+                }
+                request.path_hash = HttpHash(HTTP_HASH_BASIS, request.method);
+                mark = offset + 1;
+                state = STATE_PATH;
+            } else if ((c == '\r' || c == '\n') && offset == mark) {
+                // Ignore empty lines ahead of the request line (RFC 9112 2.2)
+                mark = offset + 1;
+            } else if (!IsTokenChar(c)) {
+                return HTTP_BAD_REQUEST;
+            }
+            break;
+
+        case STATE_PATH:
+            if (c == ' ' || c == '?') {
+                if (offset == mark) return HTTP_BAD_REQUEST;
+
+                request.path = { mark, (uint16_t)(offset - mark) };
+                request.query = { (uint16_t)(offset + 1), 0 };
+                mark = offset + 1;
+                state = (c == '?') ? STATE_QUERY : STATE_VERSION;
+            } else if (c <= ' ' || c == 0x7F) {
+                return HTTP_BAD_REQUEST;
+            } else {
+                request.path_hash = HttpHash(request.path_hash, c);
+            }
+            break;
+
+        case STATE_QUERY:
+            if (c == ' ') {
+                request.query = { mark, (uint16_t)(offset - mark) };
+                mark = offset + 1;
+                state = STATE_VERSION;
+            } else if (c < ' ' || c == 0x7F) {
+                return HTTP_BAD_REQUEST;
+            }
+            break;
+
+        case STATE_VERSION:
+            if (c == '\r' || c == '\n') {
+                HTTP_VIEW_T version = { mark, (uint16_t)(offset - mark) };
+                HTTP_VIEW_T prefix = { mark, 7 };
+                if (version.length != 8 || !Equals(prefix, "HTTP/1.")) return HTTP_BAD_REQUEST;
+
+                const pbuf* q = data;
+                uint16_t i = mark + 7;
+                int minor = Next(&q, &i);
+                if (minor < '0' || minor > '9') return HTTP_BAD_REQUEST;
+
+                request.version_minor = minor - '0';
+                state = (c == '\r') ? STATE_REQUEST_LF : STATE_HEADER_START;
+            }
+            break;
+
+        case STATE_REQUEST_LF:
+        case STATE_HEADER_LF:
+            if (c != '\n') return HTTP_BAD_REQUEST;
+            state = STATE_HEADER_START;
+            break;
+
+        case STATE_HEADER_START:
+            if (c == '\r') {
+                state = STATE_HEADERS_LF;
+                break;
+            }
+            if (c != '\n') {
+                if (!IsTokenChar(c)) return HTTP_BAD_REQUEST;
+                if (request.header_count >= HTTP_MAX_HEADERS) return HTTP_TOO_LARGE;
+
+                mark = offset;
+                state = STATE_HEADER_NAME;
+                break;
+            }
+            [[fallthrough]];
+
+        case STATE_HEADERS_LF:
+            if (c != '\n') return HTTP_BAD_REQUEST;
+
+            // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for it
+            if (request.version_minor >= 1) request.keep_alive = !(request.connection & HTTP_CONNECTION_CLOSE);
+            else request.keep_alive = request.connection & HTTP_CONNECTION_KEEP_ALIVE;
+
+            if (request.content_length > 0) {
+                if (offset + 1 + request.content_length > HTTP_MAX_REQUEST_SIZE) return HTTP_BODY_TOO_LARGE;
+
+                request.body = { (uint16_t)(offset + 1), (uint16_t)request.content_length };
+                state = STATE_BODY;
+                break;
+            }
+
+            request.body = { (uint16_t)(offset + 1), 0 };
+            request.length = offset + 1;
+            return HTTP_COMPLETE;
+
+        case STATE_HEADER_NAME:
+            if (c == ':') {
+                request.headers[request.header_count].name = { mark, (uint16_t)(offset - mark) };
+                state = STATE_HEADER_VALUE_START;
+            } else if (!IsTokenChar(c)) {
+                return HTTP_BAD_REQUEST;
+            }
+            break;
+
+        case STATE_HEADER_VALUE_START:
+            if (c == ' ' || c == '\t') break;
+
+            mark = offset;
+            end = offset;
+            state = STATE_HEADER_VALUE;
+            [[fallthrough]];
+
+        case STATE_HEADER_VALUE:
+            if (c == '\r' || c == '\n') {
+                request.headers[request.header_count].value = { mark, (uint16_t)(end - mark) };
+                HTTP_STATUS result = EndHeader();
+                if (result != HTTP_INCOMPLETE) return result;
+
+                state = (c == '\r') ? STATE_HEADER_LF : STATE_HEADER_START;
+            } else if (c != ' ' && c != '\t') {
+                end = offset + 1;
+            }
+            break;
+    }
+
+    return HTTP_INCOMPLETE;
+}
+
+HTTP_STATUS HTTP_PARSER::EndHeader() {
+    const HTTP_HEADER_T* header = &request.headers[request.header_count++];
+
+    if (EqualsIgnoreCase(header->name, "Content-Length")) {
+        const pbuf* q = data;
+        uint16_t i = header->value.offset;
+        uint32_t length = 0;
+
+        if (header->value.length == 0) return HTTP_BAD_REQUEST;
+        for (uint16_t n = 0; n < header->value.length; ++n) {
+            int c = Next(&q, &i);
+            if (c < '0' || c > '9') return HTTP_BAD_REQUEST;
+            // Stops before the value can overflow, whatever follows is too large anyway
+            if (length > HTTP_MAX_REQUEST_SIZE) return HTTP_BODY_TOO_LARGE;
+            length = length * 10 + (c - '0');
+        }
+        request.content_length = length;
+    } else if (EqualsIgnoreCase(header->name, "Connection")) {
+        if (HasToken(header->value, "close")) request.connection |= HTTP_CONNECTION_CLOSE;
+        if (HasToken(header->value, "keep-alive")) request.connection |= HTTP_CONNECTION_KEEP_ALIVE;
+        if (HasToken(header->value, "upgrade")) request.connection |= HTTP_CONNECTION_UPGRADE;
+    } else if (EqualsIgnoreCase(header->name, "Transfer-Encoding")) {
+        // Chunked request bodies are not supported
+        return HTTP_BAD_REQUEST;
+    }
+
+    return HTTP_INCOMPLETE;
+}
+
+void HTTP_PARSER::Consume() {
+    data = pbuf_free_header(data, request.length);
+
+    memset(&request, 0, sizeof(request));
+    status = HTTP_INCOMPLETE;
+    cursor = data;
+    index = 0;
+    offset = 0;
+    state = STATE_METHOD;
+    mark = 0;
+    end = 0;
+}
+
+void HTTP_PARSER::Reset() {
+    if (data != nullptr) pbuf_free(data);
+    data = nullptr;
+
+    memset(&request, 0, sizeof(request));
+    status = HTTP_INCOMPLETE;
+    cursor = nullptr;
+    index = 0;
+    offset = 0;
+    state = STATE_METHOD;
+    mark = 0;
+    end = 0;
+}
+
+struct pbuf* HTTP_PARSER::Detach() {
+    struct pbuf* rest = data;
+    data = nullptr;
+    Reset();
+
+    return rest;
+}
+
+bool HTTP_PARSER::Buffered() const {
+    return data != nullptr && data->tot_len > 0;
+}
+
+uint16_t HTTP_PARSER::Size() const {
+    return data != nullptr ? data->tot_len : 0;
+}
+
+const HTTP_VIEW_T* HTTP_PARSER::Header(const char* name) const {
+    for (uint8_t i = 0; i < request.header_count; ++i) {
+        if (EqualsIgnoreCase(request.headers[i].name, name)) return &request.headers[i].value;
+    }
+
+    return nullptr;
+}
+
+bool HTTP_PARSER::Equals(HTTP_VIEW_T view, const char* s) const {
+    if (strlen(s) != view.length) return false;
+
+    return pbuf_memcmp(data, view.offset, s, view.length) == 0;
+}
+
+bool HTTP_PARSER::EqualsIgnoreCase(HTTP_VIEW_T view, const char* s) const {
+    if (strlen(s) != view.length) return false;
+
+    const pbuf* q = data;
+    uint16_t i = view.offset;
+    for (uint16_t n = 0; n < view.length; ++n) {
+        int c = Next(&q, &i);
+        if (c < 0 || Lower(c) != Lower(s[n])) return false;
+    }
+
+    return true;
+}
+
+bool HTTP_PARSER::HasToken(HTTP_VIEW_T view, const char* token) const {
+    const pbuf* q = data;
+    uint16_t i = view.offset;
+    size_t matched = 0;
+    bool mismatch = false;
+    bool parameters = false;
+
+    for (uint16_t n = 0; n <= view.length; ++n) {
+        int c = (n < view.length) ? Next(&q, &i) : ',';
+        if (c < 0) return false;
+
+        if (c == ',') {
+            if (!mismatch && token[matched] == '\0') return true;
+            matched = 0;
+            mismatch = false;
+            parameters = false;
+        } else if (parameters) {
+            // Ignore ";q=0.5" style parameters after the token
+        } else if (c == ';') {
+            parameters = true;
+        } else if (c == ' ' || c == '\t') {
+            // Blanks only surround tokens
+            if (matched > 0) mismatch = mismatch || token[matched] != '\0';
+        } else if (!mismatch && token[matched] != '\0' && Lower(c) == Lower(token[matched])) {
+            matched++;
+        } else {
+            mismatch = true;
+        }
+    }
+
+    return false;
+}
+
+bool HTTP_PARSER::HasEntityTag(HTTP_VIEW_T view, const char* tag) const {
+    const pbuf* q = data;
+    uint16_t i = view.offset;
+    size_t matched = 0;
+    bool mismatch = false;
+
+    for (uint16_t n = 0; n <= view.length; ++n) {
+        int c = (n < view.length) ? Next(&q, &i) : ',';
+        if (c < 0) return false;
+
+        if (c == ',') {
+            if (!mismatch && matched > 0 && tag[matched] == '\0') return true;
+            matched = 0;
+            mismatch = false;
+        } else if (c == ' ' || c == '\t') {
+            // Blanks only surround tags
+            if (matched > 0) mismatch = mismatch || tag[matched] != '\0';
+        } else if (!mismatch && tag[matched] != '\0' && c == tag[matched]) {
+            matched++;
+        } else {
+            mismatch = true;
+        }
+    }
+
+    return false;
+}
+
+const char* HTTP_PARSER::Contiguous(HTTP_VIEW_T view) const {
+    const pbuf* q = data;
+    uint16_t i = view.offset;
+    while (q != nullptr && i >= q->len) {
+        i -= q->len;
+        q = q->next;
+    }
+    if (q == nullptr || i + view.length > q->len) return nullptr;
+
+    return reinterpret_cast<const char*>(q->payload) + i;
+}
+
+size_t HTTP_PARSER::Copy(HTTP_VIEW_T view, char* buf, size_t max_len) const {
+    if (max_len == 0) return 0;
+
+    uint16_t len = LWIP_MIN(view.length, max_len - 1);
+    len = pbuf_copy_partial(data, buf, len, view.offset);
+    buf[len] = '\0';
+
+    return len;
+}
@@ -0,0 +1,216 @@
+/**
+ *@file Lease.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstring>
+
+#include <Lease.hpp>
+
+#define MAC_LEN (6)
+
+LEASE_TABLE::LEASE_TABLE() {
+    memset(leases, 0, sizeof(leases));
+    memset(buckets, LEASE_NONE, sizeof(buckets));
+    memset(heads, LEASE_NONE, sizeof(heads));
+    memset(tails, LEASE_NONE, sizeof(tails));
+    memset(counts, 0, sizeof(counts));
+
+    // Lowest addresses first
+    for (size_t i = 0; i < DHCPS_MAX_IP; ++i) {
+        leases[i].chain = LEASE_NONE;
+        Link(&leases[i], LEASE_FREE);
+    }
+}
+
+size_t LEASE_TABLE::Bucket(const uint8_t* mac) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < MAC_LEN; ++i) hash = (hash ^ mac[i]) * 16777619u;
+    return (hash ^ hash >> 16) & (BUCKETS - 1);
+}
+
+void LEASE_TABLE::Link(LEASE_T* lease, LEASE_STATE state) {
+    uint8_t i = lease - leases;
+
+    lease->state = state;
+    lease->prev = tails[state];
+    lease->next = LEASE_NONE;
+    if (tails[state] != LEASE_NONE) {
+        leases[tails[state]].next = i;
+    } else {
+        heads[state] = i;
+    }
+    tails[state] = i;
+    counts[state]++;
+}
+
+void LEASE_TABLE::Unlink(LEASE_T* lease) {
+    uint8_t state = lease->state;
+
+    if (lease->prev != LEASE_NONE) {
+        leases[lease->prev].next = lease->next;
+    } else {
+        heads[state] = lease->next;
+    }
+    if (lease->next != LEASE_NONE) {
+        leases[lease->next].prev = lease->prev;
+    } else {
+        tails[state] = lease->prev;
+    }
+    counts[state]--;
+}
+
+void LEASE_TABLE::Hash(LEASE_T* lease, const uint8_t* mac) {
+    size_t bucket = Bucket(mac);
+
+    memcpy(lease->mac, mac, MAC_LEN);
+    lease->chain = buckets[bucket];
+    buckets[bucket] = lease - leases;
+}
+
+void LEASE_TABLE::Unhash(LEASE_T* lease) {
+    uint8_t i = lease - leases;
+
+    for (uint8_t* link = &buckets[Bucket(lease->mac)]; *link != LEASE_NONE; link = &leases[*link].chain) {
+        if (*link == i) {
+            *link = lease->chain;
+            break;
+        }
+    }
+    lease->chain = LEASE_NONE;
+    memset(lease->mac, 0, MAC_LEN);
+}
+
+LEASE_T* LEASE_TABLE::Find(const uint8_t* mac) {
+    for (uint8_t i = buckets[Bucket(mac)]; i != LEASE_NONE; i = leases[i].chain) {
+        if (memcmp(leases[i].mac, mac, MAC_LEN) == 0) return &leases[i];
+    }
+    return NULL;
+}
+
+void LEASE_TABLE::Expire(uint32_t now) {
+    static constexpr LEASE_STATE ACTIVE[] = { LEASE_OFFERED, LEASE_BOUND, LEASE_DECLINED };
+
+    // Every list is in expiry order, so only their heads need checking
+    for (LEASE_STATE state : ACTIVE) {
+        while (heads[state] != LEASE_NONE) {
+            LEASE_T* lease = &leases[heads[state]];
+            if ((int32_t)(lease->expiry - now) > 0) break;
+
+            Unlink(lease);
+            Link(lease, state == LEASE_DECLINED ? LEASE_FREE : LEASE_IDLE);
+        }
+    }
+}
+
+bool LEASE_TABLE::Deadline(uint32_t* at) const {
+    static constexpr LEASE_STATE ACTIVE[] = { LEASE_OFFERED, LEASE_BOUND, LEASE_DECLINED };
+
+    bool found = false;
+    for (LEASE_STATE state : ACTIVE) {
+        if (heads[state] == LEASE_NONE) continue;
+
+        uint32_t expiry = leases[heads[state]].expiry;
+        if (!found || (int32_t)(expiry - *at) < 0) *at = expiry;
+        found = true;
+    }
+    return found;
+}
+
+LEASE_T* LEASE_TABLE::Allocate(const uint8_t* mac, uint32_t now) {
+    Expire(now);
+
+    LEASE_T* lease = Find(mac);
+    if (lease != NULL) return lease;
+
+    // A fresh address, otherwise the one whose client has been gone longest
+    uint8_t i = heads[LEASE_FREE] != LEASE_NONE ? heads[LEASE_FREE] : heads[LEASE_IDLE];
+    if (i == LEASE_NONE) return NULL;
+
+    lease = &leases[i];
+    if (lease->state == LEASE_IDLE) Unhash(lease);
+    Unlink(lease);
+    Hash(lease, mac);
+    Link(lease, LEASE_IDLE);
+    return lease;
+}
+
+LEASE_T* LEASE_TABLE::Claim(uint8_t address, const uint8_t* mac, uint32_t now) {
+    if (address < DHCPS_BASE_IP || address >= DHCPS_BASE_IP + DHCPS_MAX_IP) return NULL;
+    Expire(now);
+
+    LEASE_T* lease = &leases[address - DHCPS_BASE_IP];
+    if (lease->state == LEASE_DECLINED) return NULL;
+    if (lease->state != LEASE_FREE && memcmp(lease->mac, mac, MAC_LEN) == 0) return lease;
+    if (lease->state == LEASE_OFFERED || lease->state == LEASE_BOUND) return NULL;
+
+    // The client moves to this address, whatever it held before is given up
+    LEASE_T* previous = Find(mac);
+    if (previous != NULL) {
+        Unhash(previous);
+        Unlink(previous);
+        Link(previous, LEASE_FREE);
+    }
+
+    if (lease->state == LEASE_IDLE) Unhash(lease);
+    Unlink(lease);
+    Hash(lease, mac);
+    Link(lease, LEASE_IDLE);
+    return lease;
+}
+
+void LEASE_TABLE::Offer(LEASE_T* lease, uint32_t now) {
+    // A bound client asking again keeps its lease until it requests
+    if (lease->state == LEASE_BOUND) return;
+
+    Unlink(lease);
+    lease->expiry = now + LEASE_OFFER_HOLD_S * 1000;
+    Link(lease, LEASE_OFFERED);
+}
+
+void LEASE_TABLE::Bind(LEASE_T* lease, uint32_t now, uint32_t seconds) {
+    // Every lease is the same length, so the tail stays the latest to expire
+    Unlink(lease);
+    lease->expiry = now + seconds * 1000;
+    Link(lease, LEASE_BOUND);
+}
+
+void LEASE_TABLE::Decline(LEASE_T* lease, uint32_t now) {
+    Release(lease);
+
+    Unlink(lease);
+    lease->expiry = now + LEASE_DECLINE_HOLD_S * 1000;
+    Link(lease, LEASE_DECLINED);
+}
+
+void LEASE_TABLE::Release(LEASE_T* lease) {
+    if (lease->state == LEASE_FREE) return;
+
+    Unhash(lease);
+    Unlink(lease);
+    Link(lease, LEASE_FREE);
+}
+
+LEASE_T* LEASE_TABLE::Restore(uint8_t address, const uint8_t* mac, uint32_t now, uint32_t seconds) {
+    if (address < DHCPS_BASE_IP || address >= DHCPS_BASE_IP + DHCPS_MAX_IP) return NULL;
+
+    LEASE_T* lease = &leases[address - DHCPS_BASE_IP];
+    LEASE_T* previous = Find(mac);
+    if (previous != NULL && previous != lease) Release(previous);
+
+    if (previous != lease) {
+        Release(lease);
+        Unlink(lease);
+        Hash(lease, mac);
+        Link(lease, LEASE_IDLE);
+    }
+
+    Bind(lease, now, seconds);
+    return lease;
+}
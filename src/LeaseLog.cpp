@@ -0,0 +1,272 @@
+/**
+ *@file LeaseLog.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-07-13
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_DHCP
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+#define ERROR_WRITE printf
+
+#define MAC_LEN (6)
+
+#include <cstdio>
+#include <cstring>
+
+#include <pico/cyw43_arch.h>
+
+#include <LeaseLog.hpp>
+
+LEASE_LOG_STATS_T LEASE_LOG::stats;
+bool LEASE_LOG::started;
+size_t LEASE_LOG::sector;
+uint32_t LEASE_LOG::generation;
+size_t LEASE_LOG::position;
+LEASE_RECORD_T LEASE_LOG::queue[LEASE_LOG_QUEUE];
+size_t LEASE_LOG::queued;
+bool LEASE_LOG::overflowed;
+uint32_t LEASE_LOG::oldest;
+
+uint8_t LEASE_LOG::Check(const void* slot) {
+    // CRC-8 over everything before the check byte
+    const uint8_t* bytes = (const uint8_t*)slot;
+    uint8_t crc = 0;
+    for (size_t i = 0; i < sizeof(LEASE_RECORD_T) - 1; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+bool LEASE_LOG::Valid(size_t sector, uint32_t* generation) {
+    LEASE_LOG_HEADER_T header;
+    memcpy(&header, FLASH_STORE::Read(sector * FLASH_SECTOR_SIZE), sizeof(header));
+
+    if (header.magic != LEASE_LOG_MAGIC || header.version != LEASE_LOG_VERSION) return false;
+    if (header.check != Check(&header)) return false;
+
+    *generation = header.generation;
+    return true;
+}
+
+size_t LEASE_LOG::Start(LEASE_TABLE* table, uint32_t now) {
+    started = false;
+    queued = 0;
+    overflowed = false;
+    if (!FLASH_STORE::Start()) return 0;
+
+    bool found = false;
+    for (size_t i = 0; i < FLASH_STORE_SECTORS; ++i) {
+        uint32_t g;
+        if (!Valid(i, &g)) continue;
+
+        // Generations only go up, compared so that wrapping still works
+        if (!found || (int32_t)(g - generation) > 0) {
+            sector = i;
+            generation = g;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        // Blank flash or an older layout, begin a new log in the first sector
+        DEBUG_WRITE("DHCP: No lease log, starting one\n");
+        sector = FLASH_STORE_SECTORS - 1;
+        generation = 0;
+        started = Compact(NULL, 0);
+        return 0;
+    }
+
+    started = true;
+    return Replay(table, now);
+}
+
+size_t LEASE_LOG::Replay(LEASE_TABLE* table, uint32_t now) {
+    const uint8_t* base = FLASH_STORE::Read(sector * FLASH_SECTOR_SIZE);
+
+    for (position = 1; position < LEASE_LOG_SLOTS; ++position) {
+        LEASE_RECORD_T record;
+        memcpy(&record, base + position * sizeof(record), sizeof(record));
+
+        // Records are appended in order, the first erased slot is the end
+        static const uint8_t ERASED[sizeof(LEASE_RECORD_T)] = {
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        };
+        if (memcmp(&record, ERASED, sizeof(record)) == 0) break;
+
+        if (record.check != Check(&record)) {
+            stats.corrupt++;
+            continue;
+        }
+        stats.restored++;
+
+        if (record.state == LEASE_BOUND) {
+            table->Restore(record.address, record.mac, now, record.seconds);
+        } else if (record.state == LEASE_FREE) {
+            LEASE_T* lease = table->Find(record.mac);
+            if (lease != NULL) table->Release(lease);
+        }
+    }
+
+    DEBUG_WRITE("DHCP: Restored %u leases from generation %lu, %u records\n",
+        (unsigned)table->Count(LEASE_BOUND), (unsigned long)generation, (unsigned)(position - 1));
+    return table->Count(LEASE_BOUND);
+}
+
+void LEASE_LOG::Record(const uint8_t* mac, uint8_t address, uint32_t seconds, uint32_t now) {
+    if (!started) return;
+    stats.recorded++;
+
+    LEASE_RECORD_T record;
+    memcpy(record.mac, mac, MAC_LEN);
+    record.address = address;
+    record.state = seconds > 0 ? LEASE_BOUND : LEASE_FREE;
+    record.seconds = seconds;
+    memset(record.unused, 0, sizeof(record.unused));
+    record.check = Check(&record);
+
+    if (queued == 0 && !overflowed) oldest = now;
+
+    // Only the latest change to a client matters, but it has to stay behind
+    // everything queued before it so replay still ends in the same state
+    for (size_t i = 0; i < queued; ++i) {
+        if (memcmp(queue[i].mac, mac, MAC_LEN) != 0) continue;
+
+        memmove(&queue[i], &queue[i + 1], (queued - i - 1) * sizeof(record));
+        queued--;
+        stats.coalesced++;
+        break;
+    }
+
+    if (queued == LEASE_LOG_QUEUE) {
+        // The table has the change, the next flush writes all of it
+        if (!overflowed) stats.overflows++;
+        overflowed = true;
+        return;
+    }
+    queue[queued++] = record;
+}
+
+size_t LEASE_LOG::Snapshot(const LEASE_TABLE* table, uint32_t now, LEASE_RECORD_T* records) {
+    size_t count = 0;
+
+    // Soonest to expire first, so replaying rebuilds the bound list in the same order
+    for (const LEASE_T* lease = table->First(LEASE_BOUND); lease != NULL; lease = table->Next(lease)) {
+        int32_t left = lease->expiry - now;
+        if (left <= 0) continue;
+
+        LEASE_RECORD_T* record = &records[count++];
+        memcpy(record->mac, lease->mac, MAC_LEN);
+        record->address = table->Address(lease);
+        record->state = LEASE_BOUND;
+        record->seconds = (left + 999) / 1000;
+        memset(record->unused, 0, sizeof(record->unused));
+        record->check = Check(record);
+    }
+    return count;
+}
+
+void LEASE_LOG::Flush(const LEASE_TABLE* table, uint32_t now, bool force) {
+    static LEASE_RECORD_T batch[DHCPS_MAX_IP > LEASE_LOG_QUEUE ? DHCPS_MAX_IP : LEASE_LOG_QUEUE];
+
+    if (!started) return;
+
+    // Take the queue, or a snapshot, out from under the DHCP callback, then write without the lock
+    cyw43_arch_lwip_begin();
+
+    bool due = queued > 0 || overflowed;
+    if (due && !force) {
+        due = overflowed || queued >= LEASE_LOG_QUEUE / 2 || now - oldest >= LEASE_LOG_FLUSH_MS;
+    }
+    if (!due) {
+        cyw43_arch_lwip_end();
+        return;
+    }
+
+    bool compact = overflowed || position + queued > LEASE_LOG_SLOTS;
+    size_t count;
+    if (compact) {
+        count = Snapshot(table, now, batch);
+    } else {
+        count = queued;
+        memcpy(batch, queue, count * sizeof(LEASE_RECORD_T));
+    }
+    queued = 0;
+    overflowed = false;
+
+    cyw43_arch_lwip_end();
+
+    bool written = compact ? Compact(batch, count) : Append(batch, count);
+    stats.flushes++;
+
+    if (!written) {
+        // Leases carry on in RAM, retrying would only wear the flash further
+        ERROR_WRITE("DHCP: Lease log write failed, leases are no longer saved\n");
+        started = false;
+    }
+}
+
+bool LEASE_LOG::Append(const LEASE_RECORD_T* records, size_t count) {
+    if (!WriteSlots(sector, position, records, count)) return false;
+
+    position += count;
+    return true;
+}
+
+bool LEASE_LOG::Compact(const LEASE_RECORD_T* records, size_t count) {
+    size_t next = (sector + 1) % FLASH_STORE_SECTORS;
+
+    if (!FLASH_STORE::Erase(next)) return false;
+    if (!WriteSlots(next, 1, records, count)) return false;
+
+    // The header goes in last, until then the old sector is still the live one
+    LEASE_LOG_HEADER_T header;
+    header.magic = LEASE_LOG_MAGIC;
+    header.generation = generation + 1;
+    header.version = LEASE_LOG_VERSION;
+    memset(header.unused, 0, sizeof(header.unused));
+    header.check = Check(&header);
+    if (!WriteSlots(next, 0, &header, 1)) return false;
+
+    DEBUG_WRITE("DHCP: Lease log compacted to sector %u, %u leases\n", (unsigned)next, (unsigned)count);
+
+    sector = next;
+    generation++;
+    position = 1 + count;
+    stats.compactions++;
+    return true;
+}
+
+bool LEASE_LOG::WriteSlots(size_t sector, size_t slot, const void* slots, size_t count) {
+    // Programs need their data in RAM, and each page is rewritten whole
+    static uint8_t page[FLASH_PAGE_SIZE];
+
+    const uint8_t* data = (const uint8_t*)slots;
+    uint32_t offset = sector * FLASH_SECTOR_SIZE + slot * sizeof(LEASE_RECORD_T);
+    size_t left = count * sizeof(LEASE_RECORD_T);
+
+    while (left > 0) {
+        uint32_t start = offset & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+        size_t at = offset - start;
+        size_t n = FLASH_PAGE_SIZE - at < left ? FLASH_PAGE_SIZE - at : left;
+
+        // Slots already written are programmed again with the same bits, which leaves them as they are
+        memcpy(page, FLASH_STORE::Read(start), FLASH_PAGE_SIZE);
+        memcpy(page + at, data, n);
+        if (!FLASH_STORE::Program(start, page)) return false;
+
+        offset += n;
+        data += n;
+        left -= n;
+    }
+    return true;
+}
@@ -0,0 +1,475 @@
+/**
+ *@file Metrics.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-08-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <cyw43_config.h>
+#include <pico/stdlib.h>
+
+#include <lwipopts.h>
+#include <lwip/ip_addr.h>
+#include <lwip/memp.h>
+#include <lwip/stats.h>
+#include <lwip/udp.h>
+
+#include <DHCP.hpp>
+#include <DNS.hpp>
+#include <Flash.hpp>
+#include <Forward.hpp>
+#include <LeaseLog.hpp>
+#include <Metrics.hpp>
+#include <TCP.hpp>
+#include <Task.hpp>
+
+METRIC_SCRAPE_T METRIC_REGISTRY::scrapes[METRIC_SCRAPES];
+
+static bool Uptime(size_t i, METRIC_SAMPLE_T* sample) {
+    sample->value = time_us_64() / 1000000;
+    return i == 0;
+}
+
+static bool Connections(size_t i, METRIC_SAMPLE_T* sample) {
+    static const char* const STATES[] = { "idle", "active", "websocket", "events", "closing" };
+    if (i >= sizeof(STATES) / sizeof(STATES[0])) return false;
+
+    uint32_t counts[sizeof(STATES) / sizeof(STATES[0])] = {};
+    for (size_t c = 0; c < TCP_SERVER::connections.Capacity(); ++c) {
+        TCP_CONNECT_STATE_T* connection = TCP_SERVER::connections.At(c);
+        if (connection == nullptr) continue;
+
+        if (connection->websocket != nullptr) counts[2]++;
+        else if (connection->event_stream) counts[3]++;
+        else if (connection->closing) counts[4]++;
+        else if (TCP_SERVER::Streaming(connection) || connection->parser.Buffered()) counts[1]++;
+        else counts[0]++;
+    }
+
+    sample->series = STATES[i];
+    sample->value = counts[i];
+    return true;
+}
+
+static bool ConnectionsHighWater(size_t i, METRIC_SAMPLE_T* sample) {
+    sample->value = TCP_SERVER::connections.HighWater();
+    return i == 0;
+}
+
+static bool ResponseTimes(size_t i, METRIC_SAMPLE_T* sample) {
+    static const char* const OTHERS[TCP_TIMINGS] = { "asset", "probe", "redirect", "reject" };
+
+    // Every route, then the responses no route made
+    if (i < ROUTER::Count()) {
+        sample->series = ROUTER::At(i)->path;
+        sample->histogram = ROUTER::Timing(ROUTER::At(i));
+        return true;
+    }
+    i -= ROUTER::Count();
+    if (i >= TCP_TIMINGS) return false;
+
+    sample->series = OTHERS[i];
+    sample->histogram = &TCP_SERVER::timings[i];
+    return true;
+}
+
+static bool DnsQuestions(size_t i, METRIC_SAMPLE_T* sample) {
+    static const char* const KINDS[DNS_QUERY_KINDS] = { "A", "AAAA", "PTR", "SVCB", "other" };
+    if (i >= DNS_QUERY_KINDS) return false;
+
+    sample->series = KINDS[i];
+    sample->value = DNS_SERVER::stats.questions[i];
+    return true;
+}
+
+static bool DnsResponses(size_t i, METRIC_SAMPLE_T* sample) {
+    static const char* const RCODES[DNS_RCODES] = { "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED" };
+    if (i >= DNS_RCODES) return false;
+
+    sample->series = RCODES[i];
+    sample->value = DNS_SERVER::stats.responses[i];
+    return true;
+}
+
+static bool DhcpReceived(size_t i, METRIC_SAMPLE_T* sample) {
+    // Only what a client sends, 0 for a type the server does not know
+    static const uint8_t TYPES[] = { 0, DHCPDISCOVER, DHCPREQUEST, DHCPDECLINE, DHCPRELEASE, DHCPINFORM };
+    static const char* const NAMES[] = { "unknown", "DISCOVER", "REQUEST", "DECLINE", "RELEASE", "INFORM" };
+    if (i >= sizeof(TYPES)) return false;
+
+    sample->series = NAMES[i];
+    sample->value = DHCP_SERVER::stats.received[TYPES[i]];
+    return true;
+}
+
+static bool DhcpSent(size_t i, METRIC_SAMPLE_T* sample) {
+    static const uint8_t TYPES[] = { DHCPOFFER, DHCPACK, DHCPNACK };
+    static const char* const NAMES[] = { "OFFER", "ACK", "NAK" };
+    if (i >= sizeof(TYPES)) return false;
+
+    sample->series = NAMES[i];
+    sample->value = DHCP_SERVER::stats.sent[TYPES[i]];
+    return true;
+}
+
+static bool DhcpLeases(size_t i, METRIC_SAMPLE_T* sample) {
+    static const char* const STATES[LEASE_STATES] = { "free", "idle", "offered", "bound", "declined" };
+    if (i >= LEASE_STATES) return false;
+
+    sample->series = STATES[i];
+    sample->value = DHCP_SERVER::Leases(static_cast<LEASE_STATE>(i));
+    return true;
+}
+
+static bool FlashErases(size_t i, METRIC_SAMPLE_T* sample) {
+    static char sector[4];
+    if (i >= FLASH_STORE_SECTORS) return false;
+
+    // Read before the next series is asked for
+    snprintf(sector, sizeof(sector), "%u", (unsigned)i);
+    sample->series = sector;
+    sample->value = FLASH_STORE::stats.erases[i];
+    return true;
+}
+
+/**
+ * @brief lwIP heap, then the pools that run out first under load.
+ *
+ * @param i
+ * @param name
+ * @return const stats_mem* NULL past the last pool
+ */
+static const stats_mem* Pool(size_t i, const char** name) {
+    static const struct {
+        const char* name;
+        int pool;           // memp_t, -1 for the heap
+    } POOLS[] = {
+        { "heap", -1 },
+        { "pbuf_pool", MEMP_PBUF_POOL },
+        { "pbuf", MEMP_PBUF },
+        { "tcp_pcb", MEMP_TCP_PCB },
+        { "tcp_pcb_listen", MEMP_TCP_PCB_LISTEN },
+        { "tcp_seg", MEMP_TCP_SEG },
+        { "udp_pcb", MEMP_UDP_PCB },
+    };
+    if (i >= sizeof(POOLS) / sizeof(POOLS[0])) return nullptr;
+
+    *name = POOLS[i].name;
+    if (POOLS[i].pool < 0) return &lwip_stats.mem;
+
+    // Set by memp_init, a pool that is not there reads as empty
+    static const stats_mem none = {};
+    const stats_mem* stats = lwip_stats.memp[POOLS[i].pool];
+    return stats != nullptr ? stats : &none;
+}
+
+static bool PoolUsed(size_t i, METRIC_SAMPLE_T* sample) {
+    const stats_mem* stats = Pool(i, &sample->series);
+    if (stats == nullptr) return false;
+
+    sample->value = stats->used;
+    return true;
+}
+
+static bool PoolHighWater(size_t i, METRIC_SAMPLE_T* sample) {
+    const stats_mem* stats = Pool(i, &sample->series);
+    if (stats == nullptr) return false;
+
+    sample->value = stats->max;
+    return true;
+}
+
+static bool PoolSize(size_t i, METRIC_SAMPLE_T* sample) {
+    const stats_mem* stats = Pool(i, &sample->series);
+    if (stats == nullptr) return false;
+
+    sample->value = stats->avail;
+    return true;
+}
+
+static bool PoolFailures(size_t i, METRIC_SAMPLE_T* sample) {
+    const stats_mem* stats = Pool(i, &sample->series);
+    if (stats == nullptr) return false;
+
+    sample->value = stats->err;
+    return true;
+}
+
+/**
+ * @brief Everything served at /metrics, in order. Add new metrics here.
+ */
+static const METRIC_T REGISTRY[] = {
+    { "uptime_seconds", "Seconds since boot", METRIC_TYPE_GAUGE, nullptr, nullptr, nullptr, Uptime },
+
+    { "http_connections_accepted_total", "Connections accepted", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &TCP_SERVER::stats.accepts, nullptr },
+    { "http_connections_rejected_total", "Connections turned away with 503 for lack of a slot", METRIC_TYPE_COUNTER,
+        nullptr, nullptr, &TCP_SERVER::stats.rejections, nullptr },
+    { "http_connections_evicted_total", "Idle connections closed to make room", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &TCP_SERVER::stats.evictions, nullptr },
+    { "http_connections_timed_out_total", "Connections closed by the idle timer", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &TCP_SERVER::stats.timeouts, nullptr },
+    { "http_connections_aborted_total", "Connections lost to a reset or an abort inside lwIP", METRIC_TYPE_COUNTER,
+        nullptr, nullptr, &TCP_SERVER::stats.aborts, nullptr },
+    { "http_connections", "Open connections by state", METRIC_TYPE_GAUGE, "state", nullptr, nullptr, Connections },
+    { "http_connections_high_water", "Most connections open at once", METRIC_TYPE_GAUGE, nullptr, nullptr, nullptr,
+        ConnectionsHighWater },
+    { "http_response_seconds", "Time from a complete request to its response being queued", METRIC_TYPE_HISTOGRAM,
+        "route", nullptr, nullptr, ResponseTimes },
+    { "http_websocket_upgrades_total", "Connections switched to WebSocket", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &TCP_SERVER::stats.upgrades, nullptr },
+    { "http_websocket_dropped_total", "WebSocket messages not sent for lack of send buffer", METRIC_TYPE_COUNTER,
+        nullptr, nullptr, &TCP_SERVER::stats.ws_dropped, nullptr },
+    { "http_event_streams_total", "Event streams opened", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &TCP_SERVER::stats.subscriptions, nullptr },
+    { "http_event_gaps_total", "Times an event stream fell behind the event ring", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &TCP_SERVER::stats.event_gaps, nullptr },
+    { "tasks_started_total", "Asynchronous handlers started", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &ASYNC_TASK::stats.started, nullptr },
+    { "tasks_exhausted_total", "Asynchronous handlers refused for lack of a frame", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &ASYNC_TASK::stats.exhausted, nullptr },
+
+    { "dns_questions_total", "Questions received by type", METRIC_TYPE_COUNTER, "type", nullptr, nullptr,
+        DnsQuestions },
+    { "dns_responses_total", "Responses sent by RCODE, forwarded queries aside", METRIC_TYPE_COUNTER, "rcode",
+        nullptr, nullptr, DnsResponses },
+    { "dns_ignored_total", "Datagrams not answered, not a query or malformed", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &DNS_SERVER::stats.ignored, nullptr },
+    { "dns_rate_limited_total", "Queries over their client's rate", METRIC_TYPE_COUNTER, "action", "refused",
+        &DNS_SERVER::limiter.stats.refused, nullptr },
+    { "dns_rate_limited_total", "Queries over their client's rate", METRIC_TYPE_COUNTER, "action", "dropped",
+        &DNS_SERVER::limiter.stats.dropped, nullptr },
+    { "dns_rate_limit_evictions_total", "Clients pushed out of the rate limit table", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &DNS_SERVER::limiter.stats.evictions, nullptr },
+    { "dns_forward_queries_total", "Queries for names outside the local zone", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &DNS_FORWARDER::stats.queries, nullptr },
+    { "dns_forward_cache_total", "Forwarded queries by how the cache took them", METRIC_TYPE_COUNTER, "result",
+        "hit", &DNS_FORWARDER::stats.hits, nullptr },
+    { "dns_forward_cache_total", "Forwarded queries by how the cache took them", METRIC_TYPE_COUNTER, "result",
+        "miss", &DNS_FORWARDER::stats.misses, nullptr },
+    { "dns_forward_cache_total", "Forwarded queries by how the cache took them", METRIC_TYPE_COUNTER, "result",
+        "coalesced", &DNS_FORWARDER::stats.coalesced, nullptr },
+    { "dns_forward_upstream_total", "Queries sent upstream", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &DNS_FORWARDER::stats.upstream, nullptr },
+    { "dns_forward_replies_total", "Upstream replies matched to a query", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &DNS_FORWARDER::stats.replies, nullptr },
+    { "dns_forward_timeouts_total", "Upstream queries given up on", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &DNS_FORWARDER::stats.timeouts, nullptr },
+    { "dns_forward_dropped_total", "Queries dropped with no room to track them", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &DNS_FORWARDER::stats.dropped, nullptr },
+    { "dns_forward_upstream_milliseconds_total", "Upstream round trips summed over every matched reply",
+        METRIC_TYPE_COUNTER, nullptr, nullptr, &DNS_FORWARDER::stats.latency_total_ms, nullptr },
+    { "dns_forward_upstream_max_milliseconds", "Longest upstream round trip", METRIC_TYPE_GAUGE, nullptr, nullptr,
+        &DNS_FORWARDER::stats.latency_max_ms, nullptr },
+
+    { "dhcp_received_total", "Requests received by message type", METRIC_TYPE_COUNTER, "type", nullptr, nullptr,
+        DhcpReceived },
+    { "dhcp_sent_total", "Replies sent by message type", METRIC_TYPE_COUNTER, "type", nullptr, nullptr, DhcpSent },
+    { "dhcp_malformed_total", "Datagrams that were not a well formed request", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &DHCP_SERVER::stats.malformed, nullptr },
+    { "dhcp_exhausted_total", "Discovers not offered an address, every one was taken", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &DHCP_SERVER::stats.exhausted, nullptr },
+    { "dhcp_leases", "Leases by state", METRIC_TYPE_GAUGE, "state", nullptr, nullptr, DhcpLeases },
+    { "lease_log_restored_total", "Lease records replayed at boot", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &LEASE_LOG::stats.restored, nullptr },
+    { "lease_log_corrupt_total", "Lease records skipped for a bad check", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &LEASE_LOG::stats.corrupt, nullptr },
+    { "lease_log_recorded_total", "Lease changes queued for flash", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &LEASE_LOG::stats.recorded, nullptr },
+    { "lease_log_coalesced_total", "Lease changes folded into one already queued", METRIC_TYPE_COUNTER, nullptr,
+        nullptr, &LEASE_LOG::stats.coalesced, nullptr },
+    { "lease_log_flushes_total", "Lease queue flushes to flash", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &LEASE_LOG::stats.flushes, nullptr },
+    { "lease_log_compactions_total", "Lease log moves to a fresh sector", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &LEASE_LOG::stats.compactions, nullptr },
+    { "lease_log_overflows_total", "Lease queue overflows, written as a whole snapshot", METRIC_TYPE_COUNTER,
+        nullptr, nullptr, &LEASE_LOG::stats.overflows, nullptr },
+    { "flash_erases_total", "Sector erases", METRIC_TYPE_COUNTER, "sector", nullptr, nullptr, FlashErases },
+    { "flash_programs_total", "Page programs", METRIC_TYPE_COUNTER, nullptr, nullptr, &FLASH_STORE::stats.programs,
+        nullptr },
+    { "flash_failures_total", "Erases or programs refused or read back wrong", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &FLASH_STORE::stats.failures, nullptr },
+
+    { "lwip_pool_used", "Heap bytes or pool elements in use", METRIC_TYPE_GAUGE, "pool", nullptr, nullptr,
+        PoolUsed },
+    { "lwip_pool_high_water", "Most heap bytes or pool elements in use at once", METRIC_TYPE_GAUGE, "pool", nullptr,
+        nullptr, PoolHighWater },
+    { "lwip_pool_size", "Heap bytes or pool elements there are", METRIC_TYPE_GAUGE, "pool", nullptr, nullptr,
+        PoolSize },
+    { "lwip_pool_failures_total", "Allocations refused", METRIC_TYPE_COUNTER, "pool", nullptr, nullptr,
+        PoolFailures },
+    { "lwip_link_frames_total", "Frames through the interface", METRIC_TYPE_COUNTER, "direction", "rx",
+        &lwip_stats.link.recv, nullptr },
+    { "lwip_link_frames_total", "Frames through the interface", METRIC_TYPE_COUNTER, "direction", "tx",
+        &lwip_stats.link.xmit, nullptr },
+    { "lwip_link_dropped_total", "Frames dropped by the interface", METRIC_TYPE_COUNTER, nullptr, nullptr,
+        &lwip_stats.link.drop, nullptr },
+};
+
+static constexpr size_t METRIC_COUNT = sizeof(REGISTRY) / sizeof(REGISTRY[0]);
+
+void METRIC_REGISTRY::Start(HTTP_RESPONSE_T* response) {
+    uint32_t now = cyw43_hal_ticks_ms();
+
+    for (size_t i = 0; i < METRIC_SCRAPES; ++i) {
+        METRIC_SCRAPE_T* scrape = &scrapes[i];
+        if (scrape->busy && now - scrape->last_active < METRIC_SCRAPE_STALE_MS) continue;
+
+        // A stale scrape's handle stops resolving, its connection is closed on the next pull
+        scrape->generation++;
+        scrape->last_active = now;
+        scrape->offset = 0;
+        scrape->metric = 0;
+        scrape->series = 0;
+        scrape->row = 0;
+        scrape->described = false;
+        scrape->line_len = 0;
+        scrape->line_sent = 0;
+        scrape->busy = true;
+
+        response->content_type = METRIC_CONTENT_TYPE;
+        response->producer = Produce;
+        response->context = reinterpret_cast<void*>(static_cast<uintptr_t>(scrape->generation) << 8 | i);
+        return;
+    }
+
+    response->status = 503;
+    response->body_len = 0;
+}
+
+int METRIC_REGISTRY::Produce(void* context, uint32_t offset, char* buffer, size_t max_len) {
+    uintptr_t handle = reinterpret_cast<uintptr_t>(context);
+    size_t i = handle & 0xFF;
+    if (i >= METRIC_SCRAPES) return -1;
+
+    METRIC_SCRAPE_T* scrape = &scrapes[i];
+    if (!scrape->busy || scrape->generation != (handle >> 8) ||
+        scrape->offset != offset) {
+        return -1;
+    }
+    scrape->last_active = cyw43_hal_ticks_ms();
+
+    size_t len = 0;
+    while (len < max_len) {
+        if (scrape->line_sent == scrape->line_len && !Next(scrape)) break;
+
+        size_t take = scrape->line_len - scrape->line_sent;
+        if (take > max_len - len) take = max_len - len;
+        memcpy(buffer + len, scrape->line + scrape->line_sent, take);
+        scrape->line_sent += take;
+        len += take;
+    }
+
+    scrape->offset += len;
+    if (len == 0) scrape->busy = false;
+    return len;
+}
+
+bool METRIC_REGISTRY::Sample(const METRIC_T* metric, size_t i, METRIC_SAMPLE_T* sample) {
+    sample->series = metric->series;
+    sample->value = 0;
+    sample->histogram = nullptr;
+
+    if (metric->value != nullptr) {
+        sample->value = *metric->value;
+        return i == 0;
+    }
+    return metric->source(i, sample);
+}
+
+bool METRIC_REGISTRY::Line(METRIC_SCRAPE_T* scrape, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(scrape->line, sizeof(scrape->line), format, args);
+    va_end(args);
+
+    // Only a mistake in the registry makes a line this long, it is cut but still ends the line
+    if (len < 0) len = 0;
+    if ((size_t)len >= sizeof(scrape->line)) {
+        len = sizeof(scrape->line) - 1;
+        scrape->line[len - 1] = '\n';
+    }
+
+    scrape->line_len = len;
+    scrape->line_sent = 0;
+    return true;
+}
+
+bool METRIC_REGISTRY::Next(METRIC_SCRAPE_T* scrape) {
+    static const char* const TYPES[] = { "counter", "gauge", "histogram" };
+
+    while (scrape->metric < METRIC_COUNT) {
+        const METRIC_T* metric = &REGISTRY[scrape->metric];
+
+        // A family split over several entries is described once
+        if (!scrape->described) {
+            scrape->described = true;
+            if (scrape->metric == 0 || strcmp(REGISTRY[scrape->metric - 1].name, metric->name) != 0) {
+                return Line(scrape, "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s %s\n", metric->name,
+                    metric->help, metric->name, TYPES[metric->type]);
+            }
+        }
+
+        METRIC_SAMPLE_T sample;
+        if (!Sample(metric, scrape->series, &sample)) {
+            scrape->metric++;
+            scrape->series = 0;
+            scrape->row = 0;
+            scrape->described = false;
+            continue;
+        }
+
+        // Label values are routes and names from the tables above, none needs escaping
+        char pair[64] = "";
+        if (metric->label != nullptr) snprintf(pair, sizeof(pair), "%s=\"%s\"", metric->label, sample.series);
+
+        if (metric->type != METRIC_TYPE_HISTOGRAM) {
+            scrape->series++;
+            if (pair[0] == '\0') return Line(scrape, METRIC_PREFIX "%s %lu\n", metric->name, (unsigned long)sample.value);
+            return Line(scrape, METRIC_PREFIX "%s{%s} %lu\n", metric->name, pair, (unsigned long)sample.value);
+        }
+
+        // Copied at its first line, so the buckets, sum and count of one series agree
+        if (scrape->row == 0) {
+            memcpy(scrape->counts, sample.histogram->counts, sizeof(scrape->counts));
+            scrape->sum_us = sample.histogram->sum_us;
+        }
+
+        size_t row = scrape->row++;
+        const char* comma = pair[0] != '\0' ? "," : "";
+        if (row <= METRIC_BUCKETS) {
+            unsigned long count = 0;
+            for (size_t b = 0; b <= row; ++b) count += scrape->counts[b];
+
+            if (row == METRIC_BUCKETS) {
+                return Line(scrape, METRIC_PREFIX "%s_bucket{%s%sle=\"+Inf\"} %lu\n", metric->name, pair, comma, count);
+            }
+            uint32_t bound = METRIC_HISTOGRAM::Bound(row);
+            return Line(scrape, METRIC_PREFIX "%s_bucket{%s%sle=\"%lu.%06lu\"} %lu\n", metric->name, pair, comma,
+                (unsigned long)(bound / 1000000), (unsigned long)(bound % 1000000), count);
+        }
+
+        const char* open = pair[0] != '\0' ? "{" : "";
+        const char* close = pair[0] != '\0' ? "}" : "";
+        if (row == METRIC_BUCKETS + 1) {
+            return Line(scrape, METRIC_PREFIX "%s_sum%s%s%s %llu.%06lu\n", metric->name, open, pair, close,
+                (unsigned long long)(scrape->sum_us / 1000000), (unsigned long)(scrape->sum_us % 1000000));
+        }
+
+        unsigned long count = 0;
+        for (size_t b = 0; b <= METRIC_BUCKETS; ++b) count += scrape->counts[b];
+        scrape->series++;
+        scrape->row = 0;
+        return Line(scrape, METRIC_PREFIX "%s_count%s%s%s %lu\n", metric->name, open, pair, close, count);
+    }
+
+    return false;
+}
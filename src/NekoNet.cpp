@@ -30,16 +30,23 @@ int main() {
 
   TCP_SERVER tcp_server(SSID);
 
+  ip_addr_t gw;
   ip4_addr_t netMask;
-  IP4_ADDR(ip_2_ip4(&tcp_server.gw), 192, 168, 4, 1);
+  IP4_ADDR(ip_2_ip4(&gw), 192, 168, 4, 1);
   IP4_ADDR(ip_2_ip4(&netMask), 255, 255, 255, 0);
+  tcp_server.SetGateway(&gw);
 
   DHCP_SERVER dhcp_server(&tcp_server.gw, &netMask);
 
   DNS_SERVER dns_server(&tcp_server.gw);
+#ifdef NEKONET_DNS_UPSTREAM
+  ip_addr_t upstream;
+  if (ipaddr_aton(NEKONET_DNS_UPSTREAM, &upstream)) dns_server.SetUpstream(&upstream);
+#endif
 
   tcp_server.complete = false;
   while (tcp_server.complete == false) {
+    dhcp_server.Flush();
     Heartbeat(250);
   }
   tcp_server.~TCP_SERVER();
@@ -0,0 +1,92 @@
+/**
+ *@file Portal.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_PORTAL
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+// Any answer but the expected one makes an OS show the portal. A redirect
+// works for most, Apple's sheet shows the body, so it gets a page that loads the portal.
+#define PORTAL_REDIRECT "HTTP/1.1 302 Found\r\nLocation: http://%s" PORTAL_PATH "\r\nCache-Control: no-store\r\nContent-Length: 0\r\n"
+#define PORTAL_PAGE_BODY "<HTML><HEAD><TITLE>NekoNet</TITLE><META http-equiv=\"refresh\" content=\"0; url=http://%s" PORTAL_PATH "\"></HEAD><BODY>NekoNet</BODY></HTML>"
+#define PORTAL_PAGE "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nCache-Control: no-store\r\nContent-Length: %d\r\n"
+
+#include <cstdio>
+
+#include <Portal.hpp>
+
+#define PROBE(path, host, client) { path, host, client, HttpHash(HTTP_METHOD_GET, path) }
+
+/**
+ * @brief Known probes. Paths that are unlikely anywhere else match on any host,
+ * generic ones only on the probe host.
+ */
+static constexpr PORTAL_PROBE_T PROBES[] = {
+    PROBE("/generate_204",                  nullptr,                    PORTAL_ANDROID),
+    PROBE("/gen_204",                       nullptr,                    PORTAL_ANDROID),
+    PROBE("/hotspot-detect.html",           nullptr,                    PORTAL_APPLE),
+    PROBE("/library/test/success.html",     nullptr,                    PORTAL_APPLE),
+    PROBE("/connecttest.txt",               nullptr,                    PORTAL_WINDOWS),
+    PROBE("/ncsi.txt",                      nullptr,                    PORTAL_WINDOWS),
+    PROBE("/redirect",                      "www.msftconnecttest.com",  PORTAL_WINDOWS),
+    PROBE("/canonical.html",                "detectportal.firefox.com", PORTAL_FIREFOX),
+    PROBE("/success.txt",                   "detectportal.firefox.com", PORTAL_FIREFOX),
+};
+
+uint32_t PORTAL_PROBES::hits[PORTAL_CLIENT_COUNT];
+PORTAL_RESPONSE_T PORTAL_PROBES::responses[PORTAL_CLIENT_COUNT];
+
+static char page[PORTAL_RESPONSE_SIZE];
+
+void PORTAL_PROBES::Build(const ip_addr_t* address) {
+    const char* ip = ipaddr_ntoa(address);
+
+    int page_len = snprintf(page, sizeof(page), PORTAL_PAGE_BODY, ip);
+    if (page_len <= 0 || (size_t)page_len >= sizeof(page)) page_len = 0;
+
+    for (size_t i = 0; i < PORTAL_CLIENT_COUNT; ++i) {
+        PORTAL_RESPONSE_T* response = &responses[i];
+        bool with_page = i == PORTAL_APPLE && page_len > 0;
+
+        int len = with_page ? snprintf(response->header, sizeof(response->header), PORTAL_PAGE, page_len)
+            : snprintf(response->header, sizeof(response->header), PORTAL_REDIRECT, ip);
+        response->header_len = (len > 0 && (size_t)len < sizeof(response->header)) ? len : 0;
+        response->body = with_page ? page : nullptr;
+        response->body_len = with_page ? page_len : 0;
+    }
+}
+
+const PORTAL_PROBE_T* PORTAL_PROBES::Classify(const HTTP_PARSER& parser) {
+    const HTTP_REQUEST_T& request = parser.request;
+    if (request.method != HTTP_METHOD_GET) return nullptr;
+
+    for (const PORTAL_PROBE_T& probe : PROBES) {
+        if (probe.hash != request.path_hash || !parser.Equals(request.path, probe.path)) continue;
+
+        if (probe.host != nullptr) {
+            const HTTP_VIEW_T* host = parser.Header("Host");
+            if (host == nullptr || !parser.EqualsIgnoreCase(*host, probe.host)) continue;
+        }
+
+        DEBUG_WRITE("PORTAL: Probe %s\n", probe.path);
+        hits[probe.client]++;
+        return &probe;
+    }
+
+    return nullptr;
+}
+
+const PORTAL_RESPONSE_T* PORTAL_PROBES::Response(const PORTAL_PROBE_T* probe) {
+    const PORTAL_RESPONSE_T* response = &responses[probe->client];
+    return response->header_len > 0 ? response : nullptr;
+}
@@ -0,0 +1,96 @@
+/**
+ *@file Routes.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-04
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define HTTP_BODY "<html><body><h1>Hello from Pico W.</h1></body></html>"
+
+#define TEMPERATURE_SAMPLES     (8)
+#define TEMPERATURE_INTERVAL_MS (10)
+#define TEMPERATURE_ADC_INPUT   (4)
+
+#include <cstdio>
+
+#include <hardware/adc.h>
+
+#include <Metrics.hpp>
+#include <Routes.hpp>
+#include <TCP.hpp>
+
+static void Hello(const HTTP_PARSER& request, HTTP_RESPONSE_T* response) {
+    response->body_len = snprintf(response->body, response->body_max, HTTP_BODY);
+}
+
+static void Echo(void* client, const uint8_t* data, size_t len, bool text) {
+    TCP_SERVER::SendMessage(client, data, len, text);
+}
+
+static void Socket(const HTTP_PARSER& request, HTTP_RESPONSE_T* response) {
+    response->websocket = Echo;
+}
+
+static void Events(const HTTP_PARSER& request, HTTP_RESPONSE_T* response) {
+    response->event_stream = true;
+}
+
+static ASYNC_TASK Temperature(const HTTP_PARSER& request, HTTP_RESPONSE_T* response) {
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+    adc_select_input(TEMPERATURE_ADC_INPUT);
+
+    // Average samples spread over a few ticks, other clients are served in between
+    uint32_t sum = 0;
+    for (int i = 0; i < TEMPERATURE_SAMPLES; ++i) {
+        sum += adc_read();
+        co_await ASYNC_SLEEP(TEMPERATURE_INTERVAL_MS);
+    }
+
+    // 0.706 V at 27 C, falling 1.721 mV per degree
+    float volts = sum * 3.3f / (4096 * TEMPERATURE_SAMPLES);
+    float celsius = 27.0f - (volts - 0.706f) / 0.001721f;
+
+    response->content_type = "text/plain";
+    response->body_len = snprintf(response->body, response->body_max, "%.1f\n", celsius);
+}
+
+static void Metrics(const HTTP_PARSER& request, HTTP_RESPONSE_T* response) {
+    METRIC_REGISTRY::Start(response);
+}
+
+/**
+ * @brief Every endpoint, add new handlers here.
+ * Anything not listed falls through to the flash assets and then to the portal redirect.
+ */
+static constexpr ROUTE_T ROUTE_LIST[] = {
+    { HTTP_METHOD_GET, "/NekoNet", Hello },
+    { HTTP_METHOD_GET, "/ws", Socket },
+    { HTTP_METHOD_GET, "/events", Events },
+    { HTTP_METHOD_GET, "/temperature", nullptr, Temperature },
+    { HTTP_METHOD_GET, "/metrics", Metrics, nullptr, true },
+};
+
+static constexpr size_t ROUTE_COUNT = sizeof(ROUTE_LIST) / sizeof(ROUTE_LIST[0]);
+static constexpr ROUTE_TABLE<ROUTE_COUNT> table(ROUTE_LIST);
+static METRIC_HISTOGRAM timings[ROUTE_COUNT];
+
+const ROUTE_T* ROUTER::Find(const HTTP_PARSER& parser) {
+    return table.Find(parser);
+}
+
+size_t ROUTER::Count() {
+    return ROUTE_COUNT;
+}
+
+const ROUTE_T* ROUTER::At(size_t i) {
+    return &ROUTE_LIST[i];
+}
+
+METRIC_HISTOGRAM* ROUTER::Timing(const ROUTE_T* route) {
+    return &timings[route - ROUTE_LIST];
+}
@@ -17,55 +17,137 @@
 
 #define ERROR_WRITE printf
 
-#define POLL_TIME_S 5
-#define HTTP_GET "GET"
-#define HTTP_RESPONSE_HEADER "HTTP/1.1 %d OK\nContent-Length: %d\nContent-Type: text/html; charset=utf-8\nConnection: close\n\n"
-#define HTTP_RESPONSE_REDIRECT "HTTP/1.1 302 Redirect\nLocation: http://%s/NekoNet\n\n"
-#define HTTP_BODY "<html><body><h1>Hello from Pico W.</h1></body></html>"
+#define POLL_TIME_S 1
+#define HTTP_RESPONSE_REDIRECT "HTTP/1.1 302 Found\r\nLocation: http://%s" PORTAL_PATH "\r\n"
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+#define HTTP_RESPONSE_UPGRADE "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"
+#define HTTP_RESPONSE_UPGRADE_REQUIRED "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_RESPONSE_EVENTS "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-store\r\nConnection: keep-alive\r\n\r\nretry: 3000\n\n"
+#define HTTP_RESPONSE_UNAVAILABLE "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " TO_STRING(TCP_RETRY_AFTER_S) "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
 
 #include <cassert>
+#include <cstdlib>
+
+#ifdef NEKONET_DUAL_CORE
+#include <hardware/sync.h>
+#include <pico/flash.h>
+#include <pico/multicore.h>
+#endif
+
+#include <cyw43_config.h>
+#include <pico/stdlib.h>
 
 #include <lwipopts.h>
 #include <TCP.hpp>
 
+SLAB_POOL<TCP_CONNECT_STATE_T, TCP_MAX_CONNECTIONS> TCP_SERVER::connections;
+TCP_SERVER_STATS_T TCP_SERVER::stats;
+EVENT_RING TCP_SERVER::events;
+METRIC_HISTOGRAM TCP_SERVER::timings[TCP_TIMINGS];
+async_when_pending_worker_t TCP_SERVER::task_worker;
+tcp_pcb* TCP_SERVER::aborted;
+
+#ifdef NEKONET_DUAL_CORE
+SPSC_RING<TCP_WORK_T, TCP_WORK_QUEUE> TCP_SERVER::requests;
+SPSC_RING<TCP_WORK_T, TCP_WORK_QUEUE> TCP_SERVER::completions;
+async_when_pending_worker_t TCP_SERVER::completion_worker;
+async_context_t* TCP_SERVER::worker_context;
+#endif
+char TCP_SERVER::redirect[HTTP_HEADER_BLOCK_SIZE];
+size_t TCP_SERVER::redirect_len;
+
 err_t TCP_SERVER::Poll(void* arg, tcp_pcb* pcb) {
-    TCP_CONNECT_STATE_T* connection = reinterpret_cast<TCP_CONNECT_STATE_T*>(arg);
+    TCP_CONNECT_STATE_T* connection = connections.Resolve(arg);
+    if (connection == nullptr) return Abort(pcb);
     DEBUG_WRITE("TCP: Polling\n");
-    return CloseClient(connection, pcb, ERR_OK);
+
+    // WebSocket clients stay connected while quiet, pings find out whether they are still there
+    uint32_t now = cyw43_hal_ticks_ms();
+    if (connection->websocket != nullptr && !connection->closing) {
+        if (now - connection->last_active >= WS_IDLE_TIMEOUT_S * 1000) {
+            DEBUG_WRITE("TCP: WebSocket timeout\n");
+            stats.timeouts++;
+            return CloseClient(connection, pcb, ERR_OK);
+        }
+
+        if (now - connection->last_active >= WS_PING_INTERVAL_S * 1000 &&
+            now - connection->last_ping >= WS_PING_INTERVAL_S * 1000) {
+            connection->last_ping = now;
+            err_t err = SendFrame(connection, pcb, WS_OPCODE_PING, nullptr, 0);
+            if (err != ERR_OK && err != ERR_MEM) return err;
+        }
+        return ERR_OK;
+    }
+
+    // Event streams only talk one way, a comment now and then keeps quiet ones open
+    if (connection->event_stream && !connection->closing) {
+        if (now - connection->last_active >= EVENT_KEEPALIVE_S * 1000 &&
+            now - connection->last_ping >= EVENT_KEEPALIVE_S * 1000 &&
+            tcp_sndbuf(pcb) >= 3 && tcp_sndqueuelen(pcb) + 1 < TCP_SND_QUEUELEN) {
+            connection->last_ping = now;
+            const TCP_SPAN_T spans[] = { { ":\n\n", 3, TCP_SPAN_FLASH } };
+            err_t err = Write(connection, pcb, spans, 1, false);
+            if (err != ERR_OK) return err;
+        }
+        return SendEvents(connection, pcb);
+    }
+
+    // Nothing received or acknowledged for a while, a suspended task or a request on core 1 gets longer
+    uint32_t timeout_s = Streaming(connection) ? HTTP_RESPONSE_TIMEOUT_S : HTTP_KEEPALIVE_TIMEOUT_S;
+    if (now - connection->last_active >= timeout_s * 1000) {
+        DEBUG_WRITE("TCP: Idle timeout\n");
+        stats.timeouts++;
+        return CloseClient(connection, pcb, ERR_OK);
+    }
+
+    return ERR_OK;
 }
 
 err_t TCP_SERVER::Sent(void* arg, tcp_pcb* pcb, u16_t len) {
-    TCP_CONNECT_STATE_T* connection = reinterpret_cast<TCP_CONNECT_STATE_T*>(arg);
+    TCP_CONNECT_STATE_T* connection = connections.Resolve(arg);
+    if (connection == nullptr) return Abort(pcb);
 
     DEBUG_WRITE("TCP: Server Sent %u\n", len);
+    connection->last_active = cyw43_hal_ticks_ms();
 
-    connection->sent_len = len;
-    if (connection->sent_len >= connection->header_len + connection->result_len) {
-        DEBUG_WRITE("TCP: All Done\n");
-        return CloseClient(connection, pcb, ERR_OK);
+    if (Streaming(connection)) {
+        err_t err = SendBody(connection, pcb);
+        if (err != ERR_OK) return err;
     }
 
-    return ERR_OK;
+    if (connection->closing) {
+        if (!Streaming(connection) && tcp_sndqueuelen(pcb) == 0) {
+            DEBUG_WRITE("TCP: All Done\n");
+            return CloseClient(connection, pcb, ERR_OK);
+        }
+        return ERR_OK;
+    }
+
+    // Resume pipelined requests that were waiting for send buffer space
+    return Dispatch(connection, pcb);
 }
 
 err_t TCP_SERVER::Accept(void* arg, tcp_pcb* client_pcb, err_t err) {
-    TCP_SERVER* state = reinterpret_cast<TCP_SERVER*>(arg);
-
     if (err != ERR_OK || client_pcb == nullptr) {
         DEBUG_WRITE("TCP: Failure in accept\n");
         return ERR_VAL;
     }
     DEBUG_WRITE("TCP: Client Connected\n");
 
-    TCP_CONNECT_STATE_T* connection = reinterpret_cast<TCP_CONNECT_STATE_T*>(calloc(1, sizeof(TCP_CONNECT_STATE_T)));
+    // Make room by closing the least recently active idle connection, or turn the client away
+    TCP_CONNECT_STATE_T* connection = connections.Acquire();
+    if (connection == nullptr && Evict()) connection = connections.Acquire();
     if (connection == nullptr) {
-        DEBUG_WRITE("TCP: Failed to allocate connection state\n");
-        return ERR_MEM;
+        DEBUG_WRITE("TCP: No free connection slot (%u in use)\n", connections.Occupancy());
+        return Refuse(client_pcb);
     }
+    stats.accepts++;
     connection->pcb = client_pcb;
-    connection->gw = &state->gw;
+    connection->last_active = cyw43_hal_ticks_ms();
 
-    tcp_arg(client_pcb, connection);
+    tcp_setprio(client_pcb, TCP_PRIO_ACTIVE);
+    tcp_arg(client_pcb, connections.Handle(connection));
     tcp_sent(client_pcb, Sent);
     tcp_recv(client_pcb, Receive);
     tcp_poll(client_pcb, Poll, POLL_TIME_S * 2);
@@ -75,12 +157,16 @@ err_t TCP_SERVER::Accept(void* arg, tcp_pcb* client_pcb, err_t err) {
 }
 
 err_t TCP_SERVER::Receive(void* arg, tcp_pcb* pcb, pbuf* p, err_t err) {
-    TCP_CONNECT_STATE_T* connection = reinterpret_cast<TCP_CONNECT_STATE_T*>(arg);
+    TCP_CONNECT_STATE_T* connection = connections.Resolve(arg);
+    if (connection == nullptr) {
+        if (p != nullptr) pbuf_free(p);
+        return Abort(pcb);
+    }
     if (p == nullptr) {
         DEBUG_WRITE("TCP: Connection Closed\n");
         return CloseClient(connection, pcb, ERR_OK);
     }
-    assert(connection && connection->pcb == pcb);
+    assert(connection->pcb == pcb);
 
     if (p->tot_len > 0) {
         DEBUG_WRITE("TCP: Receive %d err %d\n", p->tot_len, err);
@@ -91,66 +177,734 @@ err_t TCP_SERVER::Receive(void* arg, tcp_pcb* pcb, pbuf* p, err_t err) {
         }
 #endif
 
-        // Copy request into buffer
-        pbuf_copy_partial(p, connection->header, p->tot_len > sizeof(connection->header) ? sizeof(connection->header) - 1 : p->tot_len, 0);
+        connection->last_active = cyw43_hal_ticks_ms();
+        tcp_setprio(pcb, TCP_PRIO_ACTIVE);
 
-        // Handle GET request
-        if (strncmp(HTTP_GET, connection->header, sizeof(HTTP_GET) - 1) == 0) {
-            char* request = connection->header + sizeof(HTTP_GET);
-            char* params = strchr(request, '?');
-            if (params != nullptr) {
-                DEBUG_WRITE("GET: %c", params);
-            }
+        // The last response is on its way and the connection closes after it,
+        // or the client is subscribed to events and has nothing more to say
+        if (connection->closing || connection->event_stream) {
+            tcp_recved(pcb, p->tot_len);
+            pbuf_free(p);
+            return ERR_OK;
+        }
 
-            // Generate content
-            connection->result_len = Content(request, params, connection->result, sizeof(connection->result));
-            DEBUG_WRITE("TCP Request: %s?%s\n", request, params);
-            DEBUG_WRITE("TCP Result: %d\n", connection->result);
+        // Acknowledged as the parsers release it, see Acknowledge
+        connection->unacked += p->tot_len;
 
-            // Check for buffer overflow
-            if (connection->result_len > sizeof(connection->result) - 1) {
-                DEBUG_WRITE("TCP: Too much result data %d\n", connection->result_len);
-                return CloseClient(connection, pcb, ERR_CLSD);
+#ifdef NEKONET_DUAL_CORE
+        // Core 1 is reading the buffered request, later data waits until it is done
+        if (connection->pending) {
+            if (connection->held == nullptr) {
+                connection->held = p;
+            } else {
+                pbuf_cat(connection->held, p);
             }
+            return ERR_OK;
+        }
+#endif
+
+        // The parser keeps the pbuf chain until the request is complete.
+        // p is ours from here on, so only an abort may be reported back to lwIP
+        if (connection->websocket != nullptr) {
+            connection->ws.Append(p);
+        } else {
+            connection->parser.Append(p);
+        }
+        return Dispatch(connection, pcb) == ERR_ABRT ? ERR_ABRT : ERR_OK;
+    }
+    pbuf_free(p);
+    return ERR_OK;
+}
 
-            //Generate webpage
-            if (connection->result_len > 0) {
-                connection->header_len = snprintf(connection->header, sizeof(connection->header), HTTP_RESPONSE_HEADER,
-                    200, connection->result_len);
-                if (connection->header_len > sizeof(connection->header) - 1) {
-                    DEBUG_WRITE("TCP: Too much header data %d\n", connection->header_len);
-                    return CloseClient(connection, pcb, ERR_CLSD);
+err_t TCP_SERVER::Dispatch(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    if (connection->websocket != nullptr) return WsDispatch(connection, pcb);
+    if (connection->event_stream) return SendEvents(connection, pcb);
+
+    // Answer buffered requests in the order they arrived
+    while (!connection->closing) {
+        // The previous response has to be fully queued first
+        if (Streaming(connection)) {
+            err_t err = SendBody(connection, pcb);
+            if (err != ERR_OK || Streaming(connection)) return err;
+        }
+
+        switch (connection->parser.Parse()) {
+            case HTTP_INCOMPLETE:
+                // Waiting for the next request, first in line if lwIP runs out of pcbs
+                if (!connection->parser.Buffered()) tcp_setprio(pcb, TCP_PRIO_IDLE);
+                return ERR_OK;
+            case HTTP_COMPLETE: {
+                // Wait for Sent if the largest possible response does not fit
+                if (tcp_sndbuf(pcb) < sizeof(connection->header) + sizeof(connection->result) ||
+                    tcp_sndqueuelen(pcb) + 2 > TCP_SND_QUEUELEN) {
+                    DEBUG_WRITE("TCP: Send buffer full, deferring request\n");
+                    return ERR_OK;
                 }
-            } else {
-                // Send redirect
-                connection->header_len = snprintf(connection->header, sizeof(connection->header), HTTP_RESPONSE_REDIRECT,
-                    ipaddr_ntoa(connection->gw));
-                DEBUG_WRITE("TCP: Sending redirect %s", connection->header);
-            }
 
-            // Send header to client
-            connection->sent_len = 0;
-            err_t err = tcp_write(pcb, connection->header, connection->header_len, 0);
-            if (err != ERR_OK) {
-                DEBUG_WRITE("TCP: Failed to write header data %d\n", err);
-                return CloseClient(connection, pcb, err);
+                connection->started = time_us_32();
+                connection->timing = nullptr;
+                err_t err = Respond(connection, pcb);
+                if (err != ERR_OK) return err;
+                // The handler is waiting on something, Finished carries on from here
+                if (connection->task.Valid()) return ERR_OK;
+#ifdef NEKONET_DUAL_CORE
+                // The handler runs on core 1, Completed carries on from here
+                if (connection->pending) return ERR_OK;
+#endif
+
+                Observe(connection);
+                NextRequest(connection);
+                if (connection->websocket != nullptr || connection->event_stream) return Dispatch(connection, pcb);
+                break;
             }
+            case HTTP_TOO_LARGE:
+                return Reject(connection, pcb, 431);
+            case HTTP_BODY_TOO_LARGE:
+                return Reject(connection, pcb, 413);
+            default:
+                return Reject(connection, pcb, 400);
+        }
+    }
+
+    return ERR_OK;
+}
+
+void TCP_SERVER::NextRequest(TCP_CONNECT_STATE_T* connection) {
+    connection->parser.Consume();
+
+    // Whatever follows the upgrade request is already WebSocket frames
+    if (connection->websocket != nullptr) {
+        struct pbuf* rest = connection->parser.Detach();
+        if (rest != nullptr) connection->ws.Append(rest);
+    }
+    if (connection->event_stream) connection->parser.Reset();
+    Acknowledge(connection);
+}
+
+void TCP_SERVER::Acknowledge(TCP_CONNECT_STATE_T* connection) {
+    uint16_t buffered = connection->parser.Size() + connection->ws.Size();
+#ifdef NEKONET_DUAL_CORE
+    if (connection->held != nullptr) buffered += connection->held->tot_len;
+#endif
+
+    if (connection->unacked > buffered) {
+        tcp_recved(connection->pcb, connection->unacked - buffered);
+        connection->unacked = buffered;
+    }
+}
+
+err_t TCP_SERVER::Respond(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    const HTTP_REQUEST_T& request = connection->parser.request;
+
+    // OS connectivity probes arrive in bursts as devices join, answer them before anything else
+    const PORTAL_PROBE_T* probe = PORTAL_PROBES::Classify(connection->parser);
+    if (probe != nullptr) {
+        const PORTAL_RESPONSE_T* response = PORTAL_PROBES::Response(probe);
+        if (response != nullptr) {
+            connection->timing = &timings[TCP_TIMING_PROBE];
+            return SendProbe(connection, pcb, response);
+        }
+    }
+
+    // Registered routes take any method, assets and the portal redirect are GET only
+    const ROUTE_T* route = ROUTER::Find(connection->parser);
+    if (route == nullptr && request.method != HTTP_METHOD_GET) {
+        connection->timing = &timings[TCP_TIMING_REJECT];
+        return Reject(connection, pcb, 405);
+    }
+
+    DEBUG_WRITE("TCP Request: path %u bytes, query %u bytes, %u headers\n",
+        request.path.length, request.query.length, request.header_count);
+
+    // Close once the response is acknowledged if either side wants to, or the request cap is hit
+    connection->requests++;
+    connection->closing = !request.keep_alive || connection->requests >= HTTP_KEEPALIVE_MAX_REQUESTS;
+
+    if (route == nullptr) {
+        const ASSET_T* asset = ASSET_STORE::Find(connection->parser, request.path);
+        if (asset != nullptr) {
+            connection->timing = &timings[TCP_TIMING_ASSET];
+            return SendAsset(connection, pcb, asset);
+        }
+    }
+
+    //Generate webpage
+    if (route != nullptr) {
+        connection->timing = ROUTER::Timing(route);
+        HTTP_RESPONSE_T response = { 200, ROUTE_CONTENT_TYPE_HTML, connection->result, sizeof(connection->result), 0,
+            nullptr, nullptr, HTTP_LENGTH_UNKNOWN, nullptr, false };
+        if (route->async != nullptr) return Await(connection, pcb, route, &response);
+#ifdef NEKONET_DUAL_CORE
+        if (!route->pinned && Offload(connection, route, &response)) return ERR_OK;
+#endif
+        route->handler(connection->parser, &response);
+        return Complete(connection, pcb, &response);
+    }
+
+    // Send redirect, built once the gateway address is known
+    if (redirect_len == 0) {
+        connection->timing = &timings[TCP_TIMING_REJECT];
+        return Reject(connection, pcb, 404);
+    }
+    connection->timing = &timings[TCP_TIMING_REDIRECT];
+
+    connection->result_len = 0;
+    connection->header_len = HTTP_HEADER_CACHE::Finish(connection->header, sizeof(connection->header), 0,
+        !connection->closing);
+    DEBUG_WRITE("TCP: Sending redirect %.*s", (int)redirect_len, redirect);
+
+    const TCP_SPAN_T spans[] = {
+        { redirect, (uint16_t)redirect_len, TCP_SPAN_STATIC },
+        { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION },
+    };
+    return Write(connection, pcb, spans, 2, false);
+}
+
+err_t TCP_SERVER::Await(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, const ROUTE_T* route,
+    const HTTP_RESPONSE_T* response) {
+    // The task outlives this call, so it fills the response kept with the connection
+    connection->response = *response;
+    connection->task = route->async(connection->parser, &connection->response);
+    if (!connection->task.Valid()) {
+        DEBUG_WRITE("TCP: No task frame free\n");
+        return Reject(connection, pcb, 503);
+    }
+
+    connection->task.Start(&task_worker);
+    return ERR_OK;
+}
+
+void TCP_SERVER::Finished(async_context_t* context, async_when_pending_worker_t* worker) {
+    for (size_t i = 0; i < connections.Capacity(); ++i) {
+        TCP_CONNECT_STATE_T* connection = connections.At(i);
+        if (connection == nullptr || !connection->task.Done()) continue;
+
+        connection->task.Destroy();
+        tcp_pcb* pcb = connection->pcb;
+        if (Complete(connection, pcb, &connection->response) != ERR_OK) continue;
+
+        Observe(connection);
+        NextRequest(connection);
+        Dispatch(connection, pcb);
+    }
+}
+
+err_t TCP_SERVER::Complete(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, const HTTP_RESPONSE_T* response) {
+    if (response->websocket != nullptr) return Upgrade(connection, pcb, response->websocket);
+    if (response->event_stream) return Subscribe(connection, pcb);
+    if (response->producer != nullptr) return SendStream(connection, pcb, response);
+
+    connection->result_len = response->body_len;
+    DEBUG_WRITE("TCP Result: %d %d\n", response->status, connection->result_len);
+
+    // Check for buffer overflow
+    if (connection->result_len > sizeof(connection->result) - 1) {
+        DEBUG_WRITE("TCP: Too much result data %d\n", connection->result_len);
+        return CloseClient(connection, pcb, ERR_CLSD);
+    }
+
+    return SendHeader(connection, pcb, response->status, response->content_type, connection->result_len,
+        connection->result, connection->result_len);
+}
+
+err_t TCP_SERVER::SendHeader(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, int status, const char* content_type,
+    int32_t content_length, const char* body, size_t body_len) {
+    bool more = body == nullptr && content_length != 0;
+
+    // Cached blocks never change once built, only the length and Connection lines are per response
+    const HTTP_HEADER_BLOCK_T* block = HTTP_HEADER_CACHE::Find(status, content_type);
+    if (block != nullptr) {
+        connection->header_len = HTTP_HEADER_CACHE::Finish(connection->header, sizeof(connection->header),
+            content_length, !connection->closing);
+    } else {
+        connection->header_len = HTTP_HEADER_CACHE::Build(connection->header, sizeof(connection->header),
+            status, content_type, content_length, !connection->closing);
+    }
+    if (connection->header_len == 0) {
+        DEBUG_WRITE("TCP: Too much header data\n");
+        return CloseClient(connection, pcb, ERR_CLSD);
+    }
+
+    // Body copied so the buffers are free for the next pipelined request
+    TCP_SPAN_T spans[3];
+    size_t count = 0;
+    if (block != nullptr) spans[count++] = { block->data, block->length, TCP_SPAN_STATIC };
+    spans[count++] = { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION };
+    if (body_len > 0) spans[count++] = { body, (uint16_t)body_len, TCP_SPAN_CONNECTION };
+
+    return Write(connection, pcb, spans, count, more);
+}
+
+err_t TCP_SERVER::SendAsset(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, const ASSET_T* asset) {
+    const HTTP_PARSER& parser = connection->parser;
+
+    // Every asset header is prebuilt in flash, only the Connection line is added
+    connection->header_len = HTTP_HEADER_CACHE::Finish(connection->header, sizeof(connection->header),
+        HTTP_LENGTH_UNKNOWN, !connection->closing);
+
+    // The variant decides the ETag a revalidation has to match
+    const HTTP_VIEW_T* accept_encoding = parser.Header("Accept-Encoding");
+    bool gzip = asset->gzip_data != nullptr && accept_encoding != nullptr && parser.HasToken(*accept_encoding, "gzip");
+    const char* etag = gzip ? asset->gzip_etag : asset->etag;
+
+    // Answer revalidation of an unchanged asset without a body
+    const HTTP_VIEW_T* none_match = parser.Header("If-None-Match");
+    if (none_match != nullptr) {
+        char weak[32] = "W/";
+        strncat(weak, etag, sizeof(weak) - 3);
+
+        if (parser.HasEntityTag(*none_match, etag) || parser.HasEntityTag(*none_match, weak) ||
+            parser.Equals(*none_match, "*")) {
+            DEBUG_WRITE("TCP: %s not modified\n", asset->path);
+
+            const TCP_SPAN_T spans[] = {
+                { gzip ? asset->gzip_not_modified : asset->not_modified,
+                    gzip ? asset->gzip_not_modified_length : asset->not_modified_length, TCP_SPAN_FLASH },
+                { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION },
+            };
+            return Write(connection, pcb, spans, 2, false);
+        }
+    }
+
+    connection->body = gzip ? asset->gzip_data : asset->data;
+    connection->body_left = gzip ? asset->gzip_length : asset->length;
+    DEBUG_WRITE("TCP: Sending %s, %lu bytes%s\n", asset->path, (unsigned long)connection->body_left, gzip ? " gzip" : "");
+
+    const TCP_SPAN_T spans[] = {
+        { gzip ? asset->gzip_header : asset->header, gzip ? asset->gzip_header_length : asset->header_length,
+            TCP_SPAN_FLASH },
+        { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION },
+    };
+    err_t err = Write(connection, pcb, spans, 2, connection->body_left > 0);
+    if (err != ERR_OK) return err;
+
+    return SendBody(connection, pcb);
+}
+
+err_t TCP_SERVER::SendStream(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, const HTTP_RESPONSE_T* response) {
+    // Without a length HTTP/1.0 clients can only tell the end of the body by the connection closing
+    bool chunked = response->content_length == HTTP_LENGTH_UNKNOWN && connection->parser.request.version_minor >= 1;
+    if (response->content_length == HTTP_LENGTH_UNKNOWN && !chunked) connection->closing = true;
+
+    err_t err = SendHeader(connection, pcb, response->status, response->content_type,
+        chunked ? HTTP_LENGTH_CHUNKED : response->content_length, nullptr, 0);
+    if (err != ERR_OK) return err;
+
+    connection->producer = response->producer;
+    connection->producer_context = response->context;
+    connection->produced = 0;
+    connection->produce_left = chunked ? HTTP_LENGTH_UNKNOWN : response->content_length;
+    connection->chunked = chunked;
+
+    return SendBody(connection, pcb);
+}
+
+err_t TCP_SERVER::SendProbe(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, const PORTAL_RESPONSE_T* response) {
+    connection->requests++;
+    connection->closing = !connection->parser.request.keep_alive || connection->requests >= HTTP_KEEPALIVE_MAX_REQUESTS;
+    connection->result_len = 0;
+
+    connection->header_len = HTTP_HEADER_CACHE::Finish(connection->header, sizeof(connection->header),
+        HTTP_LENGTH_UNKNOWN, !connection->closing);
+
+    // The canned response lives as long as the program
+    const TCP_SPAN_T spans[] = {
+        { response->header, (uint16_t)response->header_len, TCP_SPAN_STATIC },
+        { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION },
+        { response->body, (uint16_t)response->body_len, TCP_SPAN_STATIC },
+    };
+    return Write(connection, pcb, spans, 3, false);
+}
+
+err_t TCP_SERVER::Write(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, const TCP_SPAN_T* spans, size_t count,
+    bool more) {
+    // Queue all of it or nothing, a response cut short cannot be recovered
+    size_t total = 0;
+    size_t segments = 0;
+    uint16_t mss = LWIP_MAX(tcp_mss(pcb), 1);
+    for (size_t i = 0; i < count; ++i) {
+        total += spans[i].length;
+        segments += spans[i].length / mss + 1;
+    }
+    if (total > tcp_sndbuf(pcb) || tcp_sndqueuelen(pcb) + segments > TCP_SND_QUEUELEN) {
+        DEBUG_WRITE("TCP: No room for %u bytes\n", (unsigned)total);
+        return CloseClient(connection, pcb, ERR_MEM);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const TCP_SPAN_T& span = spans[i];
+        if (span.length == 0) continue;
+
+        // lwIP fills the last unsent segment up to the MSS before starting another,
+        // so spans written back to back share segments. Short spans are copied into
+        // the segment instead of each taking a pbuf and a queue entry.
+        bool reference = (span.lifetime == TCP_SPAN_FLASH || span.lifetime == TCP_SPAN_STATIC) &&
+            span.length >= TCP_SPAN_COPY_BELOW;
+        u8_t flags = reference ? 0 : TCP_WRITE_FLAG_COPY;
+        if (more || i + 1 < count) flags |= TCP_WRITE_FLAG_MORE;
+
+        err_t err = tcp_write(pcb, span.data, span.length, flags);
+        if (err != ERR_OK) {
+            DEBUG_WRITE("TCP: Failed to write %u bytes %d\n", span.length, err);
+            return CloseClient(connection, pcb, err);
+        }
+    }
+
+    // One flush once the response is queued
+    if (!more) tcp_output(pcb);
+    return ERR_OK;
+}
+
+err_t TCP_SERVER::Upgrade(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, WS_HANDLER handler) {
+    const HTTP_PARSER& parser = connection->parser;
+    const HTTP_REQUEST_T& request = parser.request;
+
+    const HTTP_VIEW_T* upgrade = parser.Header("Upgrade");
+    const HTTP_VIEW_T* key = parser.Header("Sec-WebSocket-Key");
+    if (request.version_minor < 1 || (request.connection & HTTP_CONNECTION_UPGRADE) == 0 || upgrade == nullptr ||
+        !parser.HasToken(*upgrade, "websocket") || key == nullptr || key->length != WS_KEY_LENGTH) {
+        return Reject(connection, pcb, 400);
+    }
+
+    const HTTP_VIEW_T* version = parser.Header("Sec-WebSocket-Version");
+    if (version == nullptr || !parser.Equals(*version, "13")) {
+        connection->closing = true;
+        const TCP_SPAN_T spans[] = {
+            { HTTP_RESPONSE_UPGRADE_REQUIRED, sizeof(HTTP_RESPONSE_UPGRADE_REQUIRED) - 1, TCP_SPAN_FLASH },
+        };
+        return Write(connection, pcb, spans, 1, false);
+    }
+
+    char key_text[WS_KEY_LENGTH + 1];
+    char accept[WS_ACCEPT_LENGTH + 1];
+    parser.Copy(*key, key_text, sizeof(key_text));
+    if (!WsAccept(key_text, WS_KEY_LENGTH, accept)) return Reject(connection, pcb, 400);
+
+    // Only once per connection, so formatting is not worth caching
+    connection->header_len = snprintf(connection->header, sizeof(connection->header), HTTP_RESPONSE_UPGRADE, accept);
+
+    const TCP_SPAN_T spans[] = {
+        { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION },
+    };
+    err_t err = Write(connection, pcb, spans, 1, false);
+    if (err != ERR_OK) return err;
 
-            // Send body to client
-            if (connection->result_len > 0) {
-                err_t err = tcp_write(pcb, connection->result, connection->result_len, 0);
-                if (err != ERR_OK) {
-                    DEBUG_WRITE("TCP: Failed to write result data %d\n", err);
-                    return CloseClient(connection, pcb, err);
+    DEBUG_WRITE("TCP: Upgraded to WebSocket\n");
+    stats.upgrades++;
+    connection->websocket = handler;
+    connection->closing = false;
+    connection->last_ping = cyw43_hal_ticks_ms();
+    return ERR_OK;
+}
+
+err_t TCP_SERVER::WsDispatch(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    WS_PARSER& ws = connection->ws;
+    uint8_t* message = reinterpret_cast<uint8_t*>(connection->result);
+    void* handle = connections.Handle(connection);
+
+    while (!connection->closing) {
+        // Leave frames buffered until a pong or close reply is sure to fit, Sent resumes
+        if (tcp_sndbuf(pcb) < WS_MAX_HEADER + WS_MAX_CONTROL || tcp_sndqueuelen(pcb) + 3 > TCP_SND_QUEUELEN) {
+            return ERR_OK;
+        }
+
+        WS_STATUS status = ws.Parse(message, sizeof(connection->result));
+        Acknowledge(connection);
+
+        switch (status) {
+            case WS_INCOMPLETE:
+                if (!ws.Buffered()) tcp_setprio(pcb, TCP_PRIO_IDLE);
+                return ERR_OK;
+            case WS_MESSAGE:
+                aborted = nullptr;
+                connection->websocket(handle, message, ws.length, ws.opcode == WS_OPCODE_TEXT);
+
+                // A failed reply from the handler may have closed the connection, lwIP only
+                // has to stop touching the pcb if it was aborted rather than closed
+                if (connections.Resolve(handle) == nullptr) return aborted == pcb ? ERR_ABRT : ERR_OK;
+                break;
+            case WS_CONTROL:
+                if (ws.opcode == WS_OPCODE_PING) {
+                    err_t err = SendFrame(connection, pcb, WS_OPCODE_PONG, ws.control, ws.length);
+                    if (err != ERR_OK) return err;
+                } else if (ws.opcode == WS_OPCODE_CLOSE) {
+                    // Echo the client's status code and close once it is acknowledged
+                    uint16_t code = ws.length >= 2 ? ws.control[0] << 8 | ws.control[1] : WS_CLOSE_NORMAL;
+                    return WsClose(connection, pcb, code);
                 }
+                break;
+            case WS_TOO_LARGE:
+                return WsClose(connection, pcb, WS_CLOSE_TOO_LARGE);
+            default:
+                return WsClose(connection, pcb, WS_CLOSE_PROTOCOL_ERROR);
+        }
+    }
+
+    return ERR_OK;
+}
+
+err_t TCP_SERVER::WsClose(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, uint16_t code) {
+    DEBUG_WRITE("TCP: WebSocket close %u\n", code);
+
+    uint8_t payload[2] = { (uint8_t)(code >> 8), (uint8_t)code };
+    connection->closing = true;
+    connection->ws.Reset();
+
+    err_t err = SendFrame(connection, pcb, WS_OPCODE_CLOSE, payload, sizeof(payload));
+    return err == ERR_MEM ? CloseClient(connection, pcb, ERR_OK) : err;
+}
+
+err_t TCP_SERVER::SendFrame(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, uint8_t opcode, const void* data,
+    size_t len) {
+    if (len > 0xFFFF || len + WS_MAX_HEADER > tcp_sndbuf(pcb) ||
+        tcp_sndqueuelen(pcb) + len / tcp_mss(pcb) + 2 > TCP_SND_QUEUELEN) {
+        return ERR_MEM;
+    }
+
+    uint8_t header[WS_MAX_HEADER];
+    const TCP_SPAN_T spans[] = {
+        { header, (uint16_t)WsFrameHeader(header, opcode, len), TCP_SPAN_TRANSIENT },
+        { data, (uint16_t)len, TCP_SPAN_TRANSIENT },
+    };
+    return Write(connection, pcb, spans, 2, false);
+}
+
+err_t TCP_SERVER::SendMessage(void* client, const void* data, size_t len, bool text) {
+    cyw43_arch_lwip_begin();
+
+    err_t err = ERR_CLSD;
+    TCP_CONNECT_STATE_T* connection = connections.Resolve(client);
+    if (connection != nullptr && connection->websocket != nullptr && !connection->closing) {
+        err = SendFrame(connection, connection->pcb, text ? WS_OPCODE_TEXT : WS_OPCODE_BINARY, data, len);
+        if (err != ERR_OK) stats.ws_dropped++;
+    }
+
+    cyw43_arch_lwip_end();
+    return err;
+}
+
+size_t TCP_SERVER::Broadcast(const void* data, size_t len, bool text) {
+    cyw43_arch_lwip_begin();
+
+    size_t sent = 0;
+    for (size_t i = 0; i < connections.Capacity(); ++i) {
+        TCP_CONNECT_STATE_T* connection = connections.At(i);
+        if (connection == nullptr || connection->websocket == nullptr || connection->closing) continue;
+
+        // Frames go out whole or not at all, a slow client misses this one
+        if (SendFrame(connection, connection->pcb, text ? WS_OPCODE_TEXT : WS_OPCODE_BINARY, data, len) == ERR_OK) {
+            sent++;
+        } else {
+            stats.ws_dropped++;
+        }
+    }
+
+    cyw43_arch_lwip_end();
+    return sent;
+}
+
+err_t TCP_SERVER::Subscribe(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    const HTTP_PARSER& parser = connection->parser;
+
+    // A reconnecting client picks up after the last event it saw, a new one gets only new events
+    uint32_t cursor = events.Next();
+    const HTTP_VIEW_T* last_event = parser.Header("Last-Event-ID");
+    if (last_event != nullptr) {
+        char text[12];
+        char* end = nullptr;
+        parser.Copy(*last_event, text, sizeof(text));
+        unsigned long id = strtoul(text, &end, 10);
+        if (end != text && *end == '\0' && id < events.Next()) cursor = id + 1;
+    }
+
+    const TCP_SPAN_T spans[] = {
+        { HTTP_RESPONSE_EVENTS, sizeof(HTTP_RESPONSE_EVENTS) - 1, TCP_SPAN_FLASH },
+    };
+    err_t err = Write(connection, pcb, spans, 1, true);
+    if (err != ERR_OK) return err;
+
+    DEBUG_WRITE("TCP: Event stream from %lu\n", (unsigned long)cursor);
+    stats.subscriptions++;
+    connection->event_stream = true;
+    connection->event_cursor = cursor;
+    connection->closing = false;
+    connection->last_ping = cyw43_hal_ticks_ms();
+
+    return SendEvents(connection, pcb);
+}
+
+err_t TCP_SERVER::SendEvents(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    bool queued = false;
+
+    while (connection->event_cursor < events.Next()) {
+        // The ring moved on past this client, tell it how much it missed and carry on from the oldest
+        if (connection->event_cursor < events.First()) {
+            connection->header_len = events.Gap(connection->header, sizeof(connection->header), connection->event_cursor);
+            if ((size_t)connection->header_len > tcp_sndbuf(pcb) || tcp_sndqueuelen(pcb) + 1 >= TCP_SND_QUEUELEN) break;
+
+            const TCP_SPAN_T spans[] = {
+                { connection->header, (uint16_t)connection->header_len, TCP_SPAN_CONNECTION },
+            };
+            err_t err = Write(connection, pcb, spans, 1, true);
+            if (err != ERR_OK) return err;
+
+            stats.event_gaps++;
+            connection->event_cursor = events.First();
+            queued = true;
+            continue;
+        }
+
+        // Events go out whole, the ring may overwrite them before a partial one is finished
+        const char* first;
+        const char* second;
+        size_t first_len, second_len;
+        events.Read(connection->event_cursor, &first, &first_len, &second, &second_len);
+        if (first_len + second_len > tcp_sndbuf(pcb) || tcp_sndqueuelen(pcb) + 2 >= TCP_SND_QUEUELEN) break;
+
+        const TCP_SPAN_T spans[] = {
+            { first, (uint16_t)first_len, TCP_SPAN_TRANSIENT },
+            { second, (uint16_t)second_len, TCP_SPAN_TRANSIENT },
+        };
+        err_t err = Write(connection, pcb, spans, 2, true);
+        if (err != ERR_OK) return err;
+
+        connection->event_cursor++;
+        queued = true;
+    }
+
+    if (queued) tcp_output(pcb);
+    return ERR_OK;
+}
+
+uint32_t TCP_SERVER::Publish(const char* name, const char* data, size_t len) {
+    cyw43_arch_lwip_begin();
+
+    uint32_t id = events.Publish(name, data, len);
+    if (id != 0) {
+        for (size_t i = 0; i < connections.Capacity(); ++i) {
+            TCP_CONNECT_STATE_T* connection = connections.At(i);
+            if (connection == nullptr || !connection->event_stream || connection->closing) continue;
+
+            SendEvents(connection, connection->pcb);
+        }
+    }
+
+    cyw43_arch_lwip_end();
+    return id;
+}
+
+bool TCP_SERVER::Streaming(const TCP_CONNECT_STATE_T* connection) {
+#ifdef NEKONET_DUAL_CORE
+    // A response still being built on core 1 holds up the connection like a body being sent
+    if (connection->pending) return true;
+#endif
+    return connection->body_left > 0 || connection->producer != nullptr || connection->task.Valid();
+}
+
+err_t TCP_SERVER::SendBody(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    if (connection->producer != nullptr) return Produce(connection, pcb);
+
+    // Queue as much as the send buffer takes, Sent picks up the rest
+    bool queued = false;
+    while (connection->body_left > 0) {
+        uint32_t len = LWIP_MIN(connection->body_left, tcp_sndbuf(pcb));
+        if (len == 0 || tcp_sndqueuelen(pcb) + len / tcp_mss(pcb) + 1 > TCP_SND_QUEUELEN) break;
+
+        // Flash does not change, so lwIP can reference it instead of copying
+        err_t err = tcp_write(pcb, connection->body, len, len < connection->body_left ? TCP_WRITE_FLAG_MORE : 0);
+        if (err == ERR_MEM) break;
+        if (err != ERR_OK) {
+            DEBUG_WRITE("TCP: Failed to write body data %d\n", err);
+            return CloseClient(connection, pcb, err);
+        }
+
+        connection->body += len;
+        connection->body_left -= len;
+        queued = true;
+    }
+
+    if (queued) tcp_output(pcb);
+    return ERR_OK;
+}
+
+err_t TCP_SERVER::Produce(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb) {
+    // Room for the chunk size line and the CRLF after the chunk
+    const size_t overhead = connection->chunked ? 8 : 0;
+
+    // Pull one buffer at a time while the send buffer has room, Sent calls back for the rest
+    bool queued = false;
+    while (connection->producer != nullptr) {
+        size_t space = LWIP_MIN(tcp_sndbuf(pcb), sizeof(connection->result) + overhead);
+        if (space <= overhead || tcp_sndqueuelen(pcb) + 3 > TCP_SND_QUEUELEN) break;
+
+        size_t max_len = space - overhead;
+        if (connection->produce_left != HTTP_LENGTH_UNKNOWN) max_len = LWIP_MIN(max_len, (size_t)connection->produce_left);
+
+        int len = 0;
+        if (max_len > 0) {
+            len = connection->producer(connection->producer_context, connection->produced, connection->result, max_len);
+        }
+        if (len < 0 || (size_t)len > max_len) {
+            DEBUG_WRITE("TCP: Producer failed %d\n", len);
+            return CloseClient(connection, pcb, ERR_VAL);
+        }
+
+        if (len == 0) {
+            // End of body
+            connection->producer = nullptr;
+            if (connection->chunked) {
+                const TCP_SPAN_T last[] = { { "0\r\n\r\n", 5, TCP_SPAN_FLASH } };
+                return Write(connection, pcb, last, 1, false);
+            }
+            if (connection->produce_left > 0) {
+                // Fewer bytes than announced, only closing tells the client
+                DEBUG_WRITE("TCP: Producer ended %ld bytes short\n", (long)connection->produce_left);
+                connection->closing = true;
             }
+            break;
         }
-        tcp_recved(pcb, p->tot_len);
+
+        // Hex chunk size, a chunk never exceeds the result buffer
+        char size[8];
+        int size_len = 0;
+        if (connection->chunked) {
+            for (int shift = 12; shift >= 0; shift -= 4) {
+                int digit = (len >> shift) & 0xF;
+                if (digit != 0 || size_len > 0 || shift == 0) size[size_len++] = "0123456789abcdef"[digit];
+            }
+            size[size_len++] = '\r';
+            size[size_len++] = '\n';
+        }
+
+        const TCP_SPAN_T spans[] = {
+            { size, (uint16_t)size_len, TCP_SPAN_TRANSIENT },
+            { connection->result, (uint16_t)len, TCP_SPAN_CONNECTION },
+            { "\r\n", (uint16_t)(connection->chunked ? 2 : 0), TCP_SPAN_FLASH },
+        };
+        err_t err = Write(connection, pcb, spans, 3, true);
+        if (err != ERR_OK) return err;
+
+        connection->produced += len;
+        if (connection->produce_left != HTTP_LENGTH_UNKNOWN) connection->produce_left -= len;
+        queued = true;
     }
-    pbuf_free(p);
+
+    if (queued) tcp_output(pcb);
     return ERR_OK;
 }
 
+err_t TCP_SERVER::Reject(TCP_CONNECT_STATE_T* connection, tcp_pcb* pcb, int status) {
+    DEBUG_WRITE("TCP: Rejecting request %d %s\n", status, HttpReason(status));
+
+    connection->closing = true;
+    connection->result_len = 0;
+    return SendHeader(connection, pcb, status, nullptr, 0, nullptr, 0);
+}
+
+void TCP_SERVER::Observe(TCP_CONNECT_STATE_T* connection) {
+    if (connection->timing != nullptr) connection->timing->Observe(time_us_32() - connection->started);
+}
+
 err_t TCP_SERVER::CloseClient(TCP_CONNECT_STATE_T* con_state, tcp_pcb* client_pcb, err_t close_err) {
     if (client_pcb != nullptr) {
         assert(con_state != NULL && con_state->pcb == client_pcb);
@@ -159,34 +913,97 @@ err_t TCP_SERVER::CloseClient(TCP_CONNECT_STATE_T* con_state, tcp_pcb* client_pc
         tcp_sent(client_pcb, NULL);
         tcp_recv(client_pcb, NULL);
         tcp_err(client_pcb, NULL);
+        tcp_setprio(client_pcb, TCP_PRIO_IDLE);
 
         err_t err = tcp_close(client_pcb);
         if (err != ERR_OK) {
             DEBUG_WRITE("TCP: Close failed %d, calling abort\n", err);
             tcp_abort(client_pcb);
+            aborted = client_pcb;
             close_err = ERR_ABRT;
         }
 
         if (con_state != nullptr) {
-            free(con_state);
+            Release(con_state);
         }
     }
 
     return close_err;
 }
 
-void TCP_SERVER::Error(void* arg, err_t err) {
-    if (err == ERR_ABRT) return;
+err_t TCP_SERVER::Abort(tcp_pcb* pcb) {
+    DEBUG_WRITE("TCP: Stale connection handle, aborting\n");
 
-    DEBUG_WRITE("TCP: Client Error %d\n", err);
+    tcp_arg(pcb, NULL);
+    tcp_err(pcb, NULL);
+    tcp_abort(pcb);
+    return ERR_ABRT;
+}
+
+err_t TCP_SERVER::Refuse(tcp_pcb* pcb) {
+    stats.rejections++;
+    tcp_setprio(pcb, TCP_PRIO_IDLE);
+
+    // Answer and stop sending, lwIP discards the request and closes once the client does
+    err_t err = tcp_write(pcb, HTTP_RESPONSE_UNAVAILABLE, sizeof(HTTP_RESPONSE_UNAVAILABLE) - 1, 0);
+    if (err == ERR_OK) err = tcp_shutdown(pcb, 0, 1);
+    if (err != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
 
-    TCP_CONNECT_STATE_T* con_state = reinterpret_cast<TCP_CONNECT_STATE_T*>(arg);
-    CloseClient(con_state, con_state->pcb, err);
+    return ERR_OK;
 }
 
-int TCP_SERVER::Content(const char* request, const char* params, char* result, size_t max_result_len) {
-    int len = snprintf(result, max_result_len, HTTP_BODY);
-    return len;
+bool TCP_SERVER::Evict() {
+    TCP_CONNECT_STATE_T* oldest = nullptr;
+    uint32_t now = cyw43_hal_ticks_ms();
+
+    for (size_t i = 0; i < connections.Capacity(); ++i) {
+        TCP_CONNECT_STATE_T* connection = connections.At(i);
+        if (connection == nullptr || connection->closing || Streaming(connection) || connection->parser.Buffered() ||
+            connection->ws.Buffered()) continue;
+        // WebSocket and event stream clients are quiet by design, they are not idle
+        if (connection->websocket != nullptr || connection->event_stream) continue;
+
+        if (oldest == nullptr || now - connection->last_active > now - oldest->last_active) oldest = connection;
+    }
+    if (oldest == nullptr) return false;
+
+    DEBUG_WRITE("TCP: Evicting connection idle for %lu ms\n", (unsigned long)(now - oldest->last_active));
+    stats.evictions++;
+    CloseClient(oldest, oldest->pcb, ERR_OK);
+    return true;
+}
+
+void TCP_SERVER::Release(TCP_CONNECT_STATE_T* con_state) {
+#ifdef NEKONET_DUAL_CORE
+    // Core 1 may still be reading the request, the slot is freed once its response comes back
+    if (con_state->pending) {
+        con_state->orphaned = true;
+        con_state->pcb = nullptr;
+        return;
+    }
+    if (con_state->held != nullptr) pbuf_free(con_state->held);
+#endif
+    // A task still waiting is dropped, its awaiters cancel their timers
+    con_state->task.Destroy();
+    con_state->parser.Reset();
+    con_state->ws.Reset();
+    connections.Release(con_state);
+}
+
+void TCP_SERVER::Error(void* arg, err_t err) {
+    DEBUG_WRITE("TCP: Client Error %d\n", err);
+
+    // lwIP has already freed the pcb, a late callback for a released slot resolves to NULL
+    TCP_CONNECT_STATE_T* con_state = connections.Resolve(arg);
+    if (con_state == nullptr) return;
+
+    // Reset by the client, or aborted by lwIP itself when it ran short of pcbs
+    stats.aborts++;
+
+    Release(con_state);
 }
 
 TCP_SERVER::TCP_SERVER(const char* ap_name) {
@@ -204,7 +1021,7 @@ TCP_SERVER::TCP_SERVER(const char* ap_name) {
         assert(false);
     }
 
-    server_pcb = tcp_listen_with_backlog(pcb, 1);
+    server_pcb = tcp_listen_with_backlog(pcb, TCP_SERVER_BACKLOG);
     if (server_pcb == nullptr) {
         ERROR_WRITE("TCP: Failed to listen\n");
         if (pcb != nullptr) tcp_close(pcb);
@@ -214,9 +1031,92 @@ TCP_SERVER::TCP_SERVER(const char* ap_name) {
     tcp_arg(server_pcb, this);
     tcp_accept(server_pcb, Accept);
 
+    // Asynchronous handlers are resumed on the same context as lwIP
+    context = cyw43_arch_async_context();
+    ASYNC_TASK::Attach(context);
+    task_worker.do_work = Finished;
+    async_context_add_when_pending_worker(context, &task_worker);
+
+#ifdef NEKONET_DUAL_CORE
+    worker_context = context;
+    completion_worker.do_work = Completed;
+    async_context_add_when_pending_worker(context, &completion_worker);
+    multicore_launch_core1(Worker);
+#endif
+
     DEBUG_WRITE("Try connecting to '%s'\n", ap_name);
 }
 
+void TCP_SERVER::SetGateway(const ip_addr_t* address) {
+    ip_addr_copy(gw, *address);
+
+    // The portal address never changes after startup, so the redirect is formatted here once
+    int len = snprintf(redirect, sizeof(redirect), HTTP_RESPONSE_REDIRECT, ipaddr_ntoa(&gw));
+    redirect_len = (len > 0 && (size_t)len < sizeof(redirect)) ? len : 0;
+
+    PORTAL_PROBES::Build(&gw);
+}
+
+#ifdef NEKONET_DUAL_CORE
+bool TCP_SERVER::Offload(TCP_CONNECT_STATE_T* connection, const ROUTE_T* route, const HTTP_RESPONSE_T* response) {
+    TCP_WORK_T work = { connection, route, *response };
+    if (!requests.Push(work)) {
+        DEBUG_WRITE("TCP: Worker queue full, handling on core 0\n");
+        return false;
+    }
+
+    connection->pending = true;
+    __sev();
+    return true;
+}
+
+void TCP_SERVER::Worker() {
+    // Let core 0 park this core while it erases or programs flash
+    flash_safe_execute_core_init();
+
+    // Core 1 runs handlers only, it never touches lwIP
+    while (true) {
+        TCP_WORK_T work;
+        if (!requests.Pop(&work)) {
+            __wfe();
+            continue;
+        }
+
+        work.route->handler(work.connection->parser, &work.response);
+
+        // One request per connection is in flight, so there is always room
+        while (!completions.Push(work)) tight_loop_contents();
+        async_context_set_work_pending(worker_context, &completion_worker);
+    }
+}
+
+void TCP_SERVER::Completed(async_context_t* context, async_when_pending_worker_t* worker) {
+    TCP_WORK_T work;
+    while (completions.Pop(&work)) {
+        TCP_CONNECT_STATE_T* connection = work.connection;
+        connection->pending = false;
+
+        // Closed while the handler ran
+        if (connection->orphaned) {
+            Release(connection);
+            continue;
+        }
+
+        tcp_pcb* pcb = connection->pcb;
+        if (Complete(connection, pcb, &work.response) != ERR_OK) continue;
+        Observe(connection);
+
+        // Data that arrived meanwhile follows the request that was answered
+        if (connection->held != nullptr) {
+            connection->parser.Append(connection->held);
+            connection->held = nullptr;
+        }
+        NextRequest(connection);
+        Dispatch(connection, pcb);
+    }
+}
+#endif
+
 TCP_SERVER::~TCP_SERVER() {
     if (server_pcb == nullptr) return;
 
@@ -0,0 +1,98 @@
+/**
+ *@file Task.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_TASK
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <Task.hpp>
+
+async_context_t* ASYNC_TASK::context;
+TASK_STATS_T ASYNC_TASK::stats;
+SLAB_POOL<TASK_FRAME_T, TASK_FRAMES> ASYNC_TASK::frames;
+
+void* ASYNC_TASK::promise_type::operator new(size_t size) noexcept {
+    TASK_FRAME_T* frame = size <= sizeof(TASK_FRAME_T) ? frames.Acquire() : nullptr;
+    if (frame == nullptr) {
+        DEBUG_WRITE("TASK: No frame for %u bytes\n", (unsigned)size);
+        stats.exhausted++;
+        return nullptr;
+    }
+
+    stats.started++;
+    return frame;
+}
+
+void ASYNC_TASK::promise_type::operator delete(void* frame) {
+    frames.Release(static_cast<TASK_FRAME_T*>(frame));
+}
+
+void ASYNC_TASK::promise_type::unhandled_exception() {
+    abort();
+}
+
+void ASYNC_TASK::promise_type::FINAL_AWAITER::await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+    // The frame stays until the owner destroys it, the worker tells the owner it can collect the result
+    if (handle.promise().notify != nullptr) async_context_set_work_pending(context, handle.promise().notify);
+}
+
+ASYNC_TASK& ASYNC_TASK::operator=(ASYNC_TASK&& other) noexcept {
+    if (this != &other) {
+        Destroy();
+        handle = other.handle;
+        other.handle = nullptr;
+    }
+    return *this;
+}
+
+void ASYNC_TASK::Start(async_when_pending_worker_t* notify) {
+    handle.promise().notify = notify;
+    handle.resume();
+}
+
+void ASYNC_TASK::Destroy() {
+    if (!handle) return;
+
+    handle.destroy();
+    handle = nullptr;
+}
+
+void ASYNC_TASK::Attach(async_context_t* context) {
+    ASYNC_TASK::context = context;
+}
+
+ASYNC_SLEEP::~ASYNC_SLEEP() {
+    // Destroyed while waiting, the timer must not resume a freed frame
+    if (armed) async_context_remove_at_time_worker(ASYNC_TASK::context, &worker);
+}
+
+bool ASYNC_SLEEP::await_suspend(std::coroutine_handle<> handle) {
+    this->handle = handle;
+    worker.do_work = Wake;
+    worker.user_data = this;
+
+    // Carry straight on if the timer could not be added
+    armed = async_context_add_at_time_worker_in_ms(ASYNC_TASK::context, &worker, ms);
+    return armed;
+}
+
+void ASYNC_SLEEP::Wake(async_context_t* context, async_at_time_worker_t* worker) {
+    ASYNC_SLEEP* sleep = static_cast<ASYNC_SLEEP*>(worker->user_data);
+
+    // The task may finish and free this awaiter while it runs
+    sleep->armed = false;
+    sleep->handle.resume();
+}
@@ -0,0 +1,228 @@
+/**
+ *@file WebSocket.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-05-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifdef DEBUG_WEBSOCKET
+#define DEBUG_WRITE printf
+#else
+#define DEBUG_WRITE //
+#endif
+
+#include <cstdio>
+#include <cstring>
+
+#include <lwipopts.h>
+#include <WebSocket.hpp>
+
+static uint32_t Rotate(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void Sha1Block(uint32_t state[5], const uint8_t* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+            (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i) w[i] = Rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t t = Rotate(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = Rotate(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void WsSha1(const uint8_t* data, size_t len, uint8_t digest[20]) {
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) Sha1Block(state, data + i);
+
+    // Last partial block, the 0x80 marker and the bit length, spilling into a second block if needed
+    uint8_t block[128] = {};
+    size_t rest = len - i;
+    memcpy(block, data + i, rest);
+    block[rest] = 0x80;
+
+    size_t blocks = rest + 9 > 64 ? 2 : 1;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int j = 0; j < 8; ++j) block[blocks * 64 - 1 - j] = bits >> (j * 8);
+
+    for (size_t j = 0; j < blocks; ++j) Sha1Block(state, block + j * 64);
+
+    for (int j = 0; j < 20; ++j) digest[j] = state[j / 4] >> (24 - (j % 4) * 8);
+}
+
+size_t WsBase64(const uint8_t* data, size_t len, char* out) {
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+
+        out[n++] = ALPHABET[(v >> 18) & 0x3F];
+        out[n++] = ALPHABET[(v >> 12) & 0x3F];
+        out[n++] = i + 1 < len ? ALPHABET[(v >> 6) & 0x3F] : '=';
+        out[n++] = i + 2 < len ? ALPHABET[v & 0x3F] : '=';
+    }
+    out[n] = '\0';
+
+    return n;
+}
+
+bool WsAccept(const char* key, size_t key_len, char* out) {
+    if (key_len != WS_KEY_LENGTH) return false;
+
+    uint8_t input[WS_KEY_LENGTH + sizeof(WS_GUID) - 1];
+    memcpy(input, key, WS_KEY_LENGTH);
+    memcpy(input + WS_KEY_LENGTH, WS_GUID, sizeof(WS_GUID) - 1);
+
+    uint8_t digest[20];
+    WsSha1(input, sizeof(input), digest);
+    WsBase64(digest, sizeof(digest), out);
+
+    return true;
+}
+
+size_t WsFrameHeader(uint8_t* header, uint8_t opcode, size_t len) {
+    header[0] = 0x80 | opcode;
+    if (len < 126) {
+        header[1] = len;
+        return 2;
+    }
+
+    header[1] = 126;
+    header[2] = len >> 8;
+    header[3] = len;
+    return 4;
+}
+
+void WS_PARSER::Append(struct pbuf* p) {
+    if (data == nullptr) {
+        data = p;
+    } else {
+        pbuf_cat(data, p);
+    }
+}
+
+WS_STATUS WS_PARSER::Parse(uint8_t* message, size_t max_len) {
+    while (data != nullptr && data->tot_len >= 2) {
+        uint8_t header[WS_MAX_HEADER];
+        uint16_t available = pbuf_copy_partial(data, header, LWIP_MIN(data->tot_len, sizeof(header)), 0);
+
+        bool fin = header[0] & 0x80;
+        uint8_t frame_opcode = header[0] & 0x0F;
+        bool control_frame = frame_opcode & 0x08;
+
+        // No extensions are negotiated, and every client frame must be masked
+        if ((header[0] & 0x70) != 0 || (header[1] & 0x80) == 0) return WS_PROTOCOL_ERROR;
+
+        uint64_t len = header[1] & 0x7F;
+        size_t header_len = (len == 126 ? 4 : len == 127 ? 10 : 2) + 4;
+        if (available < header_len) return WS_INCOMPLETE;
+
+        if (len == 126) {
+            len = (uint16_t)(header[2] << 8 | header[3]);
+        } else if (len == 127) {
+            len = 0;
+            for (int i = 2; i < 10; ++i) len = len << 8 | header[i];
+        }
+        const uint8_t* mask = header + header_len - 4;
+
+        uint8_t* target;
+        if (control_frame) {
+            if (!fin || len > WS_MAX_CONTROL) return WS_PROTOCOL_ERROR;
+            if (frame_opcode != WS_OPCODE_CLOSE && frame_opcode != WS_OPCODE_PING && frame_opcode != WS_OPCODE_PONG) {
+                return WS_PROTOCOL_ERROR;
+            }
+            target = control;
+        } else {
+            // A continuation needs a message to continue, a new message needs the last one finished
+            if (frame_opcode == WS_OPCODE_CONTINUATION ? message_opcode == 0 : message_opcode != 0) return WS_PROTOCOL_ERROR;
+            if (frame_opcode != WS_OPCODE_CONTINUATION && frame_opcode != WS_OPCODE_TEXT &&
+                frame_opcode != WS_OPCODE_BINARY) {
+                return WS_PROTOCOL_ERROR;
+            }
+            if (len > max_len - message_length) return WS_TOO_LARGE;
+            target = message + message_length;
+        }
+
+        if (data->tot_len < header_len + len) return WS_INCOMPLETE;
+
+        pbuf_copy_partial(data, target, len, header_len);
+        for (size_t i = 0; i < len; ++i) target[i] ^= mask[i & 3];
+        data = pbuf_free_header(data, header_len + len);
+
+        if (control_frame) {
+            opcode = frame_opcode;
+            length = len;
+            return WS_CONTROL;
+        }
+
+        if (frame_opcode != WS_OPCODE_CONTINUATION) message_opcode = frame_opcode;
+        message_length += len;
+        if (!fin) continue;
+
+        opcode = message_opcode;
+        length = message_length;
+        message_opcode = 0;
+        message_length = 0;
+        DEBUG_WRITE("WS: Message opcode %u, %u bytes\n", opcode, (unsigned)length);
+        return WS_MESSAGE;
+    }
+
+    return WS_INCOMPLETE;
+}
+
+void WS_PARSER::Reset() {
+    if (data != nullptr) pbuf_free(data);
+    data = nullptr;
+
+    opcode = 0;
+    length = 0;
+    message_opcode = 0;
+    message_length = 0;
+}
+
+bool WS_PARSER::Buffered() const {
+    return data != nullptr && data->tot_len > 0;
+}
+
+uint16_t WS_PARSER::Size() const {
+    return data != nullptr ? data->tot_len : 0;
+}
@@ -0,0 +1,58 @@
+/**
+ *@file Zone.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief
+ * @version 0.1
+ * @date 2024-06-15
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <Zone.hpp>
+
+/**
+ * @brief Names with an answer of their own, add local hosts here.
+ * Anything not listed gets the portal address.
+ */
+static constexpr DNS_ZONE_T ZONE_LIST[] = {
+    { "neko.local", DNS_ANSWER_ADDRESS, 0 },
+    { "*.neko", DNS_ANSWER_ADDRESS, 0 },
+
+    // Browsers and phones look these up to decide whether to bypass local DNS
+    { "use-application-dns.net", DNS_ANSWER_NXDOMAIN, 0 },  // Firefox keeps DNS over HTTPS off
+    { "mask.icloud.com", DNS_ANSWER_NXDOMAIN, 0 },          // iCloud Private Relay stays off
+    { "mask-h2.icloud.com", DNS_ANSWER_NXDOMAIN, 0 },
+};
+
+static constexpr DNS_ZONE_TABLE<sizeof(ZONE_LIST) / sizeof(ZONE_LIST[0])> table(ZONE_LIST);
+
+bool DnsNameEquals(const uint8_t* name, const char* dotted) {
+    while (*name != 0) {
+        uint8_t label = *name++;
+        for (uint8_t i = 0; i < label; ++i, ++name, ++dotted) {
+            if (*dotted == '\0' || DnsLower(*name) != DnsLower(*dotted)) return false;
+        }
+
+        if (*name != 0 && *dotted++ != '.') return false;
+    }
+    return *dotted == '\0';
+}
+
+bool DnsNameEquals(const uint8_t* a, const uint8_t* b) {
+    while (*a != 0) {
+        if (*a != *b) return false;
+
+        uint8_t label = *a;
+        for (uint8_t i = 1; i <= label; ++i) {
+            if (DnsLower(a[i]) != DnsLower(b[i])) return false;
+        }
+        a += label + 1;
+        b += label + 1;
+    }
+    return *b == 0;
+}
+
+const DNS_ZONE_T* DNS_ZONE::Find(const uint8_t* name) {
+    return table.Find(name);
+}
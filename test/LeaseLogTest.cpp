@@ -0,0 +1,178 @@
+/**
+ *@file LeaseLogTest.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief Lease log against the host flash image: record, flush, restart and compare.
+ * @version 0.1
+ * @date 2024-08-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ERROR_WRITE(...) fprintf(stderr, __VA_ARGS__)
+
+#define TEST_CLIENTS    (3)
+#define TEST_LEASE_S    (3600)
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            ERROR_WRITE("%s:%d: %s\n", __FILE__, __LINE__, #condition);         \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+#include <cstdio>
+#include <cstring>
+
+#include <Flash.hpp>
+#include <Lease.hpp>
+#include <LeaseLog.hpp>
+
+static int failures;
+static uint32_t now = 1000;
+
+static void Mac(uint8_t* mac, uint8_t client) {
+    static const uint8_t BASE[6] = { 0x02, 0x4E, 0x4B, 0x00, 0x00, 0x00 };
+    memcpy(mac, BASE, sizeof(BASE));
+    mac[5] = client;
+}
+
+/**
+ * @brief Binds a client the way the DHCP server does, table first and then the log.
+ */
+static uint8_t Bind(LEASE_TABLE* table, uint8_t client) {
+    uint8_t mac[6];
+    Mac(mac, client);
+
+    LEASE_T* lease = table->Allocate(mac, now);
+    if (lease == NULL) return 0;
+    table->Bind(lease, now, TEST_LEASE_S);
+    LEASE_LOG::Record(mac, table->Address(lease), TEST_LEASE_S, now);
+    return table->Address(lease);
+}
+
+static void Release(LEASE_TABLE* table, uint8_t client) {
+    uint8_t mac[6];
+    Mac(mac, client);
+
+    LEASE_T* lease = table->Find(mac);
+    if (lease == NULL) return;
+    LEASE_LOG::Record(mac, table->Address(lease), 0, now);
+    table->Release(lease);
+}
+
+/**
+ * @brief Address the client is bound to, 0 if it is not.
+ */
+static uint8_t Bound(LEASE_TABLE* table, uint8_t client) {
+    uint8_t mac[6];
+    Mac(mac, client);
+
+    const LEASE_T* lease = table->Find(mac);
+    return lease != NULL && lease->state == LEASE_BOUND ? table->Address(lease) : 0;
+}
+
+/**
+ * @brief Live sector, the valid header with the highest generation.
+ */
+static size_t LiveSector() {
+    size_t live = 0;
+    uint32_t highest = 0;
+    for (size_t i = 0; i < FLASH_STORE_SECTORS; ++i) {
+        LEASE_LOG_HEADER_T header;
+        memcpy(&header, FLASH_STORE::Read(i * FLASH_SECTOR_SIZE), sizeof(header));
+        if (header.magic == LEASE_LOG_MAGIC && header.generation >= highest) {
+            live = i;
+            highest = header.generation;
+        }
+    }
+    return live;
+}
+
+/**
+ * @brief Clears one bit of the last record for a client, a program torn by a reset looks the same.
+ *
+ * @return bool false if the client has no record in the live sector
+ */
+static bool Corrupt(uint8_t client) {
+    uint8_t mac[6];
+    Mac(mac, client);
+
+    uint32_t found = 0;
+    uint32_t base = LiveSector() * FLASH_SECTOR_SIZE;
+    for (size_t slot = 1; slot < LEASE_LOG_SLOTS; ++slot) {
+        const LEASE_RECORD_T* record = (const LEASE_RECORD_T*)FLASH_STORE::Read(base + slot * sizeof(LEASE_RECORD_T));
+        if (memcmp(record->mac, mac, sizeof(mac)) == 0) found = base + slot * sizeof(LEASE_RECORD_T);
+    }
+    if (found == 0) return false;
+
+    // Flash only clears bits without an erase, so take one out of the address
+    static uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t start = found & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+    memcpy(page, FLASH_STORE::Read(start), FLASH_PAGE_SIZE);
+
+    LEASE_RECORD_T* record = (LEASE_RECORD_T*)(page + (found - start));
+    record->address &= record->address - 1;
+    return FLASH_STORE::Program(start, page);
+}
+
+int main() {
+    uint8_t addresses[TEST_CLIENTS];
+
+    // Blank flash starts a log and restores nothing
+    LEASE_TABLE blank;
+    CHECK(LEASE_LOG::Start(&blank, now) == 0);
+    CHECK(LEASE_LOG::stats.compactions == 1);
+
+    // Bind every client, give one back, and write it all out
+    LEASE_TABLE table;
+    for (uint8_t i = 0; i < TEST_CLIENTS; ++i) addresses[i] = Bind(&table, i);
+    Release(&table, 1);
+    LEASE_LOG::Flush(&table, now, true);
+
+    now += 1000;
+    LEASE_TABLE restarted;
+    CHECK(LEASE_LOG::Start(&restarted, now) == TEST_CLIENTS - 1);
+    CHECK(Bound(&restarted, 0) == addresses[0]);
+    CHECK(Bound(&restarted, 1) == 0);
+    CHECK(Bound(&restarted, 2) == addresses[2]);
+    CHECK(LEASE_LOG::stats.corrupt == 0);
+
+    // Renewals fill the sector until a flush has to compact into the next one
+    uint32_t compactions = LEASE_LOG::stats.compactions;
+    for (size_t i = 0; i < LEASE_LOG_SLOTS && LEASE_LOG::stats.compactions == compactions; ++i) {
+        now += 1000;
+        Bind(&restarted, 0);
+        Bind(&restarted, 2);
+        LEASE_LOG::Flush(&restarted, now, true);
+    }
+    CHECK(LEASE_LOG::stats.compactions == compactions + 1);
+
+    now += 1000;
+    LEASE_TABLE compacted;
+    CHECK(LEASE_LOG::Start(&compacted, now) == TEST_CLIENTS - 1);
+    CHECK(Bound(&compacted, 0) == addresses[0]);
+    CHECK(Bound(&compacted, 1) == 0);
+    CHECK(Bound(&compacted, 2) == addresses[2]);
+
+    // A record that fails its check is skipped, the one before it stands
+    Release(&compacted, 2);
+    LEASE_LOG::Flush(&compacted, now, true);
+    CHECK(Corrupt(2));
+
+    now += 1000;
+    uint32_t corrupt = LEASE_LOG::stats.corrupt;
+    LEASE_TABLE torn;
+    CHECK(LEASE_LOG::Start(&torn, now) == TEST_CLIENTS - 1);
+    CHECK(LEASE_LOG::stats.corrupt == corrupt + 1);
+    CHECK(Bound(&torn, 0) == addresses[0]);
+    CHECK(Bound(&torn, 2) == addresses[2]);
+
+    if (failures > 0) {
+        ERROR_WRITE("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("Lease log: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ *@file RingTest.cpp
+ * @author Muhd Syamim (Syazam33@gmail.com)
+ * @brief SPSC_RING between two host threads standing in for the two cores.
+ * @version 0.1
+ * @date 2024-08-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#define ERROR_WRITE(...) fprintf(stderr, __VA_ARGS__)
+
+#define TEST_RING_SIZE  (8)         // TCP_WORK_QUEUE
+#define TEST_ITEMS      (4000000)   // Pushed through the ring by the threads
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            ERROR_WRITE("%s:%d: %s\n", __FILE__, __LINE__, #condition);         \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <Ring.hpp>
+#include <Routes.hpp>
+
+/**
+ * @brief Shaped like TCP_WORK_T, every field derived from the sequence number
+ * so a torn or stale copy shows up as a mismatch.
+ */
+typedef struct TEST_ITEM_T_ {
+    uint32_t sequence;
+    const void* route;
+    HTTP_RESPONSE_T response;
+} TEST_ITEM_T;
+
+static int failures;
+
+static void Fill(TEST_ITEM_T* item, uint32_t sequence) {
+    memset(item, 0, sizeof(*item));
+    item->sequence = sequence;
+    item->route = reinterpret_cast<const void*>(static_cast<uintptr_t>(sequence) * 8 + 8);
+    item->response.status = (int)(sequence % 600);
+    item->response.body_len = sequence ^ 0x5A5A5A5Au;
+    item->response.content_length = (int32_t)(sequence * 3);
+}
+
+static bool Intact(const TEST_ITEM_T& item) {
+    TEST_ITEM_T expected;
+    Fill(&expected, item.sequence);
+    return item.route == expected.route && item.response.status == expected.response.status &&
+        item.response.body_len == expected.response.body_len &&
+        item.response.content_length == expected.response.content_length;
+}
+
+static void FullAndEmpty() {
+    static SPSC_RING<TEST_ITEM_T, TEST_RING_SIZE> ring;
+    TEST_ITEM_T item;
+
+    CHECK(ring.Empty());
+    CHECK(!ring.Pop(&item));
+
+    for (uint32_t i = 0; i < TEST_RING_SIZE; ++i) {
+        Fill(&item, i);
+        CHECK(ring.Push(item));
+    }
+    Fill(&item, TEST_RING_SIZE);
+    CHECK(!ring.Push(item));
+    CHECK(!ring.Empty());
+
+    // One out makes room for exactly one more, and order survives the wrap
+    CHECK(ring.Pop(&item) && item.sequence == 0);
+    Fill(&item, TEST_RING_SIZE);
+    CHECK(ring.Push(item));
+    CHECK(!ring.Push(item));
+
+    for (uint32_t i = 1; i <= TEST_RING_SIZE; ++i) {
+        CHECK(ring.Pop(&item) && item.sequence == i && Intact(item));
+    }
+    CHECK(!ring.Pop(&item));
+    CHECK(ring.Empty());
+}
+
+static void Threads() {
+    static SPSC_RING<TEST_ITEM_T, TEST_RING_SIZE> ring;
+    uint32_t full = 0;
+    uint32_t empty = 0;
+    uint32_t received = 0;
+    uint32_t out_of_order = 0;
+    uint32_t torn = 0;
+
+    std::thread producer([&] {
+        TEST_ITEM_T item;
+        for (uint32_t i = 0; i < TEST_ITEMS; ++i) {
+            Fill(&item, i);
+            while (!ring.Push(item)) {
+                full++;
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::thread consumer([&] {
+        TEST_ITEM_T item;
+        while (received < TEST_ITEMS) {
+            if (!ring.Pop(&item)) {
+                empty++;
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Anything lost or popped twice breaks the sequence
+            if (item.sequence != received) out_of_order++;
+            if (!Intact(item)) torn++;
+            received = item.sequence + 1;
+        }
+    });
+
+    producer.join();
+    consumer.join();
+
+    CHECK(received == TEST_ITEMS);
+    CHECK(out_of_order == 0);
+    CHECK(torn == 0);
+    CHECK(ring.Empty());
+    printf("Ring: %u items, producer found it full %u times, consumer found it empty %u times\n",
+        (unsigned)TEST_ITEMS, (unsigned)full, (unsigned)empty);
+}
+
+int main() {
+    FullAndEmpty();
+    Threads();
+
+    if (failures > 0) {
+        ERROR_WRITE("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("Ring: all checks passed\n");
+    return 0;
+}
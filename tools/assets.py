@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Packs a directory of web assets into a C++ table served from flash.
+
+Usage: assets.py <web directory> <output .cpp>
+
+Every file gets its Content-Type, a strong ETag and, when it is smaller,
+a gzip variant. The response headers are written out here too, so serving
+an asset only has to add the Connection line. The output is deterministic
+so unchanged assets do not trigger a relink.
+"""
+
+import gzip
+import hashlib
+import os
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html; charset=utf-8",
+    ".htm": "text/html; charset=utf-8",
+    ".css": "text/css; charset=utf-8",
+    ".js": "application/javascript; charset=utf-8",
+    ".json": "application/json",
+    ".txt": "text/plain; charset=utf-8",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".jpg": "image/jpeg",
+    ".jpeg": "image/jpeg",
+    ".gif": "image/gif",
+    ".ico": "image/x-icon",
+    ".woff2": "font/woff2",
+}
+
+# Already compressed formats are not worth a gzip variant
+INCOMPRESSIBLE = {".png", ".jpg", ".jpeg", ".gif", ".woff2"}
+
+
+def c_array(name, data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "static const uint8_t %s[%d] = {\n%s\n};\n" % (name, max(len(data), 1), "\n".join(lines))
+
+
+def c_string(name, text):
+    escaped = text.replace("\\", "\\\\").replace('"', '\\"').replace("\r\n", "\\r\\n")
+    return 'static const char %s[] = "%s";\n' % (name, escaped)
+
+
+def validators(etag):
+    return [
+        "Vary: Accept-Encoding",
+        "Cache-Control: no-cache",
+        "ETag: %s" % etag,
+    ]
+
+
+def response_header(content_type, etag, length, encoding=None):
+    lines = [
+        "HTTP/1.1 200 OK",
+        "Content-Type: %s" % content_type,
+        "Content-Length: %d" % length,
+    ]
+    if encoding is not None:
+        lines.append("Content-Encoding: %s" % encoding)
+    lines += validators(etag)
+    return "".join(line + "\r\n" for line in lines)
+
+
+def not_modified_header(etag):
+    # Caches update the stored response from these, so they match the 200
+    lines = ["HTTP/1.1 304 Not Modified"] + validators(etag)
+    return "".join(line + "\r\n" for line in lines)
+
+
+def c_quoted(text):
+    return text.replace('"', '\\"')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+
+    root, output = sys.argv[1], sys.argv[2]
+
+    files = []
+    for directory, _, names in os.walk(root):
+        for name in names:
+            path = os.path.join(directory, name)
+            files.append("/" + os.path.relpath(path, root).replace(os.sep, "/"))
+    files.sort()
+
+    arrays = []
+    entries = []
+    for i, url in enumerate(files):
+        with open(os.path.join(root, url[1:]), "rb") as f:
+            data = f.read()
+
+        extension = os.path.splitext(url)[1].lower()
+        content_type = CONTENT_TYPES.get(extension, "application/octet-stream")
+        digest = hashlib.sha256(data).hexdigest()[:16]
+        etag = '"%s"' % digest
+
+        arrays.append(c_array("ASSET_%d" % i, data))
+        arrays.append(c_string("ASSET_%d_HEADER" % i, response_header(content_type, etag, len(data))))
+        arrays.append(c_string("ASSET_%d_NOT_MODIFIED" % i, not_modified_header(etag)))
+
+        compressed = None
+        if extension not in INCOMPRESSIBLE:
+            compressed = gzip.compress(data, compresslevel=9, mtime=0)
+            if len(compressed) >= len(data):
+                compressed = None
+
+        if compressed is not None:
+            # A strong ETag names exact bytes, so the gzip variant has its own
+            gzip_etag = '"%s-gz"' % digest
+            arrays.append(c_array("ASSET_%d_GZIP" % i, compressed))
+            arrays.append(c_string("ASSET_%d_GZIP_HEADER" % i,
+                response_header(content_type, gzip_etag, len(compressed), "gzip")))
+            arrays.append(c_string("ASSET_%d_GZIP_NOT_MODIFIED" % i, not_modified_header(gzip_etag)))
+            gzip_ref = ('"%s", ASSET_%d_GZIP, %d, ASSET_%d_GZIP_HEADER, sizeof(ASSET_%d_GZIP_HEADER) - 1,\n'
+                '        ASSET_%d_GZIP_NOT_MODIFIED, sizeof(ASSET_%d_GZIP_NOT_MODIFIED) - 1') % (
+                c_quoted(gzip_etag), i, len(compressed), i, i, i, i)
+        else:
+            gzip_ref = "nullptr, nullptr, 0, nullptr, 0, nullptr, 0"
+
+        entries.append('    { "%s", "%s", "%s", ASSET_%d, %d, ASSET_%d_HEADER, sizeof(ASSET_%d_HEADER) - 1,\n'
+            '        ASSET_%d_NOT_MODIFIED, sizeof(ASSET_%d_NOT_MODIFIED) - 1,\n        %s },' % (
+            url, content_type, c_quoted(etag), i, len(data), i, i, i, i, gzip_ref))
+
+    with open(output + ".tmp", "w", newline="\n") as f:
+        f.write("// Generated by tools/assets.py from %s, do not edit.\n\n" % os.path.basename(os.path.normpath(root)))
+        f.write("#include <Assets.hpp>\n\n")
+        f.write("\n".join(arrays))
+        # An empty directory still needs a non-empty array
+        f.write("\nconst ASSET_T ASSET_STORE::table[] = {\n%s\n};\n\n" % ("\n".join(entries) or "    {},"))
+        f.write("const size_t ASSET_STORE::count = %d;\n" % len(entries))
+
+    # Only touch the output when it changes
+    if os.path.exists(output):
+        with open(output, "rb") as old, open(output + ".tmp", "rb") as new:
+            if old.read() == new.read():
+                os.remove(output + ".tmp")
+                return
+    os.replace(output + ".tmp", output)
+
+
+if __name__ == "__main__":
+    main()